@@ -0,0 +1,425 @@
+#!/usr/bin/env python3
+"""Benchmark driver: every echo server variant on loopback, swept over connections x payload size.
+
+For each (server, connections, payload) it starts the server, runs the load generator against it
+(tcp_client --load / udp_echo_client --load), and records
+    throughput, latency percentiles, server CPU and peak server RSS (all of its processes)
+into a JSON file. With --baseline it diffs the new numbers against a saved run and exits 2 when
+something got slower than the tolerance allows, so it can gate changes to the echo loops.
+
+    cmake -S . -B build && cmake --build build -j
+    bench/bench.py --build build --out base.json                       # full sweep
+    bench/bench.py --build build --quick --baseline base.json          # compare a change
+    bench/bench.py --build build --servers tcp_epoll,tcp_coro --conns 64 --sizes 64,4096
+    bench/bench.py --build build --replay traffic.cap --baseline base.json  # real traffic, see below
+
+With --replay LOG the sweep is replaced by one run per server of a captured log (a server started
+with --capture, see README "Capture and replay"), played back by echo_replay at --replay-speed.
+Only servers of the log's protocol are run; the result's conns is the number of flows in the log.
+
+The load generator shares the machine with the server, so absolute numbers mean little;
+compare runs from the same box only.
+"""
+
+import argparse
+import json
+import os
+import re
+import resource
+import signal
+import socket
+import subprocess
+import sys
+import threading
+import time
+
+PORT = 8080
+CLK_TCK = os.sysconf("SC_CLK_TCK")
+PAGE_KB = os.sysconf("SC_PAGE_SIZE") // 1024
+
+# name -> (protocol, binary, args, max connections it can sensibly take)
+# {conns} in args is replaced by the connection count of the run, {ncpu} by the number of CPUs
+SERVERS = {
+    "tcp_multi_fork":    ("tcp", "tcp_multi_server", ["--mode", "fork", "--quiet"], 1000),
+    "tcp_multi_prefork": ("tcp", "tcp_multi_server", ["--mode", "prefork", "--workers", "{conns}", "--quiet"], 1000),
+    "tcp_multi_threads": ("tcp", "tcp_multi_server", ["--mode", "threads", "--workers", "{conns}", "--quiet"], 1000),
+    "tcp_epoll":         ("tcp", "tcp_epoll_server", [], None),
+    "tcp_epoll_uring":   ("tcp", "tcp_epoll_server", ["--uring"], None),
+    "tcp_coro":          ("tcp", "tcp_coro_server", [], None),
+    "tcp_reactor_epoll": ("tcp", "tcp_reactor_server", ["--backend", "epoll", "--quiet"], None),
+    "tcp_reactor_uring": ("tcp", "tcp_reactor_server", ["--backend", "uring", "--quiet"], None),
+    "tcp_reactor_kqueue": ("tcp", "tcp_reactor_server", ["--backend", "kqueue", "--quiet"], None),
+    "udp_echo":          ("udp", "udp_echo_server", ["--quiet"], None),
+    "udp_epoll":         ("udp", "udp_epoll_server", ["--quiet"], None),
+    "udp_epoll_uring":   ("udp", "udp_epoll_server", ["--uring", "--quiet"], None),
+    "udp_epoll_sharded": ("udp", "udp_epoll_server", ["--workers", "{ncpu}", "--quiet"], None),
+    # a limit nobody reaches: what the per-datagram bucket lookup costs
+    "udp_epoll_limited": ("udp", "udp_epoll_server", ["--rate-limit", "1000000000", "--quiet"], None),
+    "udp_reactor_uring": ("udp", "udp_epoll_server", ["--backend", "uring", "--quiet"], None),
+    "udp_reactor_kqueue": ("udp", "udp_epoll_server", ["--backend", "kqueue", "--quiet"], None),
+}
+
+# event loop backends of the reactor servers (common/reactor.h) on this platform
+BACKENDS = {"epoll", "uring"} if sys.platform.startswith("linux") else {"kqueue"}
+
+UDP_MAX_PAYLOAD = 2048    # the most udp_echo_client --load sends
+UDP_MAX_SOCKETS = 256     # the UDP load generator spreads its rate over sockets, more adds nothing
+
+FULL_CONNS = [1, 10, 100, 1000, 10000]
+FULL_SIZES = [16, 256, 4096, 65536]
+QUICK_CONNS = [1, 64]
+QUICK_SIZES = [64, 16384]
+
+
+def csv_ints(s):
+    return [int(x) for x in s.split(",") if x]
+
+
+# ---- process tree accounting ----
+
+def children_of():
+    """ppid -> [pid] for every process on the box."""
+    kids = {}
+    for d in os.listdir("/proc"):
+        if not d.isdigit():
+            continue
+        try:
+            with open(f"/proc/{d}/stat") as f:
+                fields = f.read().rsplit(")", 1)[1].split()
+        except OSError:
+            continue
+        kids.setdefault(int(fields[1]), []).append(int(d))
+    return kids
+
+
+def tree(pid):
+    kids = children_of()
+    out, todo = [], [pid]
+    while todo:
+        p = todo.pop()
+        out.append(p)
+        todo.extend(kids.get(p, []))
+    return out
+
+
+def busy_seconds():
+    """CPU time the whole box spent not idle, from /proc/stat."""
+    with open("/proc/stat") as f:
+        v = [int(x) for x in f.readline().split()[1:]]
+    # user nice system idle iowait irq softirq steal (guest time is already inside user)
+    return (sum(v[:8]) - v[3] - v[4]) / CLK_TCK
+
+
+def proc_rss_kb(pid):
+    try:
+        with open(f"/proc/{pid}/statm") as f:
+            return int(f.read().split()[1]) * PAGE_KB
+    except OSError:
+        return 0
+
+
+class ServerSampler:
+    """Measures a server while the load generator runs.
+
+    CPU: per-process utime/stime are whole clock ticks, and a prefork pool of 64 workers each
+    running 9 ms reads as 0. So instead: busy time of the whole box minus what the load generator
+    and this script used (exact, from rusage once the generator is reaped). That also catches
+    fork-per-client children that come and go between samples, at the price of counting anything
+    else running on the box.
+    RSS: the server and everything it forked, sampled every 200 ms, peak kept."""
+
+    def __init__(self, pid):
+        self.pid = pid
+        self.peak_rss_kb = 0
+        self.stop = threading.Event()
+        self.busy0 = busy_seconds()
+        self.client0 = self.client_cpu()
+        self.sample()
+        self.t = threading.Thread(target=self.loop, daemon=True)
+        self.t.start()
+
+    @staticmethod
+    def client_cpu():
+        # the load generator, plus this script's own sampling
+        total = 0.0
+        for who in (resource.RUSAGE_CHILDREN, resource.RUSAGE_SELF):
+            ru = resource.getrusage(who)
+            total += ru.ru_utime + ru.ru_stime
+        return total
+
+    def sample(self):
+        self.peak_rss_kb = max(self.peak_rss_kb, sum(proc_rss_kb(p) for p in tree(self.pid)))
+
+    def loop(self):
+        while not self.stop.wait(0.2):
+            self.sample()
+
+    def finish(self):
+        """Server CPU seconds. Call after the load generator has been waited for."""
+        self.stop.set()
+        self.t.join()
+        self.sample()
+        busy = busy_seconds() - self.busy0
+        client = self.client_cpu() - self.client0
+        return max(0.0, busy - client)
+
+
+# ---- one run ----
+
+def wait_port_free(proto, timeout=10.0):
+    kind = socket.SOCK_STREAM if proto == "tcp" else socket.SOCK_DGRAM
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        s = socket.socket(socket.AF_INET, kind)
+        s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        try:
+            s.bind(("127.0.0.1", PORT))
+            return True
+        except OSError:
+            time.sleep(0.1)
+        finally:
+            s.close()
+    return False
+
+
+def wait_server_up(proto, proc, timeout=5.0):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        if proc.poll() is not None:
+            return False
+        if proto == "udp":
+            # nothing to connect to; a bound UDP port is all there is to wait for
+            if not wait_port_free("udp", 0):
+                return True
+        else:
+            try:
+                socket.create_connection(("127.0.0.1", PORT), timeout=0.5).close()
+                return True
+            except OSError:
+                pass
+        time.sleep(0.05)
+    return False
+
+
+def stop_server(proc):
+    # the server runs in its own process group, so forked children go down with it.
+    # Wait for ALL of them: a leftover prefork worker still holds the listening socket,
+    # the next server would fail to bind and the next run would measure the leftover
+    try:
+        os.killpg(proc.pid, signal.SIGTERM)
+    except ProcessLookupError:
+        return
+    try:
+        proc.wait(timeout=5)
+    except subprocess.TimeoutExpired:
+        os.killpg(proc.pid, signal.SIGKILL)
+        proc.wait()
+    deadline = time.time() + 5
+    while True:
+        try:
+            os.killpg(proc.pid, signal.SIGKILL if time.time() > deadline else 0)
+        except ProcessLookupError:
+            return
+        time.sleep(0.05)
+
+
+def parse_tcp(out):
+    r = {}
+    m = re.search(r"requests: (\d+) \(([\d.e+]+) req/s, ([\d.e+]+) MB/s each way\), errors (\d+)", out)
+    if m:
+        r.update(requests=int(m[1]), rps=float(m[2]), mbps=float(m[3]), errors=int(m[4]))
+    m = re.search(r"latency \(us\): p50 ([\d.e+]+)\s+p99 ([\d.e+]+)\s+p99\.9 ([\d.e+]+)\s+max ([\d.e+]+)", out)
+    if m:
+        r.update(p50_us=float(m[1]), p99_us=float(m[2]), p999_us=float(m[3]), max_us=float(m[4]))
+    return r
+
+
+def parse_udp(out, size):
+    r = {}
+    m = re.search(r"sent (\d+) \(([\d.e+]+) pps\), received (\d+) \(([\d.e+]+) pps\), send errors (\d+)", out)
+    if m:
+        r.update(requests=int(m[3]), rps=float(m[4]), mbps=float(m[4]) * size / 1e6, errors=int(m[5]))
+    m = re.search(r"loss ([\d.e+]+)%", out)
+    if m:
+        r["loss_pct"] = float(m[1])
+    m = re.search(r"rtt \(us\): p50 ([\d.e+]+)\s+p99 ([\d.e+]+)\s+p99\.9 ([\d.e+]+)\s+max ([\d.e+]+)", out)
+    if m:
+        r.update(p50_us=float(m[1]), p99_us=float(m[2]), p999_us=float(m[3]), max_us=float(m[4]))
+    return r
+
+
+def run_one(args, name, conns, size, replay=None):
+    proto, binary, extra, max_conns = SERVERS[name]
+    result = {"server": name, "proto": proto, "conns": conns, "size": size}
+    if replay:
+        result["replay"] = os.path.basename(args.replay)
+        if replay != {proto}:
+            result["skipped"] = "log has " + "+".join(sorted(replay)) + " traffic"
+            return result
+    elif max_conns is not None and conns > max_conns:
+        result["skipped"] = f"more than {max_conns} connections"
+        return result
+    if proto == "udp" and size > UDP_MAX_PAYLOAD and not replay:
+        result["skipped"] = f"UDP load generator sends at most {UDP_MAX_PAYLOAD} B"
+        return result
+    payload = max(size, 24) if proto == "udp" else size   # the UDP client needs room for its header
+
+    if not wait_port_free(proto):
+        result["skipped"] = f"port {PORT} busy"
+        return result
+
+    ncpu = os.cpu_count() or 1
+    cmd = [os.path.join(args.build, binary)] + [a.replace("{conns}", str(conns)).replace("{ncpu}", str(ncpu)) for a in extra]
+    server = subprocess.Popen(cmd, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, start_new_session=True)
+    try:
+        if not wait_server_up(proto, server):
+            err = server.stderr.read().decode(errors="replace") if server.poll() is not None else ""
+            result["skipped"] = "server did not start" + (": " + err.strip().splitlines()[-1] if err.strip() else "")
+            return result
+
+        if replay:
+            # speaks the tcp_client output format for either protocol
+            client = [os.path.join(args.build, "echo_replay"), args.replay, "--speed", str(args.replay_speed),
+                      "--threads", str(args.client_threads)]
+        elif proto == "tcp":
+            client = [os.path.join(args.build, "tcp_client"), "--load", "--conns", str(conns),
+                      "--threads", str(min(args.client_threads, conns)), "--size", str(payload),
+                      "--duration", str(args.duration)]
+        else:
+            client = [os.path.join(args.build, "udp_echo_client"), "--load",
+                      "--sockets", str(min(conns, UDP_MAX_SOCKETS)),
+                      "--threads", str(min(args.client_threads, conns)), "--size", str(payload),
+                      "--rate", str(args.udp_rate), "--duration", str(args.duration)]
+
+        sampler = ServerSampler(server.pid)
+        t0 = time.time()
+        try:
+            out = subprocess.run(client, capture_output=True, text=True,
+                                 timeout=(args.replay_timeout if replay else args.duration) + 60).stdout
+        except subprocess.TimeoutExpired:
+            out = ""
+        wall = time.time() - t0
+        cpu_s = sampler.finish()
+
+        result.update(parse_tcp(out) if proto == "tcp" or replay else parse_udp(out, payload))
+        if "rps" not in result:
+            result["skipped"] = "no result from load generator"
+            return result
+        result["server_cpu_pct"] = round(100.0 * cpu_s / wall, 1)
+        result["server_rss_kb"] = sampler.peak_rss_kb
+        return result
+    finally:
+        stop_server(server)
+
+
+# ---- baseline diff ----
+
+def key(r):
+    return (r["server"], r["conns"], r["size"])
+
+
+def compare(base, cur, tol_rps, tol_lat):
+    """Prints a side by side table, returns the list of regressions."""
+    old = {key(r): r for r in base["results"] if "rps" in r}
+    regressions = []
+    print(f"\n{'server':<18} {'conns':>6} {'size':>6} {'req/s':>12} {'Δ':>7} {'p99 us':>10} {'Δ':>7}")
+    for r in cur["results"]:
+        b = old.get(key(r))
+        if "rps" not in r or b is None:
+            continue
+        d_rps = (r["rps"] - b["rps"]) / b["rps"] * 100 if b["rps"] else 0.0
+        d_p99 = (r["p99_us"] - b["p99_us"]) / b["p99_us"] * 100 if b.get("p99_us") else 0.0
+        flag = ""
+        if d_rps < -tol_rps:
+            flag += " THROUGHPUT"
+        if d_p99 > tol_lat:
+            flag += " LATENCY"
+        if flag:
+            regressions.append((key(r), d_rps, d_p99))
+        print(f"{r['server']:<18} {r['conns']:>6} {r['size']:>6} {r['rps']:>12.0f} {d_rps:>+6.1f}% "
+              f"{r['p99_us']:>10.1f} {d_p99:>+6.1f}%{flag}")
+    return regressions
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--build", default="build", help="directory with the built binaries (build)")
+    ap.add_argument("--servers", help="comma separated subset of: " + ", ".join(SERVERS))
+    ap.add_argument("--conns", type=csv_ints, help="connection counts (1,10,100,1000,10000)")
+    ap.add_argument("--sizes", type=csv_ints, help="payload sizes in bytes (16,256,4096,65536)")
+    ap.add_argument("--quick", action="store_true", help="small sweep: 1,64 conns x 64,16384 B")
+    ap.add_argument("--duration", type=int, default=3, help="seconds per run (3)")
+    ap.add_argument("--client-threads", type=int, default=2, help="load generator threads (2)")
+    ap.add_argument("--udp-rate", type=int, default=100000, help="datagrams/s for the UDP runs (100000)")
+    ap.add_argument("--out", default="bench_results.json", help="where to write the results (bench_results.json)")
+    ap.add_argument("--baseline", help="results file to compare against")
+    ap.add_argument("--tolerance", type=float, default=10.0, help="allowed throughput drop in %% (10)")
+    ap.add_argument("--latency-tolerance", type=float, default=25.0, help="allowed p99 increase in %% (25)")
+    ap.add_argument("--replay", help="capture log to replay instead of the conns x sizes sweep")
+    ap.add_argument("--replay-speed", type=float, default=1.0, help="replay speed, 0 = as fast as possible (1)")
+    args = ap.parse_args()
+
+    names = args.servers.split(",") if args.servers else list(SERVERS)
+    for n in names:
+        if n not in SERVERS:
+            sys.exit(f"unknown server {n}, pick from: {', '.join(SERVERS)}")
+    # servers that weren't built on this platform (epoll on macOS), or want a backend it doesn't have
+    # (kqueue on Linux), are left out
+    def available(n):
+        srv_args = SERVERS[n][2]
+        if "--backend" in srv_args and srv_args[srv_args.index("--backend") + 1] not in BACKENDS:
+            return False
+        return os.path.exists(os.path.join(args.build, SERVERS[n][1]))
+    names = [n for n in names if available(n)]
+    conns = args.conns or (QUICK_CONNS if args.quick else FULL_CONNS)
+    sizes = args.sizes or (QUICK_SIZES if args.quick else FULL_SIZES)
+
+    replay = None
+    if args.replay:
+        info = subprocess.run([os.path.join(args.build, "echo_replay"), args.replay, "--info"],
+                              capture_output=True, text=True)
+        m = re.search(r"over ([\d.e+]+) s, flows: (\d+) tcp, (\d+) udp", info.stdout)
+        if info.returncode != 0 or not m:
+            sys.exit(f"cannot replay {args.replay}: {(info.stderr or info.stdout).strip()}")
+        replay = {p for p, n in (("tcp", int(m[2])), ("udp", int(m[3]))) if n > 0}
+        # one run per server: the whole log, under its flow count
+        conns, sizes = [int(m[2]) + int(m[3])], [0]
+        args.replay_timeout = float(m[1]) / args.replay_speed if args.replay_speed > 0 else 60
+        print(info.stdout.strip(), flush=True)
+
+    try:
+        rev = subprocess.run(["git", "rev-parse", "--short", "HEAD"], capture_output=True, text=True).stdout.strip()
+    except OSError:
+        rev = ""
+    doc = {"meta": {"date": time.strftime("%Y-%m-%dT%H:%M:%S"), "git": rev, "cpus": os.cpu_count(),
+                    "duration_s": args.duration, "client_threads": args.client_threads,
+                    "udp_rate": args.udp_rate, "replay": args.replay, "replay_speed": args.replay_speed},
+           "results": []}
+
+    for name in names:
+        for c in conns:
+            for s in sizes:
+                r = run_one(args, name, c, s, replay)
+                doc["results"].append(r)
+                if "rps" in r:
+                    print(f"{name:<18} {c:>6} conns {s:>6} B  {r['rps']:>10.0f} req/s  p50 {r['p50_us']:>8.1f} us  "
+                          f"p99 {r['p99_us']:>8.1f} us  cpu {r['server_cpu_pct']:>5.1f}%  rss {r['server_rss_kb']} kB",
+                          flush=True)
+                else:
+                    print(f"{name:<18} {c:>6} conns {s:>6} B  skipped: {r['skipped']}", flush=True)
+                # dump after every run so an interrupted sweep still leaves its results behind
+                with open(args.out, "w") as f:
+                    json.dump(doc, f, indent=1)
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            base = json.load(f)
+        regressions = compare(base, doc, args.tolerance, args.latency_tolerance)
+        if regressions:
+            print(f"\n{len(regressions)} regression(s) beyond -{args.tolerance}% req/s / +{args.latency_tolerance}% p99")
+            sys.exit(2)
+        print("\nno regressions")
+
+
+if __name__ == "__main__":
+    main()
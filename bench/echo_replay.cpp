@@ -0,0 +1,411 @@
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <chrono>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <signal.h>
+
+#include "../common/capture.h"
+#include "../common/hdr_histogram.h"
+
+// Replays a capture log (common/capture.h, written by a server started with --capture PATH)
+// against an echo server.
+//
+// Every TCP connection and every UDP peer in the log becomes one flow with its own socket here,
+// and every record goes out on its flow at its original offset from the start of the capture,
+// divided by --speed (--speed 0: as fast as the server takes it). So the replay has the real mix
+// of message sizes, the real bursts and gaps, and the real number of connections, not the
+// uniform traffic of the load generators.
+//
+// The log is never copied: sends point straight into the read-only mapping, which the kernel
+// pages in ahead of us (MADV_SEQUENTIAL).
+//
+// Latency is measured from when a message SHOULD have gone out (like tcp_client --rate), so a
+// replay that falls behind shows up in the numbers instead of quietly stretching the run.
+// TCP echoes come back in order, so a flow just counts bytes against its oldest message.
+// UDP echoes are matched to the oldest unanswered datagram of their flow. Whatever is still
+// unanswered once the echoes stop for --drain-ms counts as unanswered.
+
+struct ReplayConfig {
+    std::string log;
+    std::string host = "127.0.0.1";
+    int port = 8080;
+    double speed = 1.0;   // 0 = no pacing
+    int threads = 4;
+    int drain_ms = 1000;
+    bool info = false;
+};
+
+// One record to send, or a TCP close
+struct ReplayEvent {
+    uint64_t ts_ns;
+    uint64_t off;      // record offset in the log
+    uint32_t flow;
+    uint8_t kind;
+};
+
+struct Flow {
+    bool tcp = true;
+    int fd = -1;
+    bool connected = false;
+    bool want_out = false;
+    bool closing = false;      // the capture saw the connection end, close once everything is answered
+    std::deque<std::pair<const char*, size_t>> pending;    // not sent yet, points into the log
+    std::deque<std::pair<int64_t, uint32_t>> waiting;      // due time + length of every unanswered message
+    size_t recv_partial = 0;   // TCP: echoed bytes of the oldest waiting message so far
+};
+
+struct ThreadResult {
+    HdrHistogram hist;
+    HdrHistogram lag;          // how late each send was against its schedule
+    uint64_t completed = 0;
+    uint64_t bytes = 0;
+    uint64_t errors = 0;
+    uint64_t unanswered = 0;
+    int64_t last_ns = 0;       // time of the last echo
+};
+
+static int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void replay_thread(const ReplayConfig& cfg, const CaptureReader& log, const std::vector<ReplayEvent>& events,
+                          std::vector<Flow>& flows, int64_t start_ns, ThreadResult& res) {
+    int epfd = epoll_create1(0);
+    if (epfd < 0) { perror("epoll_create1"); return; }
+
+    sockaddr_in serv{};
+    serv.sin_family = AF_INET;
+    serv.sin_port = htons(cfg.port);
+    inet_pton(AF_INET, cfg.host.c_str(), &serv.sin_addr);
+
+    std::vector<char> rbuf(64 * 1024);
+    uint64_t inflight = 0;   // unanswered messages over all flows
+    int64_t drain_until = 0; // once everything is sent: give up when nothing came back for --drain-ms
+
+    auto set_out = [&](Flow& f, bool want) {
+        if (want == f.want_out) return;
+        f.want_out = want;
+        epoll_event ev{};
+        ev.events = EPOLLIN | (want ? (uint32_t)EPOLLOUT : 0u);
+        ev.data.ptr = &f;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, f.fd, &ev);
+    };
+
+    auto drop = [&](Flow& f) {
+        ++res.errors;
+        res.unanswered += f.waiting.size();
+        inflight -= f.waiting.size();
+        f.waiting.clear();
+        f.pending.clear();
+        f.recv_partial = 0;   // a reopened flow must not count these bytes toward its first echo
+        if (f.fd >= 0) close(f.fd);
+        f.fd = -1;
+        f.connected = false;
+    };
+
+    auto finish = [&](Flow& f) {
+        close(f.fd);   // closing also takes it out of the epoll set
+        f.fd = -1;
+        f.connected = false;
+    };
+
+    auto open_flow = [&](Flow& f) {
+        f.fd = socket(AF_INET, (f.tcp ? SOCK_STREAM : SOCK_DGRAM) | SOCK_NONBLOCK, 0);
+        if (f.fd < 0) { perror("socket"); ++res.errors; return false; }
+        if (f.tcp) {
+            int one = 1;
+            setsockopt(f.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+        // UDP too: a connected datagram socket only hears back from the server
+        if (connect(f.fd, (sockaddr*)&serv, sizeof(serv)) < 0 && errno != EINPROGRESS) {
+            perror("connect");
+            close(f.fd);
+            f.fd = -1;
+            ++res.errors;
+            return false;
+        }
+        // a new connection, the close seen for the last one doesnt apply to it
+        f.closing = false;
+        f.recv_partial = 0;
+        f.connected = !f.tcp;
+        f.want_out = f.tcp;   // EPOLLOUT reports the end of the non-blocking connect
+        epoll_event ev{};
+        ev.events = EPOLLIN | (f.tcp ? (uint32_t)EPOLLOUT : 0u);
+        ev.data.ptr = &f;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, f.fd, &ev);
+        return true;
+    };
+
+    // false = the flow broke
+    auto flush = [&](Flow& f) {
+        while (f.connected && !f.pending.empty()) {
+            auto& p = f.pending.front();
+            ssize_t n = send(f.fd, p.first, p.second, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                if (!f.tcp && errno == ECONNREFUSED) continue;   // an earlier datagram bounced, keep going
+                return false;
+            }
+            if (!f.tcp || (size_t)n == p.second) {
+                f.pending.pop_front();
+            } else {
+                p.first += n;
+                p.second -= (size_t)n;
+            }
+        }
+        set_out(f, !f.connected || !f.pending.empty());
+        return true;
+    };
+
+    auto complete = [&](Flow& f, int64_t now) {
+        res.hist.record(now - f.waiting.front().first);
+        res.bytes += f.waiting.front().second;
+        ++res.completed;
+        res.last_ns = now;
+        f.waiting.pop_front();
+        --inflight;
+        drain_until = 0;   // still making progress, restart the drain clock
+    };
+
+    auto dispatch = [&](const ReplayEvent& e, int64_t due, int64_t now) {
+        Flow& f = flows[e.flow];
+        if (e.kind == CAP_TCP_CLOSE) {
+            f.closing = true;
+            if (f.fd >= 0 && f.waiting.empty() && f.pending.empty()) finish(f);
+            return;
+        }
+        const CaptureRecord& r = log.at(e.off);
+        if (r.len == 0) return;
+        if (f.fd < 0 && !open_flow(f)) return;
+        res.lag.record(now > due ? now - due : 0);
+        f.pending.emplace_back(log.payload(e.off), r.len);
+        f.waiting.emplace_back(due, r.len);
+        ++inflight;
+        if (!flush(f)) drop(f);
+    };
+
+    auto due_of = [&](const ReplayEvent& e) {
+        return cfg.speed > 0 ? start_ns + (int64_t)((double)e.ts_ns / cfg.speed) : start_ns;
+    };
+
+    std::vector<epoll_event> evs(256);
+    size_t next = 0;
+    while (true) {
+        // a bounded batch per pass, so a burst of due sends (or --speed 0) doesnt starve the echoes
+        int64_t now = now_ns();
+        for (int k = 0; k < 256 && next < events.size() && due_of(events[next]) <= now; ++k) {
+            dispatch(events[next], due_of(events[next]), now);
+            ++next;
+            now = now_ns();   // opening a socket is not free, keep the lag honest
+        }
+        if (next == events.size()) {
+            if (inflight == 0) break;
+            if (drain_until == 0) drain_until = now + (int64_t)cfg.drain_ms * 1000000;
+            if (now >= drain_until) break;
+        }
+
+        int64_t wait_ns = next < events.size() ? due_of(events[next]) - now : drain_until - now;
+        if (wait_ns < 0) wait_ns = 0;
+        timespec ts{wait_ns / 1000000000, wait_ns % 1000000000};
+        int n = epoll_pwait2(epfd, evs.data(), (int)evs.size(), &ts, nullptr);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_pwait2");
+            break;
+        }
+
+        now = now_ns();
+        for (int i = 0; i < n; ++i) {
+            Flow& f = *(Flow*)evs[i].data.ptr;
+            if (f.fd < 0) continue;
+            if (!f.connected) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(f.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err != 0) { drop(f); continue; }
+                f.connected = true;
+            }
+            if (evs[i].events & EPOLLIN) {
+                bool broken = false;
+                while (true) {
+                    ssize_t r = recv(f.fd, rbuf.data(), rbuf.size(), 0);
+                    if (r < 0) {
+                        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                        if (errno == EINTR || (!f.tcp && errno == ECONNREFUSED)) continue;
+                        broken = true;
+                        break;
+                    }
+                    if (r == 0 && f.tcp) { broken = true; break; }
+                    if (f.tcp) {
+                        f.recv_partial += (size_t)r;
+                        while (!f.waiting.empty() && f.recv_partial >= f.waiting.front().second) {
+                            f.recv_partial -= f.waiting.front().second;
+                            complete(f, now);
+                        }
+                    } else if (!f.waiting.empty()) {
+                        complete(f, now);
+                    }
+                }
+                if (broken) { drop(f); continue; }
+            }
+            if (!flush(f)) { drop(f); continue; }
+            if (f.closing && f.waiting.empty() && f.pending.empty()) finish(f);
+        }
+    }
+
+    for (auto& f : flows) {
+        res.unanswered += f.waiting.size();
+        if (f.fd >= 0) close(f.fd);
+    }
+    close(epfd);
+}
+
+static void print_usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " LOG [options]\n"
+              << "  --host H          server address (127.0.0.1)\n"
+              << "  --port P          server port (8080)\n"
+              << "  --speed X         replay X times faster than captured, 0 = as fast as possible (1)\n"
+              << "  --threads T       client threads, flows are spread over them (4)\n"
+              << "  --drain-ms M      after the last send, give up once no echo came back for M ms (1000)\n"
+              << "  --info            only print what is in the log\n";
+}
+
+int main(int argc, char** argv) {
+    ReplayConfig cfg;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        bool has_val = i + 1 < argc;
+        if (a == "--host" && has_val) cfg.host = argv[++i];
+        else if (a == "--port" && has_val) cfg.port = atoi(argv[++i]);
+        else if (a == "--speed" && has_val) cfg.speed = atof(argv[++i]);
+        else if (a == "--threads" && has_val) cfg.threads = atoi(argv[++i]);
+        else if (a == "--drain-ms" && has_val) cfg.drain_ms = atoi(argv[++i]);
+        else if (a == "--info") cfg.info = true;
+        else if (a[0] != '-' && cfg.log.empty()) cfg.log = a;
+        else { print_usage(argv[0]); return 1; }
+    }
+    if (cfg.log.empty() || cfg.threads < 1 || cfg.speed < 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    CaptureReader log;
+    if (!log.open(cfg.log.c_str())) return 1;
+
+    // Chunks are per server thread, so file order is only roughly time order
+    std::vector<ReplayEvent> events;
+    log.for_each([&](uint64_t off, const CaptureRecord& r) {
+        events.push_back(ReplayEvent{r.ts_ns, off, 0, r.kind});
+    });
+    std::stable_sort(events.begin(), events.end(),
+                     [](const ReplayEvent& a, const ReplayEvent& b) { return a.ts_ns < b.ts_ns; });
+
+    // A flow is a live (protocol, peer ip, peer port). A TCP close ends it, so a client that
+    // reconnects from the same port later is a new flow
+    std::unordered_map<uint64_t, uint32_t> live;
+    std::vector<bool> flow_tcp;
+    uint64_t tcp_flows = 0, udp_flows = 0, bytes = 0;
+    for (auto& e : events) {
+        const CaptureRecord& r = log.at(e.off);
+        bool tcp = r.kind != CAP_UDP_DATA;
+        uint64_t k = ((uint64_t)r.ip << 32) | ((uint64_t)r.port << 1) | (tcp ? 1 : 0);
+        auto it = live.find(k);
+        if (it == live.end()) {
+            if (r.kind == CAP_TCP_CLOSE) { e.kind = 0; continue; }   // closed before it sent anything
+            it = live.emplace(k, (uint32_t)flow_tcp.size()).first;
+            flow_tcp.push_back(tcp);
+            (tcp ? tcp_flows : udp_flows)++;
+        }
+        e.flow = it->second;
+        bytes += r.len;
+        if (r.kind == CAP_TCP_CLOSE) live.erase(it);
+    }
+    events.erase(std::remove_if(events.begin(), events.end(), [](const ReplayEvent& e) { return e.kind == 0; }),
+                 events.end());
+    double span_s = events.empty() ? 0 : (double)events.back().ts_ns / 1e9;
+
+    std::cout << "Log " << cfg.log << ": " << events.size() << " records, " << bytes << " bytes over " << span_s
+              << " s, flows: " << tcp_flows << " tcp, " << udp_flows << " udp\n";
+    if (cfg.info || events.empty()) return events.empty() ? 1 : 0;
+
+    signal(SIGPIPE, SIG_IGN);
+    // every flow is a socket
+    rlimit rl{};
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    // flow i belongs to thread i % T, as local flow i / T
+    int nthreads = std::min<size_t>(cfg.threads, flow_tcp.size());
+    std::vector<std::vector<ReplayEvent>> per_thread(nthreads);
+    std::vector<std::vector<Flow>> flows(nthreads);
+    for (size_t i = 0; i < flow_tcp.size(); ++i) {
+        flows[i % nthreads].emplace_back();
+        flows[i % nthreads].back().tcp = flow_tcp[i];
+    }
+    for (auto& e : events) {
+        ReplayEvent local = e;
+        local.flow = e.flow / nthreads;
+        per_thread[e.flow % nthreads].push_back(local);
+    }
+    uint64_t first_ts = events.front().ts_ns;
+    std::vector<ReplayEvent>().swap(events);
+
+    std::cout << "Replay: speed " << (cfg.speed > 0 ? std::to_string(cfg.speed) + "x" : std::string("max"))
+              << ", " << nthreads << " threads against " << cfg.host << ":" << cfg.port << "\n";
+
+    int64_t start_ns = now_ns() + 100 * 1000000LL;
+    std::vector<ThreadResult> results(nthreads);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nthreads; ++t) {
+        threads.emplace_back(replay_thread, std::cref(cfg), std::cref(log), std::cref(per_thread[t]),
+                             std::ref(flows[t]), start_ns, std::ref(results[t]));
+    }
+    for (auto& th : threads) th.join();
+
+    HdrHistogram total, lag;
+    uint64_t completed = 0, echoed = 0, errors = 0, unanswered = 0;
+    int64_t last = start_ns;
+    for (auto& r : results) {
+        total.merge(r.hist);
+        lag.merge(r.lag);
+        completed += r.completed;
+        echoed += r.bytes;
+        errors += r.errors;
+        unanswered += r.unanswered;
+        last = std::max(last, r.last_ns);
+    }
+
+    // same lines as tcp_client --load, so bench/bench.py parses both.
+    // The rate counts from the first send, not from the (possibly quiet) start of the capture
+    int64_t first = cfg.speed > 0 ? start_ns + (int64_t)((double)first_ts / cfg.speed) : start_ns;
+    double secs = (double)(last - first) / 1e9;
+    if (secs <= 0) secs = 1e-9;
+    std::cout << "requests: " << completed << " (" << completed / secs << " req/s, "
+              << echoed / secs / 1e6 << " MB/s each way), errors " << errors << "\n";
+    std::cout << "latency (us): p50 " << total.percentile(50) / 1e3
+              << "  p99 " << total.percentile(99) / 1e3
+              << "  p99.9 " << total.percentile(99.9) / 1e3
+              << "  max " << total.max_value / 1e3
+              << "  mean " << total.mean() / 1e3 << "\n";
+    std::cout << "unanswered: " << unanswered << ", send lag (us): p50 " << lag.percentile(50) / 1e3
+              << "  p99 " << lag.percentile(99) / 1e3 << "  max " << lag.max_value / 1e3 << "\n";
+    return errors > 0 && completed == 0 ? 1 : 0;
+}
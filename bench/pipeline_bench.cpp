@@ -0,0 +1,171 @@
+#include <iostream>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../common/byte_kernels.h"
+#include "../common/pipeline.h"
+
+// Throughput of the --transform stages (common/pipeline.h) and the kernels behind them
+// (common/byte_kernels.h), in GB/s, for every SIMD level this CPU has and a range of message sizes:
+//
+//     pipeline_bench [--sizes 64,1024,16384,1048576] [--ms 200]
+//
+// Every kernel first has to agree with its scalar version on random input (CRCs equal, folded bytes
+// equal, first bad byte found at the same index), so a wrong SIMD path fails loudly here
+// instead of corrupting echoes.
+//
+// The data stays in cache for the small sizes, so those are kernel speed, not memory bandwidth.
+
+static double now_s() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static volatile uint64_t sink;
+
+// GB/s of f over a buffer of `size` bytes, repeated for about `ms` milliseconds.
+// A template, not std::function: at 64 B an indirect call per run would show up in the numbers
+template <typename F>
+static double measure(size_t size, int ms, F&& f) {
+    uint64_t acc = 0;
+    size_t reps = 1;
+    // find a batch that takes ~1 ms, so the clock reads dont count
+    while (true) {
+        double t0 = now_s();
+        for (size_t i = 0; i < reps; ++i) acc += f();
+        if (now_s() - t0 > 0.001) break;
+        reps *= 2;
+    }
+    double t0 = now_s(), t1 = t0;
+    size_t total = 0;
+    while (t1 - t0 < ms / 1000.0) {
+        for (size_t i = 0; i < reps; ++i) acc += f();
+        total += reps;
+        t1 = now_s();
+    }
+    sink = acc;
+    return (double)total * (double)size / (t1 - t0) / 1e9;
+}
+
+static std::vector<size_t> parse_sizes(const char* s) {
+    std::vector<size_t> out;
+    for (const char* p = s; *p;) {
+        out.push_back((size_t)strtoull(p, nullptr, 10));
+        p = strchr(p, ',');
+        if (!p) break;
+        ++p;
+    }
+    return out;
+}
+
+// The SIMD paths against the scalar ones, on every length up to 300 (all the tails) and a few big ones
+static bool cross_check(const std::vector<SimdLevel>& levels) {
+    std::mt19937 rng(42);
+    std::vector<char> a(70000), b(70000);
+    for (auto& c : a) c = (char)rng();
+    std::vector<size_t> lens;
+    for (size_t n = 0; n <= 300; ++n) lens.push_back(n);
+    lens.push_back(4096);
+    lens.push_back(65537);
+
+    bool ok = crc32c_scalar(0, "123456789", 9) == 0xE3069283u;
+    if (!ok) std::cerr << "crc32c scalar: wrong check value\n";
+    for (SimdLevel l : levels) {
+        for (size_t n : lens) {
+            if (crc32c_at(l, 0, a.data(), n) != crc32c_scalar(0, a.data(), n)) {
+                std::cerr << "crc32c " << simd_name(l) << " disagrees at " << n << " bytes\n";
+                ok = false;
+            }
+            memcpy(b.data(), a.data(), n);
+            std::vector<char> want(a.begin(), a.begin() + n);
+            ascii_fold_at(l, b.data(), n, 'A');
+            ascii_fold_scalar(want.data(), n, 'A');
+            if (memcmp(b.data(), want.data(), n) != 0) {
+                std::cerr << "ascii_fold " << simd_name(l) << " disagrees at " << n << " bytes\n";
+                ok = false;
+            }
+            // text with one bad byte planted somewhere (or none)
+            for (size_t i = 0; i < n; ++i) b[i] = (char)(0x20 + rng() % 0x5f);
+            if (n && rng() % 4) b[rng() % n] = (char)(rng() % 2 ? 0x7f : 0x80 + rng() % 0x80);
+            if (find_non_text_at(l, b.data(), n) != find_non_text_scalar(b.data(), n)) {
+                std::cerr << "find_non_text " << simd_name(l) << " disagrees at " << n << " bytes\n";
+                ok = false;
+            }
+        }
+    }
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    std::vector<size_t> sizes = {64, 1024, 16384, 1 << 20};
+    int ms = 200;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--sizes") == 0 && i + 1 < argc) sizes = parse_sizes(argv[++i]);
+        else if (strcmp(argv[i], "--ms") == 0 && i + 1 < argc) ms = atoi(argv[++i]);
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--sizes 64,1024,16384,1048576] [--ms 200]\n";
+            return 1;
+        }
+    }
+
+    std::vector<SimdLevel> levels = {SIMD_SCALAR};
+    if (simd_best() >= SIMD_SSE42) levels.push_back(SIMD_SSE42);
+    if (simd_best() >= SIMD_AVX2) levels.push_back(SIMD_AVX2);
+    std::cout << "best SIMD level on this CPU: " << simd_name(simd_best()) << "\n";
+    if (!cross_check(levels)) return 1;
+    std::cout << "SIMD kernels agree with scalar\n\n";
+
+    size_t max_size = 0;
+    for (size_t s : sizes) max_size = std::max(max_size, s);
+    // printable text, so the validate scan runs to the end instead of stopping at a bad byte
+    std::vector<char> buf(max_size);
+    std::mt19937 rng(7);
+    for (auto& c : buf) c = (char)(0x20 + rng() % 0x5f);
+
+    printf("%-26s %-8s", "GB/s", "level");
+    for (size_t s : sizes) printf(" %10zu B", s);
+    printf("\n");
+
+    auto row = [&](const char* name, SimdLevel l, auto f) {
+        printf("%-26s %-8s", name, simd_name(l));
+        for (size_t s : sizes) printf(" %12.2f", measure(s, ms, [&] { return f(s); }));
+        printf("\n");
+        fflush(stdout);
+    };
+
+    for (SimdLevel l : levels) {
+        row("crc32c", l, [&](size_t n) { return (uint64_t)crc32c_at(l, 0, buf.data(), n); });
+    }
+    for (SimdLevel l : levels) {
+        // folding lowercase text is a no-op on most bytes, but the kernel still reads and writes every one
+        row("ascii_fold (lower)", l, [&](size_t n) {
+            ascii_fold_at(l, buf.data(), n, 'A');
+            return (uint64_t)(unsigned char)buf[0];
+        });
+    }
+    for (SimdLevel l : levels) {
+        row("find_non_text (validate)", l, [&](size_t n) { return (uint64_t)find_non_text_at(l, buf.data(), n); });
+    }
+
+    // Whole chains as the server runs them, at the best level. run() is inlined stage by stage
+    printf("\n");
+    row("validate,lower,crc32c", simd_best(), [&](size_t n) {
+        Msg m(buf.data(), n);
+        bool ok = Pipeline<ValidateText, LowerCase, Crc32cTrailer>::run(m);
+        // use the CRC itself, or the compiler drops the (side effect free) checksum altogether
+        return (uint64_t)ok + (unsigned char)m.trailer[0] + (unsigned char)m.trailer[3];
+    });
+    // the same chain through pick_pipeline's function pointer, as --transform does
+    PipelineFn fn = pick_pipeline(TransformSpec{true, 'A', true});
+    row("  via pick_pipeline", simd_best(), [&](size_t n) {
+        Msg m(buf.data(), n);
+        bool ok = fn(m);
+        return (uint64_t)ok + (unsigned char)m.trailer[0] + (unsigned char)m.trailer[3];
+    });
+    return 0;
+}
@@ -0,0 +1,291 @@
+#pragma once
+// Asynchronous logging for the servers' hot paths.
+//
+// `std::cout << "From " << inet_ntoa(...) << buf` inside a receive loop costs a lot per message:
+// operator<< formats on the spot, the stream takes a lock, and once stdout is a pipe or file
+// every full buffer is a write() syscall made right in the middle of serving clients.
+// (inet_ntoa() also returns a static buffer, so two threads logging at once can print each other's peer.)
+//
+// Here the hot path only copies a fixed-size binary record (timestamp, fd, peer, length, first
+// LOG_PAYLOAD bytes of the data) into a ring owned by the calling thread. A background writer thread
+// drains every ring, formats the records and hands them to write() in big batches.
+//   - one ring per thread, single producer / single consumer: two atomic indices, no locks, no CAS
+//   - a full ring drops the record (and counts the drop) instead of blocking the server
+//   - levels: log_on(level) is a plain load + compare, so with logging off the hot path pays
+//     one predictable branch and nothing else
+//   - sampling: --log-sample N keeps only every Nth payload (DEBUG) record per thread
+//
+// Processes that fork workers must call log_after_fork() in the child: fork() copies the rings
+// but not the writer thread.
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+enum LogLevel : uint8_t { LOG_OFF = 0, LOG_ERROR = 1, LOG_INFO = 2, LOG_DEBUG = 3 };
+
+enum LogEvent : uint8_t {
+    LOGEV_ACCEPT,   // new connection
+    LOGEV_CLOSE,    // connection gone
+    LOGEV_RECV,     // payload received (the per-message one, usually DEBUG)
+    LOGEV_ERROR,    // errno in `len`
+};
+
+static const size_t LOG_PAYLOAD = 96;          // payload bytes kept per record
+static const size_t LOG_RING_RECORDS = 4096;   // per thread, power of 2
+
+// 128 bytes, two cache lines, fixed size so a push is one memcpy of the payload.
+// Aligned so a slot never shares a line with its neighbours (the producer and the writer
+// work on adjacent slots)
+struct alignas(64) LogRecord {
+    int64_t ts_ns;        // CLOCK_REALTIME
+    uint32_t peer_ip;     // network order, 0 if unknown
+    uint16_t peer_port;   // network order
+    uint8_t level;
+    uint8_t event;
+    int32_t fd;
+    uint32_t len;         // real payload length (or errno for LOGEV_ERROR)
+    uint16_t kept;        // payload bytes actually copied
+    uint16_t thread_id;
+    uint32_t pad;
+    char payload[LOG_PAYLOAD];
+};
+static_assert(sizeof(LogRecord) == 128, "a record is exactly two cache lines");
+
+struct LogRing {
+    alignas(64) std::atomic<uint64_t> head{0};   // next slot the producer writes
+    alignas(64) std::atomic<uint64_t> tail{0};   // next slot the writer reads
+    alignas(64) std::atomic<uint64_t> dropped{0};   // written by the producer only
+    uint64_t sample_count = 0;
+    uint16_t thread_id = 0;
+    LogRecord records[LOG_RING_RECORDS];
+};
+
+// Everything global in one place, so log_after_fork() can reset it in one go
+struct LogState {
+    std::mutex rings_mu;                  // only taken when a thread registers its ring
+    std::vector<LogRing*> rings;
+    std::thread writer;
+    std::atomic<bool> running{false};
+    int out_fd = STDOUT_FILENO;
+    uint16_t next_thread_id = 0;
+};
+
+inline uint8_t g_log_level = LOG_DEBUG;   // plain byte: set once at startup, then only read
+inline uint32_t g_log_sample = 1;         // keep 1 in N DEBUG records
+inline LogState* g_log = new LogState;    // never freed, writer may outlive main's locals
+inline thread_local LogRing* t_log_ring = nullptr;
+
+inline bool log_on(uint8_t level) { return __builtin_expect(level <= g_log_level, 0); }
+
+inline int64_t log_now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+inline LogRing* log_ring_slow() {
+    LogRing* r = new LogRing;
+    std::lock_guard<std::mutex> lk(g_log->rings_mu);
+    r->thread_id = g_log->next_thread_id++;
+    g_log->rings.push_back(r);
+    t_log_ring = r;
+    return r;
+}
+
+// The hot path. Callers check log_on(level) first so the arguments cost nothing when it is off.
+inline void log_record(uint8_t level, uint8_t event, int fd, const sockaddr_in* peer,
+                       const char* data, size_t len) {
+    LogRing* r = t_log_ring ? t_log_ring : log_ring_slow();
+    if (level == LOG_DEBUG && g_log_sample > 1 && r->sample_count++ % g_log_sample != 0) return;
+
+    uint64_t head = r->head.load(std::memory_order_relaxed);
+    if (head - r->tail.load(std::memory_order_acquire) >= LOG_RING_RECORDS) {
+        r->dropped.store(r->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return;
+    }
+    LogRecord& rec = r->records[head & (LOG_RING_RECORDS - 1)];
+    rec.ts_ns = log_now_ns();
+    rec.peer_ip = peer ? peer->sin_addr.s_addr : 0;
+    rec.peer_port = peer ? peer->sin_port : 0;
+    rec.level = level;
+    rec.event = event;
+    rec.fd = fd;
+    rec.len = (uint32_t)len;
+    size_t keep = data ? (len < LOG_PAYLOAD ? len : LOG_PAYLOAD) : 0;
+    rec.kept = (uint16_t)keep;
+    rec.thread_id = r->thread_id;
+    if (keep) memcpy(rec.payload, data, keep);
+    // publish: the writer must not see the new head before the record bytes
+    r->head.store(head + 1, std::memory_order_release);
+}
+
+inline void log_accept(int fd, const sockaddr_in& peer) {
+    if (log_on(LOG_INFO)) log_record(LOG_INFO, LOGEV_ACCEPT, fd, &peer, nullptr, 0);
+}
+inline void log_close(int fd) {
+    if (log_on(LOG_INFO)) log_record(LOG_INFO, LOGEV_CLOSE, fd, nullptr, nullptr, 0);
+}
+inline void log_recv(int fd, const sockaddr_in* peer, const char* data, size_t len) {
+    if (log_on(LOG_DEBUG)) log_record(LOG_DEBUG, LOGEV_RECV, fd, peer, data, len);
+}
+inline void log_error(int fd, int err) {
+    if (log_on(LOG_ERROR)) log_record(LOG_ERROR, LOGEV_ERROR, fd, nullptr, nullptr, (size_t)err);
+}
+
+// ---- writer side, everything below runs on the background thread ----
+
+inline size_t log_format(const LogRecord& rec, char* out, size_t cap) {
+    static const char* LEVELS[] = {"OFF", "ERROR", "INFO", "DEBUG"};
+    time_t secs = (time_t)(rec.ts_ns / 1000000000LL);
+    tm t;
+    localtime_r(&secs, &t);
+    int n = snprintf(out, cap, "%02d:%02d:%02d.%06d %-5s [t%u] fd %d",
+                     t.tm_hour, t.tm_min, t.tm_sec, (int)(rec.ts_ns % 1000000000LL / 1000),
+                     LEVELS[rec.level & 3], rec.thread_id, rec.fd);
+    if (rec.peer_ip || rec.peer_port) {
+        char ip[INET_ADDRSTRLEN];
+        in_addr a{};
+        a.s_addr = rec.peer_ip;
+        inet_ntop(AF_INET, &a, ip, sizeof(ip));
+        n += snprintf(out + n, cap - n, " %s:%u", ip, ntohs(rec.peer_port));
+    }
+    switch (rec.event) {
+    case LOGEV_ACCEPT: n += snprintf(out + n, cap - n, " connected\n"); break;
+    case LOGEV_CLOSE:  n += snprintf(out + n, cap - n, " disconnected\n"); break;
+    case LOGEV_ERROR:  n += snprintf(out + n, cap - n, " error: %s\n", strerror((int)rec.len)); break;
+    default: {
+        n += snprintf(out + n, cap - n, " %u bytes: ", rec.len);
+        // payloads are arbitrary bytes, keep the log one line per record
+        for (size_t i = 0; i < rec.kept && (size_t)n + 5 < cap; ++i) {
+            unsigned char ch = (unsigned char)rec.payload[i];
+            out[n++] = (ch >= 32 && ch < 127) ? (char)ch : '.';
+        }
+        if (rec.kept < rec.len && (size_t)n + 5 < cap) { memcpy(out + n, "...", 3); n += 3; }
+        out[n++] = '\n';
+    }
+    }
+    return (size_t)n;
+}
+
+inline void log_write_all(const char* p, size_t len) {
+    while (len > 0) {
+        ssize_t w = write(g_log->out_fd, p, len);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return;   // nowhere left to complain to
+        }
+        p += w;
+        len -= (size_t)w;
+    }
+}
+
+// One pass over every ring, returns how many records were written
+inline size_t log_drain() {
+    static thread_local std::vector<char> batch(256 * 1024);
+    static thread_local std::vector<uint64_t> reported_drops;
+    size_t used = 0, total = 0;
+
+    std::vector<LogRing*> rings;
+    {
+        std::lock_guard<std::mutex> lk(g_log->rings_mu);
+        rings = g_log->rings;
+    }
+    reported_drops.resize(rings.size(), 0);
+
+    for (size_t ri = 0; ri < rings.size(); ++ri) {
+        LogRing* r = rings[ri];
+        uint64_t tail = r->tail.load(std::memory_order_relaxed);
+        uint64_t head = r->head.load(std::memory_order_acquire);
+        for (; tail != head; ++tail) {
+            if (batch.size() - used < 512) {
+                log_write_all(batch.data(), used);
+                used = 0;
+            }
+            used += log_format(r->records[tail & (LOG_RING_RECORDS - 1)], batch.data() + used, batch.size() - used);
+            ++total;
+        }
+        // hand the slots back only after we are done reading them
+        r->tail.store(tail, std::memory_order_release);
+
+        uint64_t dropped = r->dropped.load(std::memory_order_relaxed);
+        if (dropped != reported_drops[ri]) {
+            used += snprintf(batch.data() + used, batch.size() - used, "log: thread t%u dropped %llu records (ring full)\n",
+                             r->thread_id, (unsigned long long)(dropped - reported_drops[ri]));
+            reported_drops[ri] = dropped;
+        }
+    }
+    if (used) log_write_all(batch.data(), used);
+    return total;
+}
+
+inline void log_writer_main() {
+    while (g_log->running.load(std::memory_order_acquire)) {
+        // busy rings get drained back to back, an idle server costs one wakeup per 10ms
+        if (log_drain() == 0) usleep(10 * 1000);
+    }
+    log_drain();
+}
+
+// Starts the writer thread (no-op when logging is off)
+inline void log_start(int out_fd = STDOUT_FILENO) {
+    if (g_log_level == LOG_OFF || g_log->running.load()) return;
+    g_log->out_fd = out_fd;
+    g_log->running.store(true);
+    g_log->writer = std::thread(log_writer_main);
+}
+
+// Flushes whatever is queued and stops the writer
+inline void log_stop() {
+    if (!g_log->running.exchange(false)) return;
+    g_log->writer.join();
+}
+
+// In a freshly forked child: only the forking thread survived, so the inherited writer handle and
+// every other thread's ring are meaningless here. Start over with empty state (the parent's copies
+// are simply left behind) and a writer of our own.
+inline void log_after_fork() {
+    // the old state (and its std::thread for a thread that doesnt exist here) is deliberately leaked
+    bool was_running = g_log->running.load();
+    int out_fd = g_log->out_fd;
+    g_log = new LogState;
+    t_log_ring = nullptr;
+    if (was_running) log_start(out_fd);
+}
+
+// Shared command line handling: --log-level off|error|info|debug, --log-sample N, --quiet (= off).
+// Returns true if argv[i] (and its value) was a logging option.
+inline bool log_parse_arg(int argc, char** argv, int& i) {
+    if (strcmp(argv[i], "--quiet") == 0) {
+        g_log_level = LOG_OFF;
+        return true;
+    }
+    if (i + 1 >= argc) return false;
+    if (strcmp(argv[i], "--log-level") == 0) {
+        const char* v = argv[++i];
+        if (strcmp(v, "off") == 0) g_log_level = LOG_OFF;
+        else if (strcmp(v, "error") == 0) g_log_level = LOG_ERROR;
+        else if (strcmp(v, "info") == 0) g_log_level = LOG_INFO;
+        else g_log_level = LOG_DEBUG;
+        return true;
+    }
+    if (strcmp(argv[i], "--log-sample") == 0) {
+        int n = atoi(argv[++i]);
+        g_log_sample = n > 1 ? (uint32_t)n : 1;
+        return true;
+    }
+    return false;
+}
+
+#define LOG_USAGE "[--log-level off|error|info|debug] [--log-sample N] [--quiet]"
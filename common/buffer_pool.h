@@ -0,0 +1,114 @@
+#pragma once
+// Size-class buffer pool shared by all connections of one event loop.
+//
+// Connections only borrow a buffer while they actually have bytes in flight and hand it back as
+// soon as it drains, so an idle connection owns no buffer memory at all.
+// Buffers come in a few size classes, so a 100 byte leftover takes a 512 byte buffer instead of
+// a 16 KB one. Buffers are carved out of big slabs and recycled through per-class free lists:
+// after warmup, get()/put() are a pointer pop/push, with no malloc on the hot path.
+// The pool belongs to one event loop thread, so there are no locks.
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A buffer is a small header followed by its bytes. start/end delimit the bytes that are
+// in use, so a partially written buffer needs no memmove.
+struct BufChunk {
+    BufChunk* next;    // queue link while in use, free-list link while pooled
+    uint32_t cap;      // usable bytes after the header
+    uint32_t start;
+    uint32_t end;
+    uint8_t cls;
+
+    char* data() { return reinterpret_cast<char*>(this + 1); }
+    uint32_t used() const { return end - start; }
+    uint32_t room() const { return cap - end; }
+};
+
+struct BufferPool {
+    // total size of a buffer (header included) per class
+    static constexpr uint32_t CLASS_SIZES[] = {512, 2048, 8192, 32768, 65536};
+    static const int NUM_CLASSES = 5;
+    static const size_t SLAB_SIZE = 256 * 1024;
+
+    BufChunk* free_lists[NUM_CLASSES] = {};
+    std::vector<char*> slabs;
+    size_t bytes_reserved = 0;   // everything ever carved, pooled or lent out
+
+    static uint32_t capacity(int cls) { return CLASS_SIZES[cls] - (uint32_t)sizeof(BufChunk); }
+
+    // smallest class whose buffer holds `want` bytes (the largest class if nothing does)
+    static int class_for(size_t want) {
+        for (int c = 0; c < NUM_CLASSES; ++c) {
+            if (want <= capacity(c)) return c;
+        }
+        return NUM_CLASSES - 1;
+    }
+
+    BufChunk* get(size_t want) {
+        int cls = class_for(want);
+        if (!free_lists[cls]) refill(cls);
+        BufChunk* b = free_lists[cls];
+        free_lists[cls] = b->next;
+        b->next = nullptr;
+        b->start = b->end = 0;
+        return b;
+    }
+
+    void put(BufChunk* b) {
+        b->next = free_lists[b->cls];
+        free_lists[b->cls] = b;
+    }
+
+    // Carve a fresh slab into buffers of one class (cold path, only while the pool is growing)
+    void refill(int cls) {
+        char* slab = new char[SLAB_SIZE];
+        slabs.push_back(slab);
+        bytes_reserved += SLAB_SIZE;
+        uint32_t sz = CLASS_SIZES[cls];
+        for (size_t off = 0; off + sz <= SLAB_SIZE; off += sz) {
+            BufChunk* b = reinterpret_cast<BufChunk*>(slab + off);
+            b->cap = capacity(cls);
+            b->cls = (uint8_t)cls;
+            b->next = free_lists[cls];
+            free_lists[cls] = b;
+        }
+    }
+
+    BufferPool() = default;
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    ~BufferPool() {
+        for (char* s : slabs) delete[] s;
+    }
+};
+
+// How much one read() on a TCP connection asks for, in pool classes. A read that fills the whole
+// buffer means more was waiting, so the next one asks for the next class up (up to 64 KB). A run of
+// reads that use less than a quarter steps back down. A chatty client keeps a 2 KB buffer, a bulk
+// transfer gets 64 KB per syscall after its first few reads.
+struct ReadSizer {
+    static const int START_CLASS = 1;
+    static const uint8_t SHRINK_AFTER = 16;   // small reads in a row before stepping down
+
+    uint8_t cls = START_CLASS;
+    uint8_t small_reads = 0;
+
+    size_t size() const { return BufferPool::capacity(cls); }
+
+    // Feed it every read's result. true = size() changed
+    bool update(size_t got) {
+        size_t cur = size();
+        if (got >= cur) {
+            small_reads = 0;
+            if (cls + 1 < BufferPool::NUM_CLASSES) { ++cls; return true; }
+        } else if (got < cur / 4 && cls > 0) {
+            if (++small_reads >= SHRINK_AFTER) { --cls; small_reads = 0; return true; }
+        } else {
+            small_reads = 0;
+        }
+        return false;
+    }
+};
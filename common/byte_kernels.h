@@ -0,0 +1,236 @@
+#pragma once
+// Byte kernels for the message pipeline stages (common/pipeline.h): CRC32C, ASCII case folding, and
+// scanning a message for bytes that dont belong in text.
+//
+// Each kernel exists three times:
+//     scalar   plain C++, runs anywhere
+//     sse4.2   16 bytes per step. CRC32C uses the crc32 instruction (8 bytes per instruction), the
+//              others plain SSE2 compares, which every SSE4.2 CPU has
+//     avx2     32 bytes per step (the CRC has no wider instruction, it stays at the sse4.2 version)
+// The x86 versions are compiled with __attribute__((target(...))), so the program itself still
+// builds for baseline x86-64 and runs on any CPU. Which one runs is decided ONCE, from cpuid
+// (simd_best()), and the kernels branch on that cached level: a well predicted branch per call,
+// no function pointer. bench/pipeline_bench.cpp runs every level side by side (*_at(level, ...)).
+//
+// Off x86 everything is the scalar code.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BYTE_KERNELS_X86 1
+#endif
+
+enum SimdLevel : uint8_t { SIMD_SCALAR = 0, SIMD_SSE42 = 1, SIMD_AVX2 = 2 };
+
+inline const char* simd_name(SimdLevel l) {
+    return l == SIMD_AVX2 ? "avx2" : l == SIMD_SSE42 ? "sse4.2" : "scalar";
+}
+
+inline SimdLevel simd_detect() {
+#ifdef BYTE_KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+    if (__builtin_cpu_supports("sse4.2")) return SIMD_SSE42;
+#endif
+    return SIMD_SCALAR;
+}
+
+// The best level this CPU has, looked up once at startup
+inline const SimdLevel g_simd_level = simd_detect();
+inline SimdLevel simd_best() { return g_simd_level; }
+
+// ---------------------------------------------------------------------------------------
+// CRC32C (Castagnoli, the iSCSI / ext4 / SCTP checksum). crc32c(0, "123456789", 9) == 0xE3069283.
+// Pass the previous result as `crc` to checksum a message in pieces.
+// ---------------------------------------------------------------------------------------
+
+// Slicing-by-8 tables: table[k][b] is the CRC of byte b followed by k zero bytes, so 8 input bytes
+// take 8 independent lookups instead of a chain of 8 dependent ones
+struct Crc32cTables {
+    uint32_t t[8][256];
+    constexpr Crc32cTables() : t() {
+        for (uint32_t b = 0; b < 256; ++b) {
+            uint32_t c = b;
+            for (int k = 0; k < 8; ++k) c = (c >> 1) ^ (0x82F63B78u & (0u - (c & 1)));
+            t[0][b] = c;
+        }
+        for (uint32_t b = 0; b < 256; ++b) {
+            for (int k = 1; k < 8; ++k) t[k][b] = (t[k - 1][b] >> 8) ^ t[0][t[k - 1][b] & 0xff];
+        }
+    }
+};
+inline constexpr Crc32cTables CRC32C_TABLES{};
+
+inline uint32_t crc32c_scalar(uint32_t crc, const char* data, size_t n) {
+    const unsigned char* p = (const unsigned char*)data;
+    const auto& t = CRC32C_TABLES.t;
+    uint32_t c = ~crc;
+    while (n >= 8) {
+        uint32_t lo, hi;
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= c;   // little endian, like every x86 and most ARM boxes
+        c = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+            t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+        p += 8;
+        n -= 8;
+    }
+    while (n--) c = (c >> 8) ^ t[0][(c ^ *p++) & 0xff];
+    return ~c;
+}
+
+#ifdef BYTE_KERNELS_X86
+__attribute__((target("sse4.2"))) inline uint32_t crc32c_sse42(uint32_t crc, const char* p, size_t n) {
+#ifdef __x86_64__
+    uint64_t c = ~crc;
+    while (n >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+        p += 8;
+        n -= 8;
+    }
+    uint32_t c32 = (uint32_t)c;
+#else
+    uint32_t c32 = ~crc;
+    while (n >= 4) {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        c32 = _mm_crc32_u32(c32, v);
+        p += 4;
+        n -= 4;
+    }
+#endif
+    while (n--) c32 = _mm_crc32_u8(c32, (unsigned char)*p++);
+    return ~c32;
+}
+#endif
+
+inline uint32_t crc32c_at(SimdLevel l, uint32_t crc, const char* p, size_t n) {
+#ifdef BYTE_KERNELS_X86
+    if (l >= SIMD_SSE42) return crc32c_sse42(crc, p, n);
+#endif
+    (void)l;
+    return crc32c_scalar(crc, p, n);
+}
+
+inline uint32_t crc32c(uint32_t crc, const char* p, size_t n) { return crc32c_at(simd_best(), crc, p, n); }
+
+// ---------------------------------------------------------------------------------------
+// ASCII case folding, in place: ascii_fold(p, n, 'A') lowercases (flips 'A'..'Z'),
+// ascii_fold(p, n, 'a') uppercases. Everything that is not an ASCII letter is left alone,
+// so UTF-8 passes through untouched.
+// ---------------------------------------------------------------------------------------
+
+inline void ascii_fold_scalar(char* p, size_t n, char first) {
+    for (size_t i = 0; i < n; ++i) {
+        // one unsigned compare for the range, no branch on the letter itself
+        unsigned char d = (unsigned char)(p[i] - first);
+        p[i] ^= (char)((d < 26) << 5);
+    }
+}
+
+#ifdef BYTE_KERNELS_X86
+// Signed compares only, so the range check shifts `first` down to -128 first:
+// then "letter" is "shifted < -128 + 26"
+__attribute__((target("sse4.2"))) inline void ascii_fold_sse42(char* p, size_t n, char first) {
+    const __m128i shift = _mm_set1_epi8((char)(0x80 - (unsigned char)first));
+    const __m128i limit = _mm_set1_epi8((char)(-128 + 26));
+    const __m128i bit = _mm_set1_epi8(0x20);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        __m128i letter = _mm_cmplt_epi8(_mm_add_epi8(v, shift), limit);
+        _mm_storeu_si128((__m128i*)(p + i), _mm_xor_si128(v, _mm_and_si128(letter, bit)));
+    }
+    ascii_fold_scalar(p + i, n - i, first);
+}
+
+__attribute__((target("avx2"))) inline void ascii_fold_avx2(char* p, size_t n, char first) {
+    const __m256i shift = _mm256_set1_epi8((char)(0x80 - (unsigned char)first));
+    const __m256i limit = _mm256_set1_epi8((char)(-128 + 26));
+    const __m256i bit = _mm256_set1_epi8(0x20);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+        __m256i letter = _mm256_cmpgt_epi8(limit, _mm256_add_epi8(v, shift));
+        _mm256_storeu_si256((__m256i*)(p + i), _mm256_xor_si256(v, _mm256_and_si256(letter, bit)));
+    }
+    ascii_fold_sse42(p + i, n - i, first);
+}
+#endif
+
+inline void ascii_fold_at(SimdLevel l, char* p, size_t n, char first) {
+#ifdef BYTE_KERNELS_X86
+    if (l == SIMD_AVX2) return ascii_fold_avx2(p, n, first);
+    if (l == SIMD_SSE42) return ascii_fold_sse42(p, n, first);
+#endif
+    (void)l;
+    ascii_fold_scalar(p, n, first);
+}
+
+inline void ascii_fold(char* p, size_t n, char first) { ascii_fold_at(simd_best(), p, n, first); }
+
+// ---------------------------------------------------------------------------------------
+// Text scan: index of the first byte that is not printable ASCII (0x20..0x7e) or \t \n \r,
+// n if there is none. A whole message is checked in one pass, 32 bytes per compare with AVX2,
+// and only a block that contains a bad byte gets looked at byte by byte.
+// ---------------------------------------------------------------------------------------
+
+inline bool text_byte(unsigned char c) {
+    return (unsigned char)(c - 0x20) < 0x5f || c == '\t' || c == '\n' || c == '\r';
+}
+
+inline size_t find_non_text_scalar(const char* p, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        if (!text_byte((unsigned char)p[i])) return i;
+    }
+    return n;
+}
+
+#ifdef BYTE_KERNELS_X86
+__attribute__((target("sse4.2"))) inline size_t find_non_text_sse42(const char* p, size_t n) {
+    const __m128i shift = _mm_set1_epi8((char)(0x80 - 0x20));   // 0x20 -> -128
+    const __m128i limit = _mm_set1_epi8((char)(-128 + 0x5f));   // 0x7e -> -34, the last printable
+    const __m128i tab = _mm_set1_epi8('\t'), lf = _mm_set1_epi8('\n'), cr = _mm_set1_epi8('\r');
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        __m128i ok = _mm_cmplt_epi8(_mm_add_epi8(v, shift), limit);
+        ok = _mm_or_si128(ok, _mm_or_si128(_mm_cmpeq_epi8(v, tab), _mm_or_si128(_mm_cmpeq_epi8(v, lf),
+                                                                                 _mm_cmpeq_epi8(v, cr))));
+        unsigned bad = ~(unsigned)_mm_movemask_epi8(ok) & 0xffffu;
+        if (bad) return i + (size_t)__builtin_ctz(bad);
+    }
+    return i + find_non_text_scalar(p + i, n - i);
+}
+
+__attribute__((target("avx2"))) inline size_t find_non_text_avx2(const char* p, size_t n) {
+    const __m256i shift = _mm256_set1_epi8((char)(0x80 - 0x20));
+    const __m256i limit = _mm256_set1_epi8((char)(-128 + 0x5f));
+    const __m256i tab = _mm256_set1_epi8('\t'), lf = _mm256_set1_epi8('\n'), cr = _mm256_set1_epi8('\r');
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+        __m256i ok = _mm256_cmpgt_epi8(limit, _mm256_add_epi8(v, shift));
+        ok = _mm256_or_si256(ok, _mm256_or_si256(_mm256_cmpeq_epi8(v, tab),
+                                                 _mm256_or_si256(_mm256_cmpeq_epi8(v, lf), _mm256_cmpeq_epi8(v, cr))));
+        unsigned bad = ~(unsigned)_mm256_movemask_epi8(ok);
+        if (bad) return i + (size_t)__builtin_ctz(bad);
+    }
+    return i + find_non_text_sse42(p + i, n - i);
+}
+#endif
+
+inline size_t find_non_text_at(SimdLevel l, const char* p, size_t n) {
+#ifdef BYTE_KERNELS_X86
+    if (l == SIMD_AVX2) return find_non_text_avx2(p, n);
+    if (l == SIMD_SSE42) return find_non_text_sse42(p, n);
+#endif
+    (void)l;
+    return find_non_text_scalar(p, n);
+}
+
+inline size_t find_non_text(const char* p, size_t n) { return find_non_text_at(simd_best(), p, n); }
@@ -0,0 +1,238 @@
+#pragma once
+// Traffic capture for the servers' receive paths (--capture PATH), replayed by bench/echo_replay.cpp.
+//
+// Every received message becomes one record (arrival time, protocol, peer address, payload) appended
+// to a binary log. The log is a preallocated file mapped with MAP_SHARED, so a record costs a
+// clock read and a memcpy into memory that is already mapped: no write() syscall, no lock, and the
+// page cache takes care of getting it to disk. Sizing is up front (--capture-mb), once the file is
+// full later messages are dropped, the server never waits for the log. A full log is latched in a
+// flag, so from then on a dropped message costs one read of it, no atomic read-modify-write on a line
+// every thread shares. capture_record() tells the caller, which counts it in its loop's stats
+// (capture_dropped_total in --stats).
+//
+// Threads dont fight over one append offset either: each thread claims a CHUNK of the file at a
+// time (one atomic add per chunk) and fills it on its own. A record never crosses a chunk, the
+// unused tail of a chunk is left zero, and readers skip from a zero size to the next chunk.
+// The number of bytes claimed so far lives in the mapped header itself, so even a server that was
+// killed leaves a log that reads back fine up to its last complete record.
+//
+//   file:   [CaptureHeader, padded to 4 KB][chunk 0][chunk 1]...
+//   record: [CaptureRecord 24 bytes][payload][pad to 8]
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <netinet/in.h>
+
+static const char CAPTURE_MAGIC[8] = {'E', 'C', 'H', 'O', 'C', 'A', 'P', '1'};
+static const uint64_t CAPTURE_DATA_START = 4096;
+static const uint64_t CAPTURE_CHUNK = 1 << 20;
+
+enum CaptureKind : uint8_t {
+    CAP_TCP_DATA = 1,    // bytes read from a TCP connection
+    CAP_TCP_CLOSE = 2,   // the connection ended (no payload)
+    CAP_UDP_DATA = 3,    // one datagram
+};
+
+struct CaptureHeader {
+    char magic[8];
+    uint64_t file_bytes;
+    uint64_t chunk_bytes;
+    int64_t start_realtime_ns;        // wall clock at capture start, record times are relative to it
+    std::atomic<uint64_t> claimed;    // bytes handed out to threads, counted from CAPTURE_DATA_START
+};
+
+struct CaptureRecord {
+    uint32_t size;      // whole record incl. header and padding, 0 = nothing here (written last)
+    uint8_t kind;
+    uint8_t pad;
+    uint16_t port;      // peer port, network order
+    uint32_t ip;        // peer IPv4, network order
+    uint32_t len;       // payload bytes
+    uint64_t ts_ns;     // since capture start (CLOCK_MONOTONIC)
+};
+static_assert(sizeof(CaptureRecord) == 24, "record header layout is part of the file format");
+
+struct CaptureLog {
+    bool on = false;
+    const char* path = nullptr;
+    uint64_t file_bytes = 256ull << 20;
+    char* base = nullptr;
+    int64_t start_mono_ns = 0;
+    std::atomic<bool> full{false};   // set once, by the first thread that found no chunk left
+};
+
+inline CaptureLog g_capture;
+
+// The chunk this thread is filling
+struct CaptureCursor {
+    uint64_t pos = 0, end = 0;
+};
+inline thread_local CaptureCursor t_capture;
+
+inline int64_t capture_mono_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Creates (or truncates) the log, allocates its blocks and maps it. Call before the loops start
+inline bool capture_open() {
+    int fd = open(g_capture.path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) { perror("open capture log"); return false; }
+    // real blocks now, so a full disk shows up here and not as a SIGBUS in the middle of a write
+#ifdef __APPLE__
+    // no posix_fallocate on macOS, a sparse file it is
+    int rc = ftruncate(fd, (off_t)g_capture.file_bytes) == 0 ? 0 : errno;
+#else
+    int rc = posix_fallocate(fd, 0, (off_t)g_capture.file_bytes);
+#endif
+    if (rc != 0) {
+        fprintf(stderr, "posix_fallocate capture log: %s\n", strerror(rc));
+        close(fd);
+        return false;
+    }
+    // MAP_POPULATE: fault every page in up front instead of on the first record that lands in it
+    // (Linux only, elsewhere the pages fault in as records land)
+#ifdef MAP_POPULATE
+    const int populate = MAP_POPULATE;
+#else
+    const int populate = 0;
+#endif
+    void* p = mmap(nullptr, g_capture.file_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | populate, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) { perror("mmap capture log"); return false; }
+
+    g_capture.base = (char*)p;
+    CaptureHeader* h = (CaptureHeader*)p;
+    memcpy(h->magic, CAPTURE_MAGIC, sizeof(h->magic));
+    h->file_bytes = g_capture.file_bytes;
+    h->chunk_bytes = CAPTURE_CHUNK;
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    h->start_realtime_ns = (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    new (&h->claimed) std::atomic<uint64_t>(0);
+    g_capture.start_mono_ns = capture_mono_ns();
+    g_capture.on = true;
+    return true;
+}
+
+inline bool capture_next_chunk(CaptureCursor& c) {
+    c.pos = c.end = 0;
+    if (g_capture.full.load(std::memory_order_relaxed)) return false;
+    CaptureHeader* h = (CaptureHeader*)g_capture.base;
+    uint64_t off = h->claimed.fetch_add(CAPTURE_CHUNK, std::memory_order_relaxed);
+    if (CAPTURE_DATA_START + off + CAPTURE_CHUNK > g_capture.file_bytes) {
+        if (!g_capture.full.exchange(true, std::memory_order_relaxed))
+            fprintf(stderr, "capture log %s is full, dropping the rest\n", g_capture.path);
+        return false;
+    }
+    c.pos = CAPTURE_DATA_START + off;
+    c.end = c.pos + CAPTURE_CHUNK;
+    return true;
+}
+
+// The hot path. Callers check g_capture.on first. ip/port in network order, as in sockaddr_in.
+// Payloads longer than a chunk are cut to fit. false = the log is full, the record was dropped
+inline bool capture_record(uint8_t kind, uint32_t ip, uint16_t port, const void* data, size_t len) {
+    size_t max = CAPTURE_CHUNK - sizeof(CaptureRecord);
+    if (len > max) len = max;
+    uint64_t size = (sizeof(CaptureRecord) + len + 7) & ~7ull;
+
+    CaptureCursor& c = t_capture;
+    if (c.end - c.pos < size && !capture_next_chunk(c)) return false;
+
+    CaptureRecord* r = (CaptureRecord*)(g_capture.base + c.pos);
+    r->kind = kind;
+    r->port = port;
+    r->ip = ip;
+    r->len = (uint32_t)len;
+    r->ts_ns = (uint64_t)(capture_mono_ns() - g_capture.start_mono_ns);
+    if (len) memcpy(r + 1, data, len);
+    // size last: a record with a size is complete
+    __atomic_store_n(&r->size, (uint32_t)size, __ATOMIC_RELEASE);
+    c.pos += size;
+    return true;
+}
+
+// --capture PATH, --capture-mb N. Returns true if argv[i] (and its value) was one of them
+inline bool capture_parse_arg(int argc, char** argv, int& i) {
+    if (i + 1 >= argc) return false;
+    if (strcmp(argv[i], "--capture") == 0) { g_capture.path = argv[++i]; return true; }
+    if (strcmp(argv[i], "--capture-mb") == 0) {
+        long mb = atol(argv[++i]);
+        if (mb < 2) mb = 2;
+        g_capture.file_bytes = (uint64_t)mb << 20;
+        return true;
+    }
+    return false;
+}
+
+#define CAPTURE_USAGE "[--capture PATH] [--capture-mb N]"
+
+// ---------------------------------------------------------------------------------------
+// Reading a log back (the replay tool)
+// ---------------------------------------------------------------------------------------
+
+struct CaptureReader {
+    const char* base = nullptr;
+    uint64_t bytes = 0;      // mapped length
+    const CaptureHeader* hdr = nullptr;
+
+    bool open(const char* path) {
+        int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) { perror("open capture log"); return false; }
+        struct stat sb;
+        if (fstat(fd, &sb) < 0 || (uint64_t)sb.st_size < CAPTURE_DATA_START) {
+            fprintf(stderr, "%s: too short to be a capture log\n", path);
+            ::close(fd);
+            return false;
+        }
+        void* p = mmap(nullptr, (size_t)sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) { perror("mmap capture log"); return false; }
+        base = (const char*)p;
+        bytes = (uint64_t)sb.st_size;
+        hdr = (const CaptureHeader*)p;
+        if (memcmp(hdr->magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0 || hdr->chunk_bytes == 0) {
+            fprintf(stderr, "%s: not a capture log\n", path);
+            return false;
+        }
+        // the records are read once, front to back
+        madvise(p, (size_t)bytes, MADV_SEQUENTIAL);
+        return true;
+    }
+
+    // Calls f(offset, const CaptureRecord&) for every complete record, in file order
+    // (per thread chunks, so only roughly in time order)
+    template <typename F>
+    void for_each(F&& f) const {
+        uint64_t chunk = hdr->chunk_bytes;
+        uint64_t end = CAPTURE_DATA_START + hdr->claimed.load(std::memory_order_relaxed);
+        if (end > bytes) end = bytes;
+        uint64_t off = CAPTURE_DATA_START;
+        while (off + sizeof(CaptureRecord) <= end) {
+            const CaptureRecord* r = (const CaptureRecord*)(base + off);
+            uint64_t chunk_end = CAPTURE_DATA_START + ((off - CAPTURE_DATA_START) / chunk + 1) * chunk;
+            if (r->size == 0 || r->size < sizeof(CaptureRecord) + r->len || off + r->size > chunk_end) {
+                off = chunk_end;   // rest of this chunk was never written (or is garbage)
+                continue;
+            }
+            f(off, *r);
+            off += r->size;
+        }
+    }
+
+    const CaptureRecord& at(uint64_t off) const { return *(const CaptureRecord*)(base + off); }
+    const char* payload(uint64_t off) const { return base + off + sizeof(CaptureRecord); }
+};
@@ -0,0 +1,93 @@
+#pragma once
+// fd-indexed connection table with slab-allocated connection state.
+//
+// The kernel hands out fds lowest-first, so fds are small dense integers and make a perfect array
+// index: looking a connection up is table[fd], no hashing. The table itself only stores pointers
+// (8 bytes per fd), the state objects live in slabs of SLAB_OBJECTS each, and closed ones go on an
+// intrusive free list to be reused by the next accept. After warmup, opening and closing a
+// connection never touches malloc.
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+template <typename T>
+struct SlabAllocator {
+    static const size_t SLAB_OBJECTS = 1024;
+
+    // A free slot reuses the object's own bytes as the free-list link
+    union Slot {
+        Slot* next;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    std::vector<Slot*> slabs;
+    Slot* free_list = nullptr;
+    size_t live = 0;
+
+    template <typename... Args>
+    T* create(Args&&... args) {
+        if (!free_list) grow();
+        Slot* s = free_list;
+        free_list = s->next;
+        ++live;
+        return new (s->storage) T(std::forward<Args>(args)...);
+    }
+
+    void destroy(T* obj) {
+        obj->~T();
+        Slot* s = reinterpret_cast<Slot*>(obj);
+        s->next = free_list;
+        free_list = s;
+        --live;
+    }
+
+    void grow() {
+        Slot* slab = static_cast<Slot*>(::operator new(sizeof(Slot) * SLAB_OBJECTS));
+        slabs.push_back(slab);
+        for (size_t i = SLAB_OBJECTS; i-- > 0;) {
+            slab[i].next = free_list;
+            free_list = &slab[i];
+        }
+    }
+
+    size_t bytes_reserved() const { return slabs.size() * SLAB_OBJECTS * sizeof(Slot); }
+
+    SlabAllocator() = default;
+    SlabAllocator(const SlabAllocator&) = delete;
+    SlabAllocator& operator=(const SlabAllocator&) = delete;
+
+    // Objects still alive at this point are simply dropped with their slab, callers close them first
+    ~SlabAllocator() {
+        for (Slot* s : slabs) ::operator delete(s);
+    }
+};
+
+template <typename T>
+struct ConnTable {
+    std::vector<T*> by_fd;
+    SlabAllocator<T> slab;
+
+    // State for a freshly accepted fd
+    T* open(int fd) {
+        if ((size_t)fd >= by_fd.size()) by_fd.resize((size_t)fd * 2 + 64, nullptr);
+        if (by_fd[fd]) slab.destroy(by_fd[fd]);
+        by_fd[fd] = slab.create();
+        return by_fd[fd];
+    }
+
+    // nullptr if fd is not an open connection (eg a stale event for one we already closed)
+    T* get(int fd) const {
+        return (size_t)fd < by_fd.size() ? by_fd[fd] : nullptr;
+    }
+
+    void close(int fd) {
+        if ((size_t)fd < by_fd.size() && by_fd[fd]) {
+            slab.destroy(by_fd[fd]);
+            by_fd[fd] = nullptr;
+        }
+    }
+
+    size_t size() const { return slab.live; }
+};
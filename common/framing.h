@@ -0,0 +1,77 @@
+#pragma once
+// Length-prefixed framing for the TCP echo protocol (--framed).
+//
+// TCP is a byte stream: one send() on the client can arrive as three read()s on the server, and
+// three sends can arrive as one read. Without framing, "a message" is whatever read() returned.
+// A frame is
+//     [4 byte big-endian payload length][payload]
+// so the receiver always knows where a message ends, no matter how the bytes were cut up.
+//
+// FrameDecoder parses incrementally: feed() it every chunk read() returns and it calls back once
+// per complete frame. Frames that sit entirely inside the chunk are handed out as pointers into it
+// (no copy), only a frame cut off by the end of the chunk gets buffered until the rest arrives.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+static const size_t FRAME_HEADER = 4;
+static const uint32_t MAX_FRAME = 16 * 1024 * 1024;   // anything bigger is garbage, not a message
+
+inline void frame_header(uint32_t len, char* out) {
+    out[0] = (char)(len >> 24);
+    out[1] = (char)(len >> 16);
+    out[2] = (char)(len >> 8);
+    out[3] = (char)len;
+}
+
+inline uint32_t frame_length(const char* hdr) {
+    const unsigned char* p = (const unsigned char*)hdr;
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+struct FrameDecoder {
+    std::vector<char> partial;   // an incomplete frame (header included) carried over from the last feed
+
+    // Calls on_frame(payload, len) for every complete frame in data. false = protocol error
+    // (a length over MAX_FRAME), the connection should be dropped.
+    template <typename F>
+    bool feed(const char* data, size_t len, F&& on_frame) {
+        if (!partial.empty()) {
+            // finish the header first, then the body
+            if (partial.size() < FRAME_HEADER) {
+                size_t take = FRAME_HEADER - partial.size();
+                if (take > len) take = len;
+                partial.insert(partial.end(), data, data + take);
+                data += take;
+                len -= take;
+                if (partial.size() < FRAME_HEADER) return true;
+            }
+            uint32_t body = frame_length(partial.data());
+            if (body > MAX_FRAME) return false;
+            size_t want = FRAME_HEADER + body - partial.size();
+            size_t take = want < len ? want : len;
+            partial.insert(partial.end(), data, data + take);
+            data += take;
+            len -= take;
+            if (take < want) return true;
+            on_frame(partial.data() + FRAME_HEADER, (size_t)body);
+            partial.clear();
+            // dont let one big frame pin its memory for the rest of the connection
+            if (partial.capacity() > 64 * 1024) std::vector<char>().swap(partial);
+        }
+
+        // whole frames straight out of the caller's buffer
+        while (len >= FRAME_HEADER) {
+            uint32_t body = frame_length(data);
+            if (body > MAX_FRAME) return false;
+            if (len < FRAME_HEADER + body) break;
+            on_frame(data + FRAME_HEADER, (size_t)body);
+            data += FRAME_HEADER + body;
+            len -= FRAME_HEADER + body;
+        }
+        if (len > 0) partial.assign(data, data + len);
+        return true;
+    }
+};
@@ -0,0 +1,135 @@
+#pragma once
+// HDR-style latency histogram (same bucketing scheme as HdrHistogram).
+//
+// A plain linear histogram either needs millions of buckets (1ns .. 1 minute at 1ns resolution)
+// or loses all precision at the low end. HDR uses log-linear buckets instead:
+//   - the value range is split by powers of 2 (bucket 0: [0, 2048), bucket 1: [2048, 4096), ...)
+//   - every power of 2 is split linearly into the same number of sub-buckets
+// so the RELATIVE error is constant (3 significant digits = within 0.1%) no matter the magnitude,
+// and 1ns .. 1 hour fits in a few hundred KB of counters. Recording is a couple of shifts + an increment.
+//
+// Values are whatever unit the caller picks (the load generators use nanoseconds).
+
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+struct HdrHistogram {
+    int64_t highest = 0;
+    int sub_bucket_half_count_magnitude = 0;
+    int64_t sub_bucket_count = 0;
+    int64_t sub_bucket_half_count = 0;
+    int64_t sub_bucket_mask = 0;
+    int bucket_count = 0;
+    std::vector<uint64_t> counts;
+    uint64_t total = 0;
+    int64_t max_value = 0;
+    int64_t min_value = INT64_MAX;
+
+    // highest_trackable: anything above is clamped to it. digits: 1..5 significant decimal digits
+    explicit HdrHistogram(int64_t highest_trackable = 3600LL * 1000 * 1000 * 1000, int digits = 3) {
+        highest = highest_trackable;
+        int64_t largest_single_unit = 2 * (int64_t)std::pow(10, digits);
+        int magnitude = (int)std::ceil(std::log2((double)largest_single_unit));
+        sub_bucket_half_count_magnitude = (magnitude > 1 ? magnitude : 1) - 1;
+        sub_bucket_count = 1LL << (sub_bucket_half_count_magnitude + 1);
+        sub_bucket_half_count = sub_bucket_count / 2;
+        sub_bucket_mask = sub_bucket_count - 1;
+
+        // how many powers of 2 until the top sub-bucket covers `highest`
+        int64_t smallest_untrackable = sub_bucket_count;
+        bucket_count = 1;
+        while (smallest_untrackable <= highest) {
+            if (smallest_untrackable > INT64_MAX / 2) { ++bucket_count; break; }
+            smallest_untrackable <<= 1;
+            ++bucket_count;
+        }
+        counts.assign((size_t)(bucket_count + 1) * sub_bucket_half_count, 0);
+    }
+
+    size_t index_of(int64_t value) const {
+        int pow2ceiling = 64 - __builtin_clzll((uint64_t)(value | sub_bucket_mask));
+        int bucket = pow2ceiling - (sub_bucket_half_count_magnitude + 1);
+        int64_t sub_bucket = value >> bucket;
+        return (size_t)(((int64_t)(bucket + 1) << sub_bucket_half_count_magnitude) + (sub_bucket - sub_bucket_half_count));
+    }
+
+    // Smallest value that lands in counts[index]
+    int64_t value_at(size_t index) const {
+        int64_t bucket = (int64_t)(index >> sub_bucket_half_count_magnitude) - 1;
+        int64_t sub_bucket = (int64_t)(index & (sub_bucket_half_count - 1)) + sub_bucket_half_count;
+        if (bucket < 0) {
+            sub_bucket -= sub_bucket_half_count;
+            bucket = 0;
+        }
+        return sub_bucket << bucket;
+    }
+
+    // Largest value that lands in counts[index] (what percentiles report, like HdrHistogram does)
+    int64_t highest_equivalent(size_t index) const {
+        int64_t bucket = (int64_t)(index >> sub_bucket_half_count_magnitude) - 1;
+        if (bucket < 0) bucket = 0;
+        return value_at(index) + (1LL << bucket) - 1;
+    }
+
+    void record(int64_t value, uint64_t n = 1) {
+        if (value < 0) value = 0;
+        if (value > highest) value = highest;
+        counts[index_of(value)] += n;
+        total += n;
+        if (value > max_value) max_value = value;
+        if (value < min_value) min_value = value;
+    }
+
+    // Coordinated omission correction for closed-loop measurement: a request that took 10x the
+    // expected interval means ~9 other requests would have been sent (and stuck behind it) meanwhile,
+    // so we back-fill those samples instead of pretending they never existed.
+    void record_corrected(int64_t value, int64_t expected_interval) {
+        record(value);
+        if (expected_interval <= 0 || value <= expected_interval) return;
+        for (int64_t missing = value - expected_interval; missing >= expected_interval; missing -= expected_interval) {
+            record(missing);
+        }
+    }
+
+    void merge(const HdrHistogram& o) {
+        for (size_t i = 0; i < counts.size() && i < o.counts.size(); ++i) counts[i] += o.counts[i];
+        total += o.total;
+        if (o.max_value > max_value) max_value = o.max_value;
+        if (o.min_value < min_value) min_value = o.min_value;
+    }
+
+    void reset() {
+        std::fill(counts.begin(), counts.end(), 0);
+        total = 0;
+        max_value = 0;
+        min_value = INT64_MAX;
+    }
+
+    // p in [0, 100]
+    int64_t percentile(double p) const {
+        if (total == 0) return 0;
+        uint64_t target = (uint64_t)std::ceil(p / 100.0 * (double)total);
+        if (target == 0) target = 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size(); ++i) {
+            seen += counts[i];
+            if (seen >= target) {
+                int64_t v = highest_equivalent(i);
+                return v < max_value ? v : max_value;
+            }
+        }
+        return max_value;
+    }
+
+    double mean() const {
+        if (total == 0) return 0;
+        double sum = 0;
+        for (size_t i = 0; i < counts.size(); ++i) {
+            if (counts[i]) sum += (double)counts[i] * (double)value_at(i);
+        }
+        return sum / (double)total;
+    }
+};
@@ -0,0 +1,239 @@
+#pragma once
+// Kernel timestamps for a per-request latency breakdown (--timestamps N). SO_TIMESTAMPING is
+// Linux only; elsewhere this header still compiles but the option is refused.
+//
+// An echo's latency has three parts, and from user space alone they all look the same:
+//   rx_queue  the kernel had the packet, but we hadnt read it yet (receive queue + our wakeup)
+//   process   we read it and hadnt handed the reply to send yet (our own loop)
+//   tx        send was called and the packet wasnt on its way to the device yet (qdisc, TCP cwnd...)
+// SO_TIMESTAMPING gives us the two kernel ends:
+//   - SOF_TIMESTAMPING_RX_SOFTWARE: every received skb is stamped when the stack gets it, and
+//     recvmsg hands that stamp back in an SCM_TIMESTAMPING cmsg
+//   - SOF_TIMESTAMPING_TX_SOFTWARE, asked for per send with a cmsg: the stack stamps the packet
+//     when the device takes it and queues the stamp on the socket's error queue (epoll: EPOLLERR)
+// The user space ends are clock_gettime(CLOCK_REALTIME), the clock the software stamps use.
+//
+// Stamping everything would cost a recvmsg with control, a cmsg walk and an error queue read per
+// request. So one request in N is sampled (per read on TCP, per datagram on UDP). The others run
+// the usual untouched path. The gap between samples is random (N on average): a fixed "every Nth"
+// locks onto the loop's rhythm. With 64 connections ready per epoll_wait and N = 64, it would
+// time the same slot of every batch, over and over.
+// There is at most one send per loop waiting for its TX stamp, so a stamp that shows up on fd X
+// belongs to that send; no OPT_ID bookkeeping. If a stamp never comes (the send was dropped),
+// the loop stops waiting for it after a second.
+//
+// The samples go into the loop's latency histograms (LoopStats::latency, common/metrics.h),
+// so --stats shows all three stages next to the counters.
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#ifdef __linux__
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#endif
+#include "metrics.h"
+
+inline uint64_t kts_now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+#ifdef __linux__
+// RX stamps on, and TX stamps allowed (the sends ask for them one by one). OPT_TSONLY: a TX stamp
+// comes back without a copy of the packet
+inline bool kts_enable(int fd) {
+    int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_TSONLY;
+    if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0) {
+        perror("setsockopt SO_TIMESTAMPING");
+        return false;
+    }
+    return true;
+}
+
+// Room for the RX stamp in a recvmsg's control buffer
+static const size_t KTS_RX_CMSG_SPACE = CMSG_SPACE(sizeof(scm_timestamping));
+// Room for the "stamp this send" request in a sendmsg's control buffer
+static const size_t KTS_TX_CMSG_SPACE = CMSG_SPACE(sizeof(uint32_t));
+
+// The software stamp in msg's SCM_TIMESTAMPING cmsg, 0 = there is none
+inline uint64_t kts_stamp(msghdr& msg) {
+    for (cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_TIMESTAMPING) continue;
+        scm_timestamping t;
+        memcpy(&t, CMSG_DATA(c), sizeof(t));
+        return (uint64_t)t.ts[0].tv_sec * 1000000000ull + (uint64_t)t.ts[0].tv_nsec;
+    }
+    return 0;
+}
+
+// Writes the "stamp this send" cmsg at c, returns its size
+inline size_t kts_put_tx_request(cmsghdr* c) {
+    uint32_t flags = SOF_TIMESTAMPING_TX_SOFTWARE;
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SO_TIMESTAMPING;
+    c->cmsg_len = CMSG_LEN(sizeof(flags));
+    memcpy(CMSG_DATA(c), &flags, sizeof(flags));
+    return KTS_TX_CMSG_SPACE;
+}
+
+// read() that also returns when the kernel received the data (rx_ns, 0 = no stamp).
+// On TCP that is the stamp of the newest segment the read consumed
+inline ssize_t kts_recv(int fd, void* buf, size_t len, uint64_t& rx_ns) {
+    alignas(cmsghdr) char control[KTS_RX_CMSG_SPACE];
+    iovec iov{buf, len};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t r = recvmsg(fd, &msg, 0);
+    rx_ns = r > 0 ? kts_stamp(msg) : 0;
+    return r;
+}
+
+// writev() that asks for a TX stamp of what it sends
+inline ssize_t kts_sendv(int fd, const iovec* iov, int cnt) {
+    alignas(cmsghdr) char control[KTS_TX_CMSG_SPACE] = {};
+    msghdr msg{};
+    msg.msg_iov = const_cast<iovec*>(iov);
+    msg.msg_iovlen = (size_t)cnt;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    kts_put_tx_request(CMSG_FIRSTHDR(&msg));
+    return sendmsg(fd, &msg, 0);
+}
+
+// If msg (read with MSG_ERRQUEUE) is a TX stamp: its time in tx_ns, true
+inline bool kts_tx_stamp(msghdr& msg, uint64_t& tx_ns) {
+    bool is_stamp = false;
+    for (cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+        if (!((c->cmsg_level == SOL_IP && c->cmsg_type == IP_RECVERR) ||
+              (c->cmsg_level == SOL_IPV6 && c->cmsg_type == IPV6_RECVERR))) continue;
+        sock_extended_err se;
+        memcpy(&se, CMSG_DATA(c), sizeof(se));
+        is_stamp = se.ee_origin == SO_EE_ORIGIN_TIMESTAMPING && se.ee_info == SCM_TSTAMP_SND;
+    }
+    if (!is_stamp) return false;
+    tx_ns = kts_stamp(msg);
+    return tx_ns != 0;
+}
+#endif
+
+// One per event loop
+struct KernelTs {
+    LoopStats& st;
+    uint32_t every;
+    uint32_t left;
+    uint32_t rng = 0x9E3779B9;   // xorshift state for the sample gaps
+    int tx_fd = -1;            // the sampled send waiting for its TX stamp, -1 = none
+    uint64_t tx_sent_ns = 0;
+
+    KernelTs(uint32_t every_, LoopStats& s) : st(s), every(every_), left(every_) {}
+
+    // Counts one request, true = this one is sampled
+    bool sample() {
+        if (--left) return false;
+        // next gap uniform in [1, 2N-1]
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        left = 1 + rng % (2 * every - 1);
+        return true;
+    }
+
+    // May this sampled send ask for a TX stamp?
+    bool want_tx(uint64_t now_ns) {
+        return tx_fd < 0 || now_ns - tx_sent_ns > 1000000000ull;
+    }
+
+    // The clocks are read at different places, a stamp "before" the previous one means the wall clock
+    // was stepped in between; the sample is dropped
+    void record(int stage, uint64_t from_ns, uint64_t to_ns) {
+        if (from_ns && to_ns >= from_ns) st.latency(stage, to_ns - from_ns);
+    }
+
+    void received(uint64_t rx_ns, uint64_t read_ns) { record(LAT_RX_QUEUE, rx_ns, read_ns); }
+
+    // The sampled request's reply went to the socket at send_ns. stamped = it asked for a TX stamp
+    void sent(int fd, uint64_t read_ns, uint64_t send_ns, bool stamped) {
+        record(LAT_PROCESS, read_ns, send_ns);
+        if (stamped) {
+            tx_fd = fd;
+            tx_sent_ns = send_ns;
+        }
+    }
+
+    void tx_done(int fd, uint64_t tx_ns) {
+        if (fd != tx_fd) return;   // a stamp we already gave up on
+        record(LAT_TX, tx_sent_ns, tx_ns);
+        tx_fd = -1;
+    }
+
+    // fd is being closed, its stamp will never come
+    void forget(int fd) {
+        if (fd == tx_fd) tx_fd = -1;
+    }
+
+#ifdef __linux__
+    // Empties fd's error queue, TX stamps go to tx_done(). Anything else on it is dropped
+    void reap(int fd) {
+        alignas(cmsghdr) char control[256];
+        while (true) {
+            msghdr msg{};
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            ssize_t r = recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+            st.syscall();
+            if (r < 0) {
+                if (errno == EINTR) continue;
+                return;
+            }
+            uint64_t tx_ns;
+            if (kts_tx_stamp(msg, tx_ns)) tx_done(fd, tx_ns);
+        }
+    }
+#endif
+};
+
+// ---------------------------------------------------------------------------------------
+// Command line
+// ---------------------------------------------------------------------------------------
+
+struct KtsConfig {
+    uint32_t every = 0;   // sample 1 request in N, 0 = off
+};
+
+inline KtsConfig g_kts;
+
+// Returns true if argv[i] (and its value) was --timestamps. Bad values exit.
+inline bool kts_parse_arg(int argc, char** argv, int& i) {
+    if (i + 1 >= argc || strcmp(argv[i], "--timestamps") != 0) return false;
+#ifndef __linux__
+    fprintf(stderr, "--timestamps needs SO_TIMESTAMPING, Linux only\n");
+    exit(1);
+#endif
+    long n = atol(argv[++i]);
+    if (n < 1) {
+        fprintf(stderr, "bad --timestamps %s, want N >= 1 (sample 1 request in N)\n", argv[i]);
+        exit(1);
+    }
+    g_kts.every = (uint32_t)n;
+    return true;
+}
+
+#define KTS_USAGE "[--timestamps N]"
+
+// A loop's sampler per the command line, or nullptr when --timestamps is off
+inline std::unique_ptr<KernelTs> kts_create(LoopStats& st) {
+    if (g_kts.every == 0) return nullptr;
+    return std::unique_ptr<KernelTs>(new KernelTs(g_kts.every, st));
+}
@@ -0,0 +1,231 @@
+#pragma once
+// Opt-in low latency profile for the event-loop servers.
+//
+// By default a loop blocks in epoll_wait(-1) whenever it runs out of work. That is cheap on CPU,
+// but every message that arrives while the thread sleeps pays for the wakeup: an interrupt, a trip
+// through the scheduler, and maybe a cold cache or a CPU coming out of a deep C-state. That adds
+// several us of RTT, and more at the tail. This profile spends CPU to skip the sleep:
+//
+//   --edge          EPOLLET. Every fd is registered once and drained until EAGAIN when it fires,
+//                   instead of being reported again on every epoll_wait while it stays readable.
+//   --spin USEC     spin-then-block: after running out of work, poll with epoll_wait(timeout 0)
+//                   for up to USEC microseconds before really going to sleep. -1 = never sleep
+//                   (the loop owns its core 100% of the time).
+//   --busy-poll US  SO_BUSY_POLL on the sockets plus epoll busy polling (EPIOCSPARAMS, kernel 6.9+):
+//                   the kernel polls the NIC queue itself instead of waiting for its interrupt.
+//                   Only does anything on a real NIC with NAPI, loopback has no queue to poll.
+//                   Raising it above net.core.busy_read needs CAP_NET_ADMIN.
+//   --cpus LIST     pin loop thread i to the i-th core of LIST (eg 2,3 or 2-5), keep these cores free
+//                   of anything else (isolcpus / irqaffinity) for the best results.
+//   --low-latency   all of the above at once: --edge --spin -1 --busy-poll 50
+//
+// Everything is off by default. With --stats on, spinning shows up as syscalls_per_message going up.
+// --edge and --spin work on every backend of common/reactor.h (io_uring polls stay level triggered),
+// --busy-poll and --cpus are Linux only.
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <pthread.h>
+#include <sched.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+#include "metrics.h"
+#include "reactor.h"
+
+// Not in older uapi headers yet (linux/eventpoll.h, 6.9)
+#if defined(__linux__) && !defined(EPIOCSPARAMS)
+struct epoll_params {
+    uint32_t busy_poll_usecs;
+    uint16_t busy_poll_budget;
+    uint8_t prefer_busy_poll;
+    uint8_t __pad;
+};
+#define EPIOCSPARAMS _IOW(0x8A, 0x01, struct epoll_params)
+#endif
+
+struct LowLatency {
+    bool edge = false;
+    int spin_us = 0;          // 0 = block right away, -1 = spin forever
+    int busy_poll_us = 0;
+    std::vector<int> cpus;    // empty = the server's own default placement
+};
+
+inline LowLatency g_lowlat;
+
+// --cpus 0,2,4-7
+inline bool lowlat_parse_cpus(const char* s, std::vector<int>& out) {
+    out.clear();
+    while (*s) {
+        char* end;
+        long a = strtol(s, &end, 10);
+        if (end == s || a < 0) return false;
+        long b = a;
+        if (*end == '-') {
+            s = end + 1;
+            b = strtol(s, &end, 10);
+            if (end == s || b < a) return false;
+        }
+        for (long c = a; c <= b; ++c) out.push_back((int)c);
+        s = end;
+        if (*s == ',') ++s;
+        else if (*s) return false;
+    }
+    return !out.empty();
+}
+
+// Returns true if argv[i] (and its value) was a low latency option. Bad values exit.
+inline bool lowlat_parse_arg(int argc, char** argv, int& i) {
+    if (strcmp(argv[i], "--edge") == 0) { g_lowlat.edge = true; return true; }
+    if (strcmp(argv[i], "--low-latency") == 0) {
+        g_lowlat.edge = true;
+        g_lowlat.spin_us = -1;
+        g_lowlat.busy_poll_us = 50;
+        return true;
+    }
+    if (i + 1 >= argc) return false;
+    if (strcmp(argv[i], "--spin") == 0) { g_lowlat.spin_us = atoi(argv[++i]); return true; }
+    if (strcmp(argv[i], "--busy-poll") == 0) { g_lowlat.busy_poll_us = atoi(argv[++i]); return true; }
+    if (strcmp(argv[i], "--cpus") == 0) {
+        if (!lowlat_parse_cpus(argv[++i], g_lowlat.cpus)) {
+            fprintf(stderr, "bad --cpus list: %s\n", argv[i]);
+            exit(1);
+        }
+        return true;
+    }
+    return false;
+}
+
+#define LOWLAT_USAGE "[--low-latency] [--edge] [--spin USEC|-1] [--busy-poll USEC] [--cpus LIST]"
+
+// Core for loop thread `i`: from --cpus if given, else `fallback`
+inline int lowlat_cpu(int i, int fallback) {
+    if (g_lowlat.cpus.empty()) return fallback;
+    return g_lowlat.cpus[(size_t)i % g_lowlat.cpus.size()];
+}
+
+// For loops that have no pinning of their own
+inline void lowlat_pin(int cpu) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rc != 0) fprintf(stderr, "pthread_setaffinity_np(cpu %d): %s\n", cpu, strerror(rc));
+#else
+    static bool warned = false;
+    if (!warned) {
+        warned = true;
+        fprintf(stderr, "pinning to cpu %d: not supported here, loops stay unpinned\n", cpu);
+    }
+#endif
+}
+
+#ifdef __linux__
+// EPOLLET when --edge is on
+inline uint32_t lowlat_events(uint32_t events) {
+    return g_lowlat.edge ? events | EPOLLET : events;
+}
+#endif
+
+// The same for a reactor interest (RX_EDGE)
+inline uint32_t lowlat_interest(uint32_t interest) {
+    return g_lowlat.edge ? interest | RX_EDGE : interest;
+}
+
+// SO_BUSY_POLL on one socket. Failing is not fatal, the socket just doesnt busy poll
+inline void lowlat_socket(int fd) {
+#ifndef SO_BUSY_POLL
+    (void)fd;
+#else
+    if (g_lowlat.busy_poll_us <= 0) return;
+    int us = g_lowlat.busy_poll_us;
+    static bool warned = false;
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &us, sizeof(us)) < 0 && !warned) {
+        warned = true;
+        perror("setsockopt SO_BUSY_POLL (needs CAP_NET_ADMIN above net.core.busy_read)");
+    }
+#endif
+}
+
+#ifdef __linux__
+// Busy polling for a whole epoll set, so epoll_wait itself polls the NIC queues of its sockets
+inline void lowlat_epoll(int epfd) {
+    if (g_lowlat.busy_poll_us <= 0) return;
+    epoll_params p{};
+    p.busy_poll_usecs = (uint32_t)g_lowlat.busy_poll_us;
+    p.busy_poll_budget = 8;
+    p.prefer_busy_poll = 1;
+    if (ioctl(epfd, EPIOCSPARAMS, &p) < 0) {
+        static bool warned = false;
+        if (!warned) {
+            warned = true;
+            perror("ioctl EPIOCSPARAMS (epoll busy poll, kernel 6.9+), using SO_BUSY_POLL only");
+        }
+    }
+}
+#endif
+
+// Busy polling for whatever a reactor waits on. Only the epoll backend has a knob for it
+template <typename R>
+void lowlat_reactor(R&) {}
+
+#ifdef REACTOR_HAVE_EPOLL
+inline void lowlat_reactor(EpollReactor& r) { lowlat_epoll(r.epfd); }
+#endif
+
+// wait(timeout_ms) with the spin-then-block policy. Spinning calls count as syscalls, only the call
+// that finally returns (events, or the blocking one) counts as a wait, so the events-per-wait
+// histogram still means the same thing. timeout_ms is the loop's own limit (its next timer,
+// -1 = none), spinning never runs past it either.
+template <typename Wait>
+int lowlat_wait_with(Wait&& wait, int timeout_ms, LoopStats& st) {
+    if (g_lowlat.spin_us != 0 && timeout_ms != 0) {
+        auto now = std::chrono::steady_clock::now();
+        auto deadline = now + std::chrono::microseconds(g_lowlat.spin_us);
+        auto limit = now + std::chrono::milliseconds(timeout_ms);
+        while (true) {
+            int n = wait(0);
+            if (n != 0) {
+                st.waited(n);
+                return n;
+            }
+            st.syscall();
+            if (timeout_ms >= 0 || g_lowlat.spin_us > 0) {
+                now = std::chrono::steady_clock::now();
+                if (timeout_ms >= 0 && now >= limit) {
+                    st.waited(0);
+                    return 0;
+                }
+                if (g_lowlat.spin_us > 0 && now >= deadline) {
+                    // the spin ate part of the timeout
+                    if (timeout_ms > 0)
+                        timeout_ms = (int)std::chrono::ceil<std::chrono::milliseconds>(limit - now).count();
+                    break;
+                }
+            }
+        }
+    }
+    int n = wait(timeout_ms);
+    st.waited(n);
+    return n;
+}
+
+#ifdef __linux__
+inline int lowlat_wait(int epfd, epoll_event* events, int max, int timeout_ms, LoopStats& st) {
+    return lowlat_wait_with([&](int t) { return epoll_wait(epfd, events, max, t); }, timeout_ms, st);
+}
+#endif
+
+template <typename R>
+int lowlat_wait(R& reactor, RxEvent* events, int max, int timeout_ms, LoopStats& st) {
+    return lowlat_wait_with([&](int t) { return reactor.wait(events, max, t); }, timeout_ms, st);
+}
@@ -0,0 +1,302 @@
+#pragma once
+// Per-loop counters for the event loop servers, plus a Unix socket to read them from.
+//
+// Every event loop (one per thread) registers a LoopStats and is the ONLY writer of it.
+// So counting needs no atomic read-modify-write: bump() is a relaxed load + store, which compiles
+// to a plain add, and each LoopStats sits on its own cache lines so two loops never fight over one.
+// The fields are still std::atomic so that the stats thread may READ them concurrently without a data race.
+// It sums all loops when somebody asks; no locks anywhere, the hot path never waits for a reader.
+//
+// Endpoint: metrics_serve("/tmp/echo.stats") starts a thread listening on that Unix socket.
+// Every connection gets one text snapshot (Prometheus exposition format) and is closed:
+//     socat - UNIX-CONNECT:/tmp/echo.stats      or      nc -U /tmp/echo.stats
+// The same thread samples the totals once a second to report current rates.
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static const int METRICS_MAX_LOOPS = 256;
+// events returned per epoll_wait/kevent: bucket b counts calls that returned [2^(b-1), 2^b)
+// (bucket 0 = returned nothing), the last bucket takes everything above
+static const int METRICS_WAIT_BUCKETS = 12;
+
+// --timestamps (common/kernel_ts.h): where a sampled request's time went
+enum LatStage { LAT_RX_QUEUE, LAT_PROCESS, LAT_TX, LAT_STAGES };
+static const char* const LAT_STAGE_NAMES[LAT_STAGES] = {"rx_queue", "process", "tx"};
+// bucket b counts samples of [2^(b-1), 2^b) microseconds (bucket 0 = under 1 us),
+// the last bucket takes everything above ~1 s
+static const int METRICS_LAT_BUCKETS = 22;
+
+typedef std::atomic<uint64_t> Counter;
+
+inline void bump(Counter& c, uint64_t n = 1) {
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+struct alignas(64) LoopStats {
+    Counter msgs_in{0};       // reads/datagrams that returned data
+    Counter bytes_in{0};
+    Counter msgs_out{0};      // writes/datagrams that sent something
+    Counter bytes_out{0};
+    Counter syscalls{0};      // every I/O syscall the loop made, waits included
+    Counter waits{0};         // epoll_wait / kevent calls
+    Counter wait_events{0};   // events those calls returned in total
+    Counter accepts{0};
+    Counter closes{0};
+    Counter eagain{0};        // calls that came back EAGAIN/EWOULDBLOCK
+    Counter short_writes{0};  // writes the socket only partly took
+    Counter timeouts{0};      // connections closed by an idle/read/write deadline
+    Counter rate_limited{0};  // datagrams dropped because their sender was over --rate-limit
+    Counter peer_evictions{0}; // senders pushed out of a full rate limit table
+    Counter replies_dropped{0}; // messages read but never answered: no room to queue the reply
+    Counter capture_dropped{0}; // messages --capture had no room left for
+    Counter wait_hist[METRICS_WAIT_BUCKETS] = {};
+    Counter lat_hist[LAT_STAGES][METRICS_LAT_BUCKETS] = {};
+    Counter lat_sum_ns[LAT_STAGES] = {};
+
+    void syscall(uint64_t n = 1) { bump(syscalls, n); }
+    void in(size_t bytes) { bump(msgs_in); bump(bytes_in, bytes); }
+    void out(size_t bytes) { bump(msgs_out); bump(bytes_out, bytes); }
+    void would_block() { bump(eagain); }
+    void short_write() { bump(short_writes); }
+    void accepted() { bump(accepts); }
+    void closed() { bump(closes); }
+    void timed_out() { bump(timeouts); }
+    void limited(uint64_t n = 1) { bump(rate_limited, n); }
+    void evicted(uint64_t n) { if (n) bump(peer_evictions, n); }
+    void reply_dropped() { bump(replies_dropped); }
+    void capture_drop() { bump(capture_dropped); }
+
+    void waited(int nevents) {
+        bump(syscalls);
+        bump(waits);
+        if (nevents <= 0) { bump(wait_hist[0]); return; }
+        bump(wait_events, (uint64_t)nevents);
+        int b = 1;
+        while (b < METRICS_WAIT_BUCKETS - 1 && (nevents >> b) != 0) ++b;
+        bump(wait_hist[b]);
+    }
+
+    void latency(int stage, uint64_t ns) {
+        bump(lat_sum_ns[stage], ns);
+        uint64_t us = ns / 1000;
+        int b = 0;
+        while (b < METRICS_LAT_BUCKETS - 1 && (us >> b) != 0) ++b;
+        bump(lat_hist[stage][b]);
+    }
+};
+
+struct MetricsRegistry {
+    LoopStats loops[METRICS_MAX_LOOPS];
+    std::atomic<int> count{0};
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+};
+
+inline MetricsRegistry g_metrics;
+
+// One per event loop, call from the loop's own thread before it starts counting.
+// Slots are never shared: bump() is only right with a single writer, two loops on one slot would
+// silently lose counts. So running out of slots is fatal
+inline LoopStats& metrics_register_loop() {
+    int i = g_metrics.count.fetch_add(1);
+    if (i >= METRICS_MAX_LOOPS) {
+        fprintf(stderr, "more than %d event loops, raise METRICS_MAX_LOOPS\n", METRICS_MAX_LOOPS);
+        exit(1);
+    }
+    return g_metrics.loops[i];
+}
+
+// Sum of every loop at one moment (each counter is read once, so it is only approximately consistent)
+struct MetricsTotals {
+    uint64_t msgs_in = 0, bytes_in = 0, msgs_out = 0, bytes_out = 0, syscalls = 0, waits = 0,
+             wait_events = 0, accepts = 0, closes = 0, eagain = 0, short_writes = 0, timeouts = 0,
+             rate_limited = 0, peer_evictions = 0, replies_dropped = 0,
+             capture_dropped = 0;
+    uint64_t wait_hist[METRICS_WAIT_BUCKETS] = {};
+    uint64_t lat_hist[LAT_STAGES][METRICS_LAT_BUCKETS] = {};
+    uint64_t lat_sum_ns[LAT_STAGES] = {};
+
+    void add(const LoopStats& s) {
+        auto rd = [](const Counter& c) { return c.load(std::memory_order_relaxed); };
+        msgs_in += rd(s.msgs_in);
+        bytes_in += rd(s.bytes_in);
+        msgs_out += rd(s.msgs_out);
+        bytes_out += rd(s.bytes_out);
+        syscalls += rd(s.syscalls);
+        waits += rd(s.waits);
+        wait_events += rd(s.wait_events);
+        accepts += rd(s.accepts);
+        closes += rd(s.closes);
+        eagain += rd(s.eagain);
+        short_writes += rd(s.short_writes);
+        timeouts += rd(s.timeouts);
+        rate_limited += rd(s.rate_limited);
+        peer_evictions += rd(s.peer_evictions);
+        replies_dropped += rd(s.replies_dropped);
+        capture_dropped += rd(s.capture_dropped);
+        for (int b = 0; b < METRICS_WAIT_BUCKETS; ++b) wait_hist[b] += rd(s.wait_hist[b]);
+        for (int g = 0; g < LAT_STAGES; ++g) {
+            lat_sum_ns[g] += rd(s.lat_sum_ns[g]);
+            for (int b = 0; b < METRICS_LAT_BUCKETS; ++b) lat_hist[g][b] += rd(s.lat_hist[g][b]);
+        }
+    }
+};
+
+inline MetricsTotals metrics_totals() {
+    MetricsTotals t;
+    int n = g_metrics.count.load();
+    if (n > METRICS_MAX_LOOPS) n = METRICS_MAX_LOOPS;
+    for (int i = 0; i < n; ++i) t.add(g_metrics.loops[i]);
+    return t;
+}
+
+struct MetricsRates {
+    double accepts = 0, msgs_in = 0, bytes_in = 0;
+};
+
+inline std::string metrics_render(const std::string& name, const MetricsRates& rates) {
+    std::string s;
+    char line[256];
+    auto put = [&](const char* metric, const char* labels, double v) {
+        snprintf(line, sizeof(line), "%s_%s%s %.17g\n", name.c_str(), metric, labels, v);
+        s += line;
+    };
+
+    int n = g_metrics.count.load();
+    if (n > METRICS_MAX_LOOPS) n = METRICS_MAX_LOOPS;
+    MetricsTotals total;
+    for (int i = 0; i < n; ++i) {
+        MetricsTotals one;
+        one.add(g_metrics.loops[i]);
+        total.add(g_metrics.loops[i]);
+        char lab[32];
+        snprintf(lab, sizeof(lab), "{loop=\"%d\"}", i);
+        put("messages_in_total", lab, (double)one.msgs_in);
+        put("messages_out_total", lab, (double)one.msgs_out);
+        put("active_connections", lab, (double)(one.accepts - one.closes));
+    }
+
+    put("uptime_seconds", "", std::chrono::duration<double>(std::chrono::steady_clock::now() - g_metrics.started).count());
+    put("loops", "", n);
+    put("messages_in_total", "", (double)total.msgs_in);
+    put("bytes_in_total", "", (double)total.bytes_in);
+    put("messages_out_total", "", (double)total.msgs_out);
+    put("bytes_out_total", "", (double)total.bytes_out);
+    put("syscalls_total", "", (double)total.syscalls);
+    put("syscalls_per_message", "", total.msgs_in ? (double)total.syscalls / (double)total.msgs_in : 0);
+    put("accepts_total", "", (double)total.accepts);
+    put("active_connections", "", (double)(total.accepts - total.closes));
+    put("eagain_total", "", (double)total.eagain);
+    put("short_writes_total", "", (double)total.short_writes);
+    put("timeouts_total", "", (double)total.timeouts);
+    put("rate_limited_total", "", (double)total.rate_limited);
+    put("peer_evictions_total", "", (double)total.peer_evictions);
+    put("replies_dropped_total", "", (double)total.replies_dropped);
+    put("capture_dropped_total", "", (double)total.capture_dropped);
+    put("accepts_per_second", "", rates.accepts);
+    put("messages_in_per_second", "", rates.msgs_in);
+    put("bytes_in_per_second", "", rates.bytes_in);
+
+    // histogram of events per wait call, cumulative buckets like Prometheus expects
+    uint64_t cum = 0;
+    for (int b = 0; b < METRICS_WAIT_BUCKETS; ++b) {
+        cum += total.wait_hist[b];
+        char lab[32];
+        if (b == METRICS_WAIT_BUCKETS - 1) snprintf(lab, sizeof(lab), "{le=\"+Inf\"}");
+        else snprintf(lab, sizeof(lab), "{le=\"%d\"}", b == 0 ? 0 : (1 << b) - 1);
+        put("events_per_wait_bucket", lab, (double)cum);
+    }
+    put("events_per_wait_sum", "", (double)total.wait_events);
+    put("events_per_wait_count", "", (double)total.waits);
+
+    // latency breakdown, only for the stages that have samples (ie with --timestamps)
+    for (int g = 0; g < LAT_STAGES; ++g) {
+        uint64_t count = 0;
+        for (int b = 0; b < METRICS_LAT_BUCKETS; ++b) count += total.lat_hist[g][b];
+        if (count == 0) continue;
+        char lab[64];
+        cum = 0;
+        for (int b = 0; b < METRICS_LAT_BUCKETS; ++b) {
+            cum += total.lat_hist[g][b];
+            if (b == METRICS_LAT_BUCKETS - 1) snprintf(lab, sizeof(lab), "{stage=\"%s\",le=\"+Inf\"}", LAT_STAGE_NAMES[g]);
+            else snprintf(lab, sizeof(lab), "{stage=\"%s\",le=\"%g\"}", LAT_STAGE_NAMES[g], (double)(1u << b) / 1e6);
+            put("latency_seconds_bucket", lab, (double)cum);
+        }
+        snprintf(lab, sizeof(lab), "{stage=\"%s\"}", LAT_STAGE_NAMES[g]);
+        put("latency_seconds_sum", lab, (double)total.lat_sum_ns[g] / 1e9);
+        put("latency_seconds_count", lab, (double)count);
+    }
+    return s;
+}
+
+inline void metrics_thread(int listen_fd, std::string name) {
+    MetricsTotals prev = metrics_totals();
+    auto prev_t = std::chrono::steady_clock::now();
+    MetricsRates rates;
+
+    while (true) {
+        pollfd p{listen_fd, POLLIN, 0};
+        int r = poll(&p, 1, 1000);
+
+        auto now = std::chrono::steady_clock::now();
+        double dt = std::chrono::duration<double>(now - prev_t).count();
+        if (dt >= 1.0) {
+            MetricsTotals cur = metrics_totals();
+            rates.accepts = (double)(cur.accepts - prev.accepts) / dt;
+            rates.msgs_in = (double)(cur.msgs_in - prev.msgs_in) / dt;
+            rates.bytes_in = (double)(cur.bytes_in - prev.bytes_in) / dt;
+            prev = cur;
+            prev_t = now;
+        }
+        if (r <= 0) continue;
+
+        int c = accept(listen_fd, nullptr, nullptr);
+        if (c < 0) continue;
+        std::string body = metrics_render(name, rates);
+        const char* p2 = body.data();
+        size_t left = body.size();
+        while (left > 0) {
+            // a scraper that hung up early must get us EPIPE, not a SIGPIPE that kills the server
+            ssize_t w = send(c, p2, left, MSG_NOSIGNAL);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) break;
+            p2 += w;
+            left -= (size_t)w;
+        }
+        close(c);
+    }
+}
+
+// Starts the stats endpoint on a Unix socket at `path`. `name` prefixes every metric
+inline bool metrics_serve(const std::string& path, const std::string& name) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) { perror("stats socket"); return false; }
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "stats socket path too long: %s\n", path.c_str());
+        close(fd);
+        return false;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    // a leftover socket file from a previous run would make bind() fail with EADDRINUSE
+    unlink(path.c_str());
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+        perror("stats bind");
+        close(fd);
+        return false;
+    }
+    std::thread(metrics_thread, fd, name).detach();
+    return true;
+}
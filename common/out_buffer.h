@@ -0,0 +1,82 @@
+#pragma once
+// Per-connection output buffering for the event loop servers.
+//
+// On a non-blocking socket write() can take only PART of what we give it (the kernel send buffer
+// is full because the peer reads slowly) or nothing at all (EAGAIN). Whatever it did not take
+// has to be kept somewhere until the socket is writable again, or it is silently lost.
+//
+// OutputQueue keeps those leftover bytes as a linked list of buffers borrowed from the loop's
+// BufferPool. Every buffer goes back to the pool the moment it is fully written, so a connection
+// with nothing pending holds no buffer at all and the queue itself is just two pointers and a count.
+
+#include <sys/uio.h>
+#include <cstddef>
+#include <cstring>
+
+#include "buffer_pool.h"
+
+struct OutputQueue {
+    BufChunk* head = nullptr;   // oldest buffer, written first
+    BufChunk* tail = nullptr;   // newest buffer, appended to
+    uint32_t bytes = 0;         // total bytes waiting
+
+    bool empty() const { return bytes == 0; }
+    size_t size() const { return bytes; }
+
+    void append(BufferPool& pool, const char* data, size_t len) {
+        while (len > 0) {
+            if (!tail || tail->room() == 0) {
+                // size the new buffer for what is left, the pool rounds up to its class
+                BufChunk* b = pool.get(len);
+                if (tail) tail->next = b;
+                else head = b;
+                tail = b;
+            }
+            size_t n = tail->room();
+            if (n > len) n = len;
+            memcpy(tail->data() + tail->end, data, n);
+            tail->end += (uint32_t)n;
+            data += n;
+            len -= n;
+            bytes += (uint32_t)n;
+        }
+    }
+
+    // Fills up to max iovecs with the waiting bytes, oldest first, ready for writev()
+    int fill_iovec(iovec* iov, int max) const {
+        int n = 0;
+        for (BufChunk* b = head; b && n < max; b = b->next) {
+            iov[n].iov_base = b->data() + b->start;
+            iov[n].iov_len = b->used();
+            ++n;
+        }
+        return n;
+    }
+
+    // Drops the first n bytes (the part writev() took), finished buffers go back to the pool
+    void consume(BufferPool& pool, size_t n) {
+        bytes -= (uint32_t)n;
+        while (n > 0 && head) {
+            size_t avail = head->used();
+            if (n < avail) {
+                head->start += (uint32_t)n;
+                return;
+            }
+            n -= avail;
+            BufChunk* done = head;
+            head = head->next;
+            pool.put(done);
+        }
+        if (!head) tail = nullptr;
+    }
+
+    void release(BufferPool& pool) {
+        while (head) {
+            BufChunk* next = head->next;
+            pool.put(head);
+            head = next;
+        }
+        tail = nullptr;
+        bytes = 0;
+    }
+};
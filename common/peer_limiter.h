@@ -0,0 +1,166 @@
+#pragma once
+// Per-peer rate limiting for the UDP server (--rate-limit PPS[:BURST]).
+//
+// Every sender (IPv4 address + port) gets a token bucket that refills at PPS datagrams per second
+// and holds at most BURST. A datagram that finds its sender's bucket empty is dropped before the
+// server does anything else with it: no capture, no log, no reply. A sender flooding us then burns
+// through its own budget, and everybody else's datagrams keep getting answered.
+//
+// The buckets live in a fixed size, set associative table:
+//   - a peer hashes to ONE 64 byte line of 4 entries and only that line is searched. A lookup touches
+//     a single cache line: no probe chains, no tombstones, no pointer chasing
+//   - a new peer takes a free entry of its line, or evicts the entry of that line that was seen
+//     longest ago. So memory is fixed (--peers N, 16 bytes each), and a flood from spoofed
+//     addresses can only churn the table, never grow it. An evicted peer comes back with a full bucket
+//   - the caller reads the clock once per batch and passes it in, nothing here makes a syscall.
+//     It counts milliseconds in 32 bits, so an entry stays 16 bytes and only wraps every ~49 days.
+//     A bucket is full after burst/rate anyway, longer idle times are cut to that before any math
+// The table belongs to one event loop, like the pools. With --workers N each worker has its own,
+// and SO_REUSEPORT keeps a sender on the same worker, so its budget is not split.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <vector>
+
+struct PeerEntry {
+    uint64_t key = 0;      // peer_key(), 0 = free
+    float tokens = 0;
+    uint32_t seen_ms = 0;  // last datagram, peer_clock_ms()
+};
+
+struct alignas(64) PeerLine {
+    static const int WAYS = 4;
+    PeerEntry e[WAYS];
+};
+static_assert(sizeof(PeerLine) == 64, "one line per cache line");
+
+// The clock the limiter runs on, read once per batch. Milliseconds are fine grained enough:
+// seen_ms is always set to the tick it was charged at, so the elapsed ticks add up exactly
+inline uint32_t peer_clock_ms() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u);
+}
+
+// addr and port as they come out of sockaddr_in (network order is fine, it only has to be unique)
+inline uint64_t peer_key(uint32_t addr, uint16_t port) {
+    return ((uint64_t)addr << 16 | port) | (1ull << 48);
+}
+
+struct PeerLimiter {
+    std::vector<PeerLine> lines;
+    int shift = 64;            // hash >> shift = line index
+    float rate_per_ms = 0;
+    float burst = 0;
+    uint32_t refill_ms = 0;    // empty to full, no point counting idle time beyond it
+    uint64_t evictions = 0;    // peers pushed out to make room for a new one
+
+    // rate in datagrams/s, burst in datagrams, peers = table capacity (rounded up to a power of 2)
+    void init(double rate, double burst_, size_t peers) {
+        size_t n = 1;
+        int bits = 0;
+        while (n * PeerLine::WAYS < peers) { n <<= 1; ++bits; }
+        lines.assign(n, PeerLine{});
+        shift = 64 - bits;
+        rate_per_ms = (float)(rate / 1e3);
+        burst = (float)burst_;
+        double full = burst_ / rate * 1e3 + 1;
+        refill_ms = full < 4e9 ? (uint32_t)full : 4000000000u;
+    }
+
+    size_t capacity() const { return lines.size() * PeerLine::WAYS; }
+
+    PeerLine& line_for(uint64_t key) {
+        // Fibonacci hashing: the multiply spreads the address bits over the top of the word
+        uint64_t h = key * 0x9E3779B97F4A7C15ull;
+        return lines[shift >= 64 ? 0 : (size_t)(h >> shift)];
+    }
+
+    bool take(PeerEntry& e, uint32_t now_ms, uint32_t cost) {
+        uint32_t idle = now_ms - e.seen_ms;
+        if (idle > refill_ms) idle = refill_ms;   // before the float math, a long idle time would round
+        float t = e.tokens + (float)idle * rate_per_ms;
+        if (t > burst) t = burst;
+        e.seen_ms = now_ms;
+        if (t < (float)cost) {
+            e.tokens = t;
+            return false;
+        }
+        e.tokens = t - (float)cost;
+        return true;
+    }
+
+    // true = let it through. cost = how many datagrams it stands for (a GRO super-packet is several)
+    bool allow(uint32_t addr, uint16_t port, uint32_t now_ms, uint32_t cost = 1) {
+        uint64_t key = peer_key(addr, port);
+        PeerLine& l = line_for(key);
+        PeerEntry* victim = nullptr;
+        uint32_t victim_age = 0;
+        for (int w = 0; w < PeerLine::WAYS; ++w) {
+            PeerEntry& e = l.e[w];
+            if (e.key == key) return take(e, now_ms, cost);
+            // entries are never freed, only replaced, so the first free one ends the search
+            if (e.key == 0) { victim = &e; break; }
+            uint32_t age = now_ms - e.seen_ms;
+            if (!victim || age > victim_age) { victim = &e; victim_age = age; }
+        }
+        if (victim->key) ++evictions;
+        victim->key = key;
+        victim->tokens = burst;
+        victim->seen_ms = now_ms;
+        return take(*victim, now_ms, cost);
+    }
+};
+
+// ---------------------------------------------------------------------------------------
+// Command line
+// ---------------------------------------------------------------------------------------
+
+struct PeerLimitConfig {
+    double rate = 0;          // datagrams per second per peer, 0 = no limit
+    double burst = 0;         // 0 = one second worth of rate
+    size_t peers = 65536;     // table capacity per loop (16 bytes each)
+};
+
+inline PeerLimitConfig g_peer_limit;
+
+// Returns true if argv[i] (and its value) was a rate limit option. Bad values exit.
+inline bool peer_limit_parse_arg(int argc, char** argv, int& i) {
+    if (i + 1 >= argc) return false;
+    if (strcmp(argv[i], "--rate-limit") == 0) {
+        // PPS or PPS:BURST
+        char* end;
+        g_peer_limit.rate = strtod(argv[++i], &end);
+        if (*end == ':') g_peer_limit.burst = strtod(end + 1, &end);
+        if (*end || g_peer_limit.rate <= 0 || g_peer_limit.burst < 0) {
+            fprintf(stderr, "bad --rate-limit %s, want PPS or PPS:BURST\n", argv[i]);
+            exit(1);
+        }
+        return true;
+    }
+    if (strcmp(argv[i], "--peers") == 0) {
+        long n = atol(argv[++i]);
+        if (n < PeerLine::WAYS) {
+            fprintf(stderr, "bad --peers %s\n", argv[i]);
+            exit(1);
+        }
+        g_peer_limit.peers = (size_t)n;
+        return true;
+    }
+    return false;
+}
+
+#define PEER_LIMIT_USAGE "[--rate-limit PPS[:BURST]] [--peers N]"
+
+// A loop's limiter per the command line, or nullptr when --rate-limit is off
+inline std::unique_ptr<PeerLimiter> peer_limit_create() {
+    if (g_peer_limit.rate <= 0) return nullptr;
+    std::unique_ptr<PeerLimiter> l(new PeerLimiter);
+    double burst = g_peer_limit.burst > 0 ? g_peer_limit.burst : g_peer_limit.rate;
+    l->init(g_peer_limit.rate, burst, g_peer_limit.peers);
+    return l;
+}
@@ -0,0 +1,131 @@
+#pragma once
+// Message transform pipeline for the echo path (--transform).
+//
+// A stage is a type with
+//     static bool apply(Msg& m);              false = reject the message (the server drops the client)
+//     static const bool framed_only = ...;     true if it only makes sense on whole messages
+// and a pipeline is a list of stages fixed at compile time:
+//     using TextEcho = Pipeline<ValidateText, LowerCase, Crc32cTrailer>;
+//     if (!TextEcho::run(m)) ...
+// run() is one fold expression over the stages, so the compiler inlines every apply() into it:
+// no virtual call and no loop over a stage list per message, and a NoStage costs nothing at all.
+//
+// Stages work in place on the received bytes (the message keeps its length), and may add a
+// trailer of up to 8 bytes that goes out right after it (Crc32cTrailer). The kernels behind them
+// are in common/byte_kernels.h.
+//
+// The server picks its pipeline at startup from --transform: pick_pipeline() returns the run()
+// of the matching instantiation, so the per-message cost of the choice is one indirect call for
+// the whole chain.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include "byte_kernels.h"
+
+struct Msg {
+    char* data;
+    size_t len;
+    char trailer[8] = {};
+    uint8_t trailer_len = 0;
+
+    Msg(char* d, size_t n) : data(d), len(n) {}
+};
+
+struct NoStage {
+    static const bool framed_only = false;
+    static bool apply(Msg&) { return true; }
+};
+
+// Rejects a message with anything but printable ASCII, tab, CR and LF in it
+struct ValidateText {
+    static const bool framed_only = false;
+    static bool apply(Msg& m) { return find_non_text(m.data, m.len) == m.len; }
+};
+
+struct LowerCase {
+    static const bool framed_only = false;
+    static bool apply(Msg& m) { ascii_fold(m.data, m.len, 'A'); return true; }
+};
+
+struct UpperCase {
+    static const bool framed_only = false;
+    static bool apply(Msg& m) { ascii_fold(m.data, m.len, 'a'); return true; }
+};
+
+// Appends the CRC32C of the (already transformed) message, big-endian. Needs message boundaries:
+// on a plain stream "the message" would be whatever one read() returned
+struct Crc32cTrailer {
+    static const bool framed_only = true;
+    static bool apply(Msg& m) {
+        uint32_t c = crc32c(0, m.data, m.len);
+        m.trailer[m.trailer_len++] = (char)(c >> 24);
+        m.trailer[m.trailer_len++] = (char)(c >> 16);
+        m.trailer[m.trailer_len++] = (char)(c >> 8);
+        m.trailer[m.trailer_len++] = (char)c;
+        return true;
+    }
+};
+
+template <typename... Stages>
+struct Pipeline {
+    static const bool framed_only = (false || ... || Stages::framed_only);
+
+    // stops at the first stage that rejects
+    static bool run(Msg& m) { return (true && ... && Stages::apply(m)); }
+};
+
+// ---------------------------------------------------------------------------------------
+// --transform for the servers: any of validate, lower|upper, crc32c, comma separated.
+// They always run in that order (check the bytes as received, fold, checksum what goes out),
+// whatever order they are listed in.
+// ---------------------------------------------------------------------------------------
+
+using PipelineFn = bool (*)(Msg&);
+
+struct TransformSpec {
+    bool validate = false;
+    int fold = 0;          // 0 = none, 'A' = lower, 'a' = upper
+    bool crc = false;
+
+    bool empty() const { return !validate && !fold && !crc; }
+    bool framed_only() const { return crc; }
+};
+
+// false = unknown stage name
+inline bool parse_transform(const char* arg, TransformSpec& spec) {
+    std::string s(arg);
+    size_t pos = 0;
+    while (pos <= s.size()) {
+        size_t comma = s.find(',', pos);
+        std::string name = s.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+        if (name == "validate") spec.validate = true;
+        else if (name == "lower") spec.fold = 'A';
+        else if (name == "upper") spec.fold = 'a';
+        else if (name == "crc32c") spec.crc = true;
+        else if (!name.empty()) return false;
+        if (comma == std::string::npos) break;
+        pos = comma + 1;
+    }
+    return true;
+}
+
+template <typename V, typename F>
+PipelineFn pick_pipeline_crc(bool crc) {
+    return crc ? &Pipeline<V, F, Crc32cTrailer>::run : &Pipeline<V, F, NoStage>::run;
+}
+
+template <typename V>
+PipelineFn pick_pipeline_fold(int fold, bool crc) {
+    if (fold == 'A') return pick_pipeline_crc<V, LowerCase>(crc);
+    if (fold == 'a') return pick_pipeline_crc<V, UpperCase>(crc);
+    return pick_pipeline_crc<V, NoStage>(crc);
+}
+
+// nullptr = nothing to do, plain echo
+inline PipelineFn pick_pipeline(const TransformSpec& spec) {
+    if (spec.empty()) return nullptr;
+    return spec.validate ? pick_pipeline_fold<ValidateText>(spec.fold, spec.crc)
+                         : pick_pipeline_fold<NoStage>(spec.fold, spec.crc);
+}
@@ -0,0 +1,394 @@
+#pragma once
+// Readiness event loop backends ("reactors"): tell one which fds you care about, ask it which are ready.
+//
+//     EpollReactor    epoll (Linux)
+//     UringReactor    io_uring poll requests (Linux 6.0+). Same readiness model as epoll, but
+//                     registering, changing and waiting all go through the one io_uring_enter
+//                     per loop pass, so an interest change costs no syscall of its own
+//     KqueueReactor   kqueue (BSD/macOS). Interest changes are queued and handed to the kevent()
+//                     call that waits next, so they cost no syscall of their own either
+//
+// A loop is written once, as a template over the backend:
+//     template <typename R> int loop(R& reactor) { ... int n = reactor.wait(events, 64, -1); ... }
+//     with_reactor(g_reactor.backend, [&](auto& r) { return loop(r); });
+// with_reactor() picks the instantiation by name at startup. Everything inside the loop is a direct
+// call into one concrete backend, which the compiler can inline: there is no virtual call per event
+// or per interest change.
+//
+// Every backend has:
+//     bool init()                                          false = failed, already reported
+//     bool add(int fd, uint32_t interest)
+//     void modify(int fd, uint32_t old_interest, uint32_t interest)
+//     void remove(int fd)                                  call it right before close(fd)
+//     int wait(RxEvent* out, int max, int timeout_ms)      -1 = error (errno), 0 = nothing ready
+//     NAME, and CTL_SYSCALL = whether add/modify/remove each make a syscall (for the stats)
+// interest is RX_IN and/or RX_OUT, plus RX_EDGE for edge triggered (EPOLLET / EV_CLEAR; the io_uring
+// backend re-arms after every event and stays level triggered).
+// Reported events are RX_IN / RX_OUT, plus RX_HUP (peer hung up) and RX_ERR (socket error). Both of
+// these also set RX_IN, so a loop finds out the details from read() like it would anyway.
+// kqueue reports readable and writable as two separate events for the same fd, the others as one.
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/epoll.h>
+#include "uring.h"
+#define REACTOR_HAVE_EPOLL 1
+#define REACTOR_HAVE_URING 1
+#define REACTOR_DEFAULT "epoll"
+#define REACTOR_BACKENDS "epoll|uring"
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__) || defined(__DragonFly__)
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+#define REACTOR_HAVE_KQUEUE 1
+#define REACTOR_DEFAULT "kqueue"
+#define REACTOR_BACKENDS "kqueue"
+#else
+#error "no event loop backend for this platform (needs epoll or kqueue)"
+#endif
+
+enum : uint32_t {
+    RX_IN = 1,
+    RX_OUT = 2,
+    RX_EDGE = 4,   // interest only
+    RX_HUP = 8,    // events only
+    RX_ERR = 16,   // events only
+};
+
+struct RxEvent {
+    int fd;
+    uint32_t events;
+};
+
+#ifdef REACTOR_HAVE_EPOLL
+struct EpollReactor {
+    static constexpr const char* NAME = "epoll";
+    static const bool CTL_SYSCALL = true;
+
+    int epfd = -1;
+    std::vector<epoll_event> evs;
+
+    EpollReactor() = default;
+    EpollReactor(const EpollReactor&) = delete;
+    EpollReactor& operator=(const EpollReactor&) = delete;
+    ~EpollReactor() { if (epfd >= 0) close(epfd); }
+
+    bool init() {
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (epfd < 0) { perror("epoll_create1"); return false; }
+        return true;
+    }
+
+    static uint32_t to_epoll(uint32_t interest) {
+        return (interest & RX_IN ? EPOLLIN : 0u) | (interest & RX_OUT ? EPOLLOUT : 0u) |
+               (interest & RX_EDGE ? (uint32_t)EPOLLET : 0u);
+    }
+
+    bool add(int fd, uint32_t interest) {
+        epoll_event ev{};
+        ev.events = to_epoll(interest);
+        ev.data.fd = fd;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) { perror("epoll_ctl"); return false; }
+        return true;
+    }
+
+    void modify(int fd, uint32_t, uint32_t interest) {
+        epoll_event ev{};
+        ev.events = to_epoll(interest);
+        ev.data.fd = fd;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+    }
+
+    // close() takes the fd out of the set by itself (as long as nobody dup()ed it)
+    void remove(int) {}
+
+    int wait(RxEvent* out, int max, int timeout_ms) {
+        if ((int)evs.size() < max) evs.resize((size_t)max);
+        int n = epoll_wait(epfd, evs.data(), max, timeout_ms);
+        for (int i = 0; i < n; ++i) {
+            uint32_t e = evs[i].events;
+            uint32_t r = (e & EPOLLIN ? RX_IN : 0u) | (e & EPOLLOUT ? RX_OUT : 0u);
+            if (e & EPOLLHUP) r |= RX_HUP | RX_IN;
+            if (e & EPOLLERR) r |= RX_ERR | RX_IN;
+            out[i] = RxEvent{evs[i].data.fd, r};
+        }
+        return n;
+    }
+};
+#endif
+
+#ifdef REACTOR_HAVE_URING
+// One IORING_OP_POLL_ADD per fd, one shot. When it completes the fd is reported and queued for
+// re-arming, and the new poll goes out with the next wait(), after the loop has read or written.
+// A poll armed on an fd that is still readable completes right away, which is what makes this
+// level triggered. Changing the interest cancels the armed poll (IORING_OP_POLL_REMOVE) and arms
+// a new one. A per-fd generation in user_data tells the cancelled one's completion apart.
+struct UringReactor {
+    static constexpr const char* NAME = "uring";
+    static const bool CTL_SYSCALL = false;
+
+    enum : uint8_t { OP_POLL = 1, OP_POLL_REMOVE = 2 };
+
+    struct PollFd {
+        uint32_t interest = 0;
+        uint16_t gen = 0;
+        bool armed = false;     // a poll for (fd, gen) is in the kernel
+        bool pending = false;   // in to_arm
+    };
+
+    Uring ring;
+    std::vector<PollFd> fds;
+    std::vector<int> to_arm;
+
+    UringReactor() = default;
+    UringReactor(const UringReactor&) = delete;
+    UringReactor& operator=(const UringReactor&) = delete;
+    ~UringReactor() { ring.destroy(); }
+
+    bool init() { return ring.init(1024); }
+
+    PollFd& at(int fd) {
+        if ((size_t)fd >= fds.size()) fds.resize(std::max((size_t)fd + 1, fds.size() * 2));
+        return fds[(size_t)fd];
+    }
+
+    void queue_arm(int fd, PollFd& p) {
+        if (!p.pending) { p.pending = true; to_arm.push_back(fd); }
+    }
+
+    // cancel whatever poll fd has in flight, its completion will carry a stale generation
+    void disarm(int fd, PollFd& p) {
+        if (p.armed) {
+            io_uring_sqe* sqe = ring.get_sqe();
+            if (sqe) {
+                sqe->opcode = IORING_OP_POLL_REMOVE;
+                sqe->addr = uring_pack(OP_POLL, fd, p.gen);
+                sqe->user_data = uring_pack(OP_POLL_REMOVE, fd);
+            }
+            p.armed = false;
+        }
+        ++p.gen;
+    }
+
+    bool add(int fd, uint32_t interest) {
+        PollFd& p = at(fd);
+        disarm(fd, p);   // only does something for an fd number that was never remove()d
+        p.interest = interest;
+        queue_arm(fd, p);
+        return true;
+    }
+
+    void modify(int fd, uint32_t, uint32_t interest) {
+        PollFd& p = at(fd);
+        if (p.interest == interest) return;
+        disarm(fd, p);
+        p.interest = interest;
+        queue_arm(fd, p);
+    }
+
+    void remove(int fd) {
+        PollFd& p = at(fd);
+        disarm(fd, p);
+        p.interest = 0;
+    }
+
+    void arm_pending() {
+        size_t kept = 0;
+        for (int fd : to_arm) {
+            PollFd& p = fds[(size_t)fd];
+            if (p.armed || !p.interest) { p.pending = false; continue; }
+            io_uring_sqe* sqe = ring.get_sqe();
+            if (!sqe) { to_arm[kept++] = fd; continue; }   // SQ full even after a flush, next time
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = fd;
+            sqe->poll32_events = (p.interest & RX_IN ? POLLIN : 0) | (p.interest & RX_OUT ? POLLOUT : 0);
+            sqe->user_data = uring_pack(OP_POLL, fd, p.gen);
+            p.armed = true;
+            p.pending = false;
+        }
+        to_arm.resize(kept);
+    }
+
+    int reap(RxEvent* out, int max) {
+        int n = 0;
+        ring.for_each_cqe([&](io_uring_cqe* cqe) {
+            if (uring_op(cqe->user_data) != OP_POLL) return;   // a POLL_REMOVE's own completion
+            int fd = uring_fd(cqe->user_data);
+            if ((size_t)fd >= fds.size()) return;
+            PollFd& p = fds[(size_t)fd];
+            if (!p.armed || uring_bid(cqe->user_data) != p.gen) return;   // cancelled, or the fd moved on
+            p.armed = false;
+            queue_arm(fd, p);
+            uint32_t r;
+            if (cqe->res < 0) {
+                r = RX_ERR | RX_IN;
+            } else {
+                r = (cqe->res & POLLIN ? RX_IN : 0u) | (cqe->res & POLLOUT ? RX_OUT : 0u);
+                if (cqe->res & POLLHUP) r |= RX_HUP | RX_IN;
+                if (cqe->res & POLLERR) r |= RX_ERR | RX_IN;
+            }
+            out[n++] = RxEvent{fd, r};
+        }, (unsigned)max);
+        return n;
+    }
+
+    int wait(RxEvent* out, int max, int timeout_ms) {
+        arm_pending();
+        // completions left over from the last call (more than `max` were ready) go first
+        int n = reap(out, max);
+        if (n > 0) {
+            if (ring.to_submit) ring.submit_and_wait(0);
+            return n;
+        }
+        int rc = ring.submit_and_wait_ms(timeout_ms);
+        if (rc < 0 && rc != -ETIME && rc != -EBUSY && rc != -EAGAIN) {
+            errno = -rc;
+            return -1;
+        }
+        return reap(out, max);
+    }
+};
+#endif
+
+#ifdef REACTOR_HAVE_KQUEUE
+// kqueue keeps one registration per (fd, filter): EVFILT_READ for "readable", EVFILT_WRITE for
+// "writable". A change is a struct kevent with EV_ADD or EV_DELETE. We collect them in `changes`
+// and pass the whole list as the changelist of the kevent() call that waits, so the kernel applies
+// them and collects events in one syscall.
+struct KqueueReactor {
+    static constexpr const char* NAME = "kqueue";
+    static const bool CTL_SYSCALL = false;
+
+    int kq = -1;
+    std::vector<struct kevent> changes;
+    std::vector<struct kevent> evs;
+
+    KqueueReactor() = default;
+    KqueueReactor(const KqueueReactor&) = delete;
+    KqueueReactor& operator=(const KqueueReactor&) = delete;
+    ~KqueueReactor() { if (kq >= 0) close(kq); }
+
+    bool init() {
+        kq = kqueue();
+        if (kq < 0) { perror("kqueue"); return false; }
+        return true;
+    }
+
+    void change(int fd, int16_t filter, uint16_t flags) {
+        struct kevent ev;
+        EV_SET(&ev, fd, filter, flags, 0, 0, nullptr);
+        changes.push_back(ev);
+    }
+
+    bool add(int fd, uint32_t interest) {
+        uint16_t clear = interest & RX_EDGE ? EV_CLEAR : 0;
+        if (interest & RX_IN) change(fd, EVFILT_READ, EV_ADD | clear);
+        if (interest & RX_OUT) change(fd, EVFILT_WRITE, EV_ADD | clear);
+        return true;
+    }
+
+    void modify(int fd, uint32_t old_interest, uint32_t interest) {
+        uint16_t clear = interest & RX_EDGE ? EV_CLEAR : 0;
+        if ((old_interest ^ interest) & RX_IN) change(fd, EVFILT_READ, interest & RX_IN ? EV_ADD | clear : EV_DELETE);
+        if ((old_interest ^ interest) & RX_OUT) change(fd, EVFILT_WRITE, interest & RX_OUT ? EV_ADD | clear : EV_DELETE);
+    }
+
+    // close() drops every registration of the fd. Only changes that havent reached the kernel
+    // yet have to go, or they would land on whatever gets this fd number next
+    void remove(int fd) {
+        changes.erase(std::remove_if(changes.begin(), changes.end(),
+                                     [fd](const struct kevent& ev) { return (int)ev.ident == fd; }),
+                      changes.end());
+    }
+
+    int wait(RxEvent* out, int max, int timeout_ms) {
+        if ((int)evs.size() < max) evs.resize((size_t)max);
+        timespec ts{timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+        int n = kevent(kq, changes.data(), (int)changes.size(), evs.data(), max, timeout_ms >= 0 ? &ts : nullptr);
+        if (n < 0 && errno != EINTR) return -1;
+        // applied, also when the wait itself got interrupted
+        changes.clear();
+        if (n < 0) return -1;
+        int k = 0;
+        for (int i = 0; i < n; ++i) {
+            const struct kevent& ev = evs[(size_t)i];
+            if (ev.flags & EV_ERROR) continue;   // a change that failed, eg on an fd closed meanwhile
+            uint32_t r = ev.filter == EVFILT_READ ? RX_IN : RX_OUT;
+            if (ev.flags & EV_EOF) r |= RX_HUP | RX_IN;
+            out[k++] = RxEvent{(int)ev.ident, r};
+        }
+        return k;
+    }
+};
+#endif
+
+// ---------------------------------------------------------------------------------------
+// --backend for the servers
+// ---------------------------------------------------------------------------------------
+
+struct ReactorConfig {
+    const char* backend = REACTOR_DEFAULT;
+};
+
+inline ReactorConfig g_reactor;
+
+inline bool reactor_available(const char* name) {
+#ifdef REACTOR_HAVE_EPOLL
+    if (strcmp(name, EpollReactor::NAME) == 0) return true;
+#endif
+#ifdef REACTOR_HAVE_URING
+    if (strcmp(name, UringReactor::NAME) == 0) return true;
+#endif
+#ifdef REACTOR_HAVE_KQUEUE
+    if (strcmp(name, KqueueReactor::NAME) == 0) return true;
+#endif
+    return false;
+}
+
+// Returns true if argv[i] (and its value) was --backend. A backend this build doesnt have exits.
+inline bool reactor_parse_arg(int argc, char** argv, int& i) {
+    if (strcmp(argv[i], "--backend") != 0 || i + 1 >= argc) return false;
+    g_reactor.backend = argv[++i];
+    if (!reactor_available(g_reactor.backend)) {
+        fprintf(stderr, "unknown --backend %s, this build has: " REACTOR_BACKENDS "\n", g_reactor.backend);
+        exit(1);
+    }
+    return true;
+}
+
+#define REACTOR_USAGE "[--backend " REACTOR_BACKENDS "]"
+
+// Creates the backend called `name` and returns f(backend), or 1 if it failed to start.
+// f is instantiated once per backend this build has
+template <typename F>
+int with_reactor(const char* name, F&& f) {
+#ifdef REACTOR_HAVE_EPOLL
+    if (strcmp(name, EpollReactor::NAME) == 0) {
+        EpollReactor r;
+        return r.init() ? f(r) : 1;
+    }
+#endif
+#ifdef REACTOR_HAVE_URING
+    if (strcmp(name, UringReactor::NAME) == 0) {
+        UringReactor r;
+        return r.init() ? f(r) : 1;
+    }
+#endif
+#ifdef REACTOR_HAVE_KQUEUE
+    if (strcmp(name, KqueueReactor::NAME) == 0) {
+        KqueueReactor r;
+        return r.init() ? f(r) : 1;
+    }
+#endif
+    fprintf(stderr, "unknown backend %s\n", name);
+    return 1;
+}
@@ -0,0 +1,360 @@
+#pragma once
+// Shared memory transport for clients on the same host (Linux only).
+//
+// An echo over loopback TCP still walks the whole network stack twice per round trip (send, softirq,
+// receive queue, wakeup), several us even though both ends are on one box. Here client and server
+// instead share a memfd holding two byte rings, one per direction:
+//
+//     [ShmRegion: magic, ring size, c2s control, s2c control][c2s bytes][s2c bytes]
+//
+// Each ring has exactly one producer and one consumer, so it needs no locks: the producer only ever
+// writes `head` (total bytes written), the consumer only ever writes `tail` (total bytes read), and
+// each reads the other's counter with acquire/release ordering. The two counters sit on separate
+// cache lines so producer and consumer dont fight over one line.
+//
+// Wakeups: a side that runs out of work sets its `waiting` flag in the ring, re-checks the ring, and
+// only then sleeps on its eventfd. The other side checks the flag after every push/pop and writes the
+// eventfd only when it is set. While both sides are busy, a message costs a memcpy and a couple of
+// atomic loads and stores, no syscall at all. eventfd (rather than a bare futex) because the server
+// sleeps in epoll_wait, and an eventfd can sit in its epoll set next to the sockets.
+//
+// Setup goes over a Unix socket: the client connects to the server's path, the server creates the
+// memfd and two eventfds and passes all three with SCM_RIGHTS. The Unix socket stays open for the
+// whole session and is how each side notices that the other one died.
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static const uint32_t SHM_MAGIC = 0x4543484f;              // "ECHO"
+static const size_t SHM_RING_BYTES = 256 * 1024;          // per direction, a power of two
+
+// One direction's counters. Everything in here lives in the shared mapping
+struct ShmRingCtl {
+    alignas(64) std::atomic<uint64_t> head{0};             // written by the producer
+    std::atomic<uint32_t> producer_waiting{0};             // producer sleeps until there is room
+    alignas(64) std::atomic<uint64_t> tail{0};             // written by the consumer
+    std::atomic<uint32_t> consumer_waiting{0};             // consumer sleeps until there is data
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared memory counters must be lock free");
+
+struct ShmRegion {
+    uint32_t magic;
+    uint32_t ring_bytes;
+    ShmRingCtl c2s;   // client -> server
+    ShmRingCtl s2c;   // server -> client
+};
+
+inline size_t shm_region_bytes(size_t ring_bytes) {
+    return (sizeof(ShmRegion) + 4095) / 4096 * 4096 + 2 * ring_bytes;
+}
+
+inline void shm_notify(int efd) {
+    uint64_t one = 1;
+    ssize_t r = write(efd, &one, sizeof(one));
+    (void)r;   // EAGAIN = counter already huge, the peer is awake anyway
+}
+
+// Resets an eventfd after its wakeup was seen
+inline void shm_drain(int efd) {
+    uint64_t v;
+    ssize_t r = read(efd, &v, sizeof(v));
+    (void)r;
+}
+
+// One side's view of one ring. `peer_efd` is the eventfd the OTHER side sleeps on
+struct ShmRing {
+    ShmRingCtl* ctl = nullptr;
+    char* data = nullptr;
+    size_t size = 0;
+    int peer_efd = -1;
+
+    size_t readable() const {
+        return (size_t)(ctl->head.load(std::memory_order_acquire) - ctl->tail.load(std::memory_order_relaxed));
+    }
+    size_t writable() const {
+        return size - (size_t)(ctl->head.load(std::memory_order_relaxed) - ctl->tail.load(std::memory_order_acquire));
+    }
+    // The peer is another process: a broken (or hostile) one could leave head and tail anywhere
+    bool sane() const {
+        return ctl->head.load(std::memory_order_acquire) - ctl->tail.load(std::memory_order_acquire) <= size;
+    }
+
+    // Producer: copies in as much as fits, returns how much that was
+    size_t write(const void* src, size_t len) {
+        uint64_t h = ctl->head.load(std::memory_order_relaxed);
+        size_t room = size - (size_t)(h - ctl->tail.load(std::memory_order_acquire));
+        if (len > room) len = room;
+        if (len == 0) return 0;
+        size_t off = (size_t)h & (size - 1);
+        size_t first = len < size - off ? len : size - off;
+        memcpy(data + off, src, first);
+        memcpy(data, (const char*)src + first, len - first);
+        ctl->head.store(h + len, std::memory_order_release);
+        return len;
+    }
+
+    // Consumer: copies out up to len bytes, returns how many
+    size_t read(void* dst, size_t len) {
+        uint64_t t = ctl->tail.load(std::memory_order_relaxed);
+        size_t avail = (size_t)(ctl->head.load(std::memory_order_acquire) - t);
+        if (len > avail) len = avail;
+        if (len == 0) return 0;
+        size_t off = (size_t)t & (size - 1);
+        size_t first = len < size - off ? len : size - off;
+        memcpy(dst, data + off, first);
+        memcpy((char*)dst + first, data, len - first);
+        ctl->tail.store(t + len, std::memory_order_release);
+        return len;
+    }
+
+    // Consumer: moves up to max bytes straight into another ring (no bounce buffer), returns how many
+    size_t move_to(ShmRing& out, size_t max = SIZE_MAX) {
+        size_t moved = 0;
+        while (moved < max) {
+            uint64_t t = ctl->tail.load(std::memory_order_relaxed);
+            size_t avail = (size_t)(ctl->head.load(std::memory_order_acquire) - t);
+            size_t off = (size_t)t & (size - 1);
+            size_t len = avail < size - off ? avail : size - off;   // contiguous part
+            if (len > max - moved) len = max - moved;
+            size_t n = out.write(data + off, len);
+            if (n == 0) break;
+            ctl->tail.store(t + n, std::memory_order_release);
+            moved += n;
+        }
+        return moved;
+    }
+
+    // After a write: wake the consumer if it went to sleep. The seq_cst fence pairs with the one in
+    // consumer_sleep(): either we see its flag, or it sees our new head, never neither
+    void wake_consumer() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (ctl->consumer_waiting.load(std::memory_order_relaxed) &&
+            ctl->consumer_waiting.exchange(0, std::memory_order_relaxed))
+            shm_notify(peer_efd);
+    }
+    // After a read: wake the producer if it was waiting for room
+    void wake_producer() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (ctl->producer_waiting.load(std::memory_order_relaxed) &&
+            ctl->producer_waiting.exchange(0, std::memory_order_relaxed))
+            shm_notify(peer_efd);
+    }
+
+    // Announce we are about to sleep for data. false = data showed up meanwhile, dont sleep
+    bool consumer_sleep() {
+        ctl->consumer_waiting.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (readable() == 0) return true;
+        ctl->consumer_waiting.store(0, std::memory_order_relaxed);
+        return false;
+    }
+    // Same for room to write
+    bool producer_sleep() {
+        ctl->producer_waiting.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (writable() == 0) return true;
+        ctl->producer_waiting.store(0, std::memory_order_relaxed);
+        return false;
+    }
+};
+
+// One session, from either side
+struct ShmEndpoint {
+    ShmRegion* region = nullptr;
+    size_t map_bytes = 0;
+    ShmRing rx, tx;
+    int efd = -1;        // we sleep on this one
+    int peer_efd = -1;   // the other side sleeps on this one
+    int ctl_fd = -1;     // the Unix socket, EOF/HUP = the other side is gone
+};
+
+inline void shm_close(ShmEndpoint& ep) {
+    if (ep.region) munmap(ep.region, ep.map_bytes);
+    if (ep.efd >= 0) close(ep.efd);
+    if (ep.peer_efd >= 0) close(ep.peer_efd);
+    if (ep.ctl_fd >= 0) close(ep.ctl_fd);
+    ep = ShmEndpoint{};
+}
+
+inline bool shm_map(ShmEndpoint& ep, int memfd, size_t ring_bytes, bool server) {
+    ep.map_bytes = shm_region_bytes(ring_bytes);
+    void* p = mmap(nullptr, ep.map_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (p == MAP_FAILED) { perror("mmap shm"); return false; }
+    ep.region = (ShmRegion*)p;
+    char* rings = (char*)p + (sizeof(ShmRegion) + 4095) / 4096 * 4096;
+    ShmRing c2s{&ep.region->c2s, rings, ring_bytes, -1};
+    ShmRing s2c{&ep.region->s2c, rings + ring_bytes, ring_bytes, -1};
+    ep.rx = server ? c2s : s2c;
+    ep.tx = server ? s2c : c2s;
+    ep.rx.peer_efd = ep.peer_efd;
+    ep.tx.peer_efd = ep.peer_efd;
+    return true;
+}
+
+// Server: non-blocking Unix listener at path (an old socket file is replaced)
+inline int shm_listen(const char* path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) { perror("socket AF_UNIX"); return -1; }
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        perror("bind/listen shm socket");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Server: accepts one client and hands it a fresh region.
+// 1 = ok, 0 = nothing to accept, -1 = the handshake failed (that client was dropped),
+// -2 = accept itself failed (EMFILE etc): the client is still queued, retrying right away fails again
+inline int shm_accept(int listen_fd, ShmEndpoint& ep) {
+    int cfd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (cfd < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+        perror("accept4 shm");
+        return -2;
+    }
+    ep.ctl_fd = cfd;
+
+    // sealed to its size, so the client cant shrink it under us (that would SIGBUS the server)
+    int memfd = memfd_create("echo-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    ep.efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ep.peer_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    bool ok = memfd >= 0 && ep.efd >= 0 && ep.peer_efd >= 0 &&
+              ftruncate(memfd, (off_t)shm_region_bytes(SHM_RING_BYTES)) == 0 &&
+              fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == 0 &&
+              shm_map(ep, memfd, SHM_RING_BYTES, true);
+    if (ok) {
+        new (&ep.region->c2s) ShmRingCtl();
+        new (&ep.region->s2c) ShmRingCtl();
+        ep.region->ring_bytes = (uint32_t)SHM_RING_BYTES;
+        ep.region->magic = SHM_MAGIC;
+
+        // [memfd, client's eventfd, server's eventfd]
+        int fds[3] = {memfd, ep.peer_efd, ep.efd};
+        char byte = 'S';
+        iovec iov{&byte, 1};
+        alignas(cmsghdr) char ctrl[CMSG_SPACE(sizeof(fds))] = {};
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = ctrl;
+        msg.msg_controllen = sizeof(ctrl);
+        cmsghdr* c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(fds));
+        memcpy(CMSG_DATA(c), fds, sizeof(fds));
+        ok = sendmsg(cfd, &msg, MSG_NOSIGNAL) == 1;
+    }
+    if (memfd >= 0) close(memfd);   // the mapping keeps it alive
+    if (!ok) {
+        perror("shm handshake");
+        shm_close(ep);
+        return -1;
+    }
+    return 1;
+}
+
+// Client: connects to the server's path and maps the region it sends back
+inline bool shm_connect(const char* path, ShmEndpoint& ep) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) { perror("socket AF_UNIX"); return false; }
+    ep.ctl_fd = fd;
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("connect shm socket");
+        shm_close(ep);
+        return false;
+    }
+
+    int fds[3] = {-1, -1, -1};
+    char byte;
+    iovec iov{&byte, 1};
+    alignas(cmsghdr) char ctrl[CMSG_SPACE(sizeof(fds))] = {};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+    ssize_t r;
+    do r = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC); while (r < 0 && errno == EINTR);
+    cmsghdr* c = r == 1 ? CMSG_FIRSTHDR(&msg) : nullptr;
+    if (!c || c->cmsg_type != SCM_RIGHTS || c->cmsg_len != CMSG_LEN(sizeof(fds))) {
+        fprintf(stderr, "shm handshake: no fds from the server\n");
+        shm_close(ep);
+        return false;
+    }
+    memcpy(fds, CMSG_DATA(c), sizeof(fds));
+    ep.efd = fds[1];
+    ep.peer_efd = fds[2];
+
+    struct stat sb;
+    bool ok = fstat(fds[0], &sb) == 0 && shm_map(ep, fds[0], SHM_RING_BYTES, false) &&
+              (size_t)sb.st_size >= ep.map_bytes && ep.region->magic == SHM_MAGIC &&
+              ep.region->ring_bytes == SHM_RING_BYTES;
+    close(fds[0]);
+    if (!ok) {
+        fprintf(stderr, "shm handshake: bad region\n");
+        shm_close(ep);
+        return false;
+    }
+    return true;
+}
+
+// Client: sleeps until the server signals, or up to timeout_ms (-1 = forever).
+// false = the server is gone
+inline bool shm_wait(ShmEndpoint& ep, int timeout_ms) {
+    pollfd p[2] = {{ep.efd, POLLIN, 0}, {ep.ctl_fd, POLLIN, 0}};
+    int n = poll(p, 2, timeout_ms);
+    if (n < 0) return errno == EINTR;
+    if (p[1].revents) return false;   // the server never writes here, anything is EOF or an error
+    if (p[0].revents) shm_drain(ep.efd);
+    return true;
+}
+
+// Client: blocking send of all len bytes. false = the server is gone
+inline bool shm_send_all(ShmEndpoint& ep, const char* data, size_t len) {
+    while (len > 0) {
+        size_t n = ep.tx.write(data, len);
+        if (n > 0) {
+            ep.tx.wake_consumer();
+            data += n;
+            len -= n;
+        } else if (ep.tx.producer_sleep() && !shm_wait(ep, -1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Client: blocking receive of at least 1 byte. 0 = the server is gone
+inline size_t shm_recv(ShmEndpoint& ep, char* out, size_t max) {
+    while (true) {
+        size_t n = ep.rx.read(out, max);
+        if (n > 0) {
+            ep.rx.wake_producer();
+            return n;
+        }
+        if (ep.rx.consumer_sleep() && !shm_wait(ep, -1)) return 0;
+    }
+}
@@ -0,0 +1,122 @@
+#pragma once
+// Socket setup shared by the event-loop servers: nonblocking mode, fd limit, and the listening /
+// bound sockets they all open on startup. Plain POSIX, builds on Linux, BSD and macOS.
+
+#include <cstdint>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+inline int make_non_blocking(int fd) {
+    // Adds O_NONBLOCK so read()/accept()/recvfrom() return -1 with errno = EAGAIN
+    // instead of sleeping when there is nothing there yet
+    int flags = fcntl(fd, F_GETFL, 0);
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// accept() handing back a nonblocking client fd. accept4 sets O_NONBLOCK in the same syscall
+// (Linux, FreeBSD), elsewhere it takes the two fcntl() calls of make_non_blocking
+inline int accept_nonblocking(int listen_fd, sockaddr_in* peer, socklen_t* len) {
+#if defined(__linux__) || defined(__FreeBSD__)
+    return accept4(listen_fd, (sockaddr*)peer, len, SOCK_NONBLOCK);
+#else
+    int fd = accept(listen_fd, (sockaddr*)peer, len);
+    if (fd >= 0) make_non_blocking(fd);
+    return fd;
+#endif
+}
+
+// 10k+ connections means 10k+ fds, the default soft limit is usually 1024
+inline void raise_fd_limit() {
+    rlimit rl{};
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+// Lets several sockets bind the same port and has the kernel spread the traffic over them.
+// Linux balances with plain SO_REUSEPORT. FreeBSD needs SO_REUSEPORT_LB for that, its SO_REUSEPORT
+// (and macOS's) only allows the bind and keeps sending everything to one socket, so it counts as
+// not supported there
+inline bool set_reuseport(int fd) {
+    int opt = 1;
+#if defined(SO_REUSEPORT_LB)
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT_LB, &opt, sizeof(opt)) < 0) {
+        perror("setsockopt SO_REUSEPORT_LB");
+        return false;
+    }
+    return true;
+#elif defined(__linux__)
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        perror("setsockopt SO_REUSEPORT");
+        return false;
+    }
+    return true;
+#else
+    (void)fd;
+    (void)opt;
+    fprintf(stderr, "SO_REUSEPORT does not balance load on this platform\n");
+    return false;
+#endif
+}
+
+// Nonblocking TCP listener on INADDR_ANY:port. reuseport: join a group of listeners on the same
+// port (one per event loop). -1 on failure, already reported
+inline int make_tcp_listener(uint16_t port, bool reuseport) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) { perror("socket"); return -1; }
+
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    // every loop binds the same port, without this the 2nd bind() fails with EADDRINUSE
+    if (reuseport && !set_reuseport(fd)) {
+        close(fd);
+        return -1;
+    }
+
+    sockaddr_in serv{};
+    serv.sin_family = AF_INET;
+    serv.sin_addr.s_addr = INADDR_ANY;
+    serv.sin_port = htons(port);
+
+    if (bind(fd, (sockaddr*)&serv, sizeof(serv)) < 0) {
+        perror("bind");
+        close(fd);
+        return -1;
+    }
+    if (listen(fd, SOMAXCONN) < 0) {
+        perror("listen");
+        close(fd);
+        return -1;
+    }
+    make_non_blocking(fd);
+    return fd;
+}
+
+// UDP socket bound to INADDR_ANY:port, left blocking (the loops set nonblocking mode themselves
+// if they need it)
+inline int make_udp_socket(uint16_t port, bool reuseport) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) { perror("socket"); return -1; }
+
+    if (reuseport && !set_reuseport(fd)) {
+        close(fd);
+        return -1;
+    }
+
+    sockaddr_in serv{};
+    serv.sin_family = AF_INET;
+    serv.sin_addr.s_addr = INADDR_ANY;
+    serv.sin_port = htons(port);
+
+    if (bind(fd, (sockaddr*)&serv, sizeof(serv)) < 0) {
+        perror("bind");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
@@ -0,0 +1,201 @@
+#pragma once
+// Hierarchical timing wheel for the event loops: idle / read / write deadlines per connection.
+//
+// A heap of deadlines costs O(log n) per arm and per cancel, and with 100k connections that each
+// push their idle deadline forward on every read, those are most of the heap operations.
+// A timing wheel costs O(1) for arm, cancel and re-arm: time is cut into ticks, and every timer hangs
+// in an intrusive doubly linked list in the slot of the tick it expires on.
+//
+// One wheel of 64 slots only covers 64 ticks, so there are 5 of them stacked up, each one 64x coarser:
+//     level 0: slot = 1 tick          covers the next 64 ticks
+//     level 1: slot = 64 ticks        covers the next 4096
+//     ...
+//     level 4: slot = 64^4 ticks      covers ~2^30 ticks (124 days at 10 ms)
+// A timer goes into the lowest level that reaches its expiry. Whenever level 0 comes round to slot 0,
+// the current slot of level 1 is emptied and its timers re-inserted, which drops them one level
+// (and so on upwards, the classic "cascade"). By the time a timer is due it sits in level 0,
+// in the exact slot of its tick.
+//
+// The loop's poll timeout comes from next_timeout_ms(): a bitmap per level finds the next non-empty
+// slot without walking the empty ones.
+//
+// Tip for per-connection idle timeouts: dont re-arm on every read. Store "last active" in the
+// connection (one store per read) and check it when the timer fires: still idle = close,
+// otherwise re-arm for the remainder. That way a busy connection touches the wheel once per timeout
+// period instead of once per message.
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+
+// 1 ms resolution is all the wheel needs, the coarse clock skips the vDSO's TSC read (~4 ms granularity)
+inline uint64_t monotonic_ms() {
+    timespec ts;
+#ifdef CLOCK_MONOTONIC_COARSE
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+// Embed one in whatever needs a deadline. `cookie` says who it belongs to (eg the fd)
+struct WheelTimer {
+    WheelTimer* next = nullptr;
+    WheelTimer** pprev = nullptr;   // the pointer that points at us, null = not armed
+    uint64_t expires = 0;           // in ticks
+    uint64_t cookie = 0;
+    uint8_t level = 0;              // where it hangs, so unlink can keep the occupied bitmaps exact
+    uint8_t slot = 0;
+
+    bool armed() const { return pprev != nullptr; }
+};
+
+class TimerWheel {
+public:
+    static const int LEVEL_BITS = 6;
+    static const int SLOTS = 1 << LEVEL_BITS;
+    static const int LEVELS = 5;
+
+    explicit TimerWheel(uint32_t tick_ms = 10, uint64_t now_ms = monotonic_ms())
+        : tick_ms_(tick_ms ? tick_ms : 1), origin_ms_(now_ms) {}
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    size_t size() const { return count_; }
+
+    // (Re)arms t to fire at deadline_ms (rounded up to the next tick, never in the past)
+    void arm(WheelTimer& t, uint64_t deadline_ms) {
+        if (t.armed()) unlink(t);
+        uint64_t rel = deadline_ms > origin_ms_ ? deadline_ms - origin_ms_ : 0;
+        uint64_t tick = (rel + tick_ms_ - 1) / tick_ms_;
+        t.expires = tick < now_tick_ ? now_tick_ : tick;
+        insert(t);
+    }
+
+    void cancel(WheelTimer& t) {
+        if (t.armed()) unlink(t);
+    }
+
+    // Runs on_expired(WheelTimer&) for every timer due at now_ms. The timer is already disarmed
+    // when the callback runs, the callback may arm it again (or arm/cancel any other timer)
+    template <typename F>
+    size_t expire(uint64_t now_ms, F&& on_expired) {
+        uint64_t target = now_ms > origin_ms_ ? (now_ms - origin_ms_) / tick_ms_ : 0;
+        size_t fired = 0;
+        while (now_tick_ <= target) {
+            if (count_ == 0) { now_tick_ = target + 1; break; }
+            // nothing to cascade or fire before `next`: jump straight there
+            uint64_t next = next_tick();
+            if (next > target) { now_tick_ = target + 1; break; }
+            now_tick_ = next;
+
+            uint64_t t = now_tick_;
+            int idx = (int)(t & (SLOTS - 1));
+            for (int l = 1; l < LEVELS && idx == 0; ++l) {
+                idx = (int)((t >> (l * LEVEL_BITS)) & (SLOTS - 1));
+                cascade(l, idx);
+            }
+
+            // detach the due slot first, so callbacks that re-arm cant land in the list we are walking
+            int slot = (int)(t & (SLOTS - 1));
+            WheelTimer* due = slots_[0][slot];
+            slots_[0][slot] = nullptr;
+            occupied_[0] &= ~(1ull << slot);
+            if (due) due->pprev = &due;
+            now_tick_ = t + 1;
+            while (due) {
+                WheelTimer* x = due;
+                unlink(*x);
+                ++fired;
+                on_expired(*x);
+            }
+        }
+        return fired;
+    }
+
+    // Milliseconds until the next timer could fire, for epoll_wait/kevent. -1 = no timers.
+    // May come back early (a cascade with nothing due yet), never late.
+    int next_timeout_ms(uint64_t now_ms) const {
+        if (count_ == 0) return -1;
+        uint64_t due_ms = origin_ms_ + next_tick() * tick_ms_;
+        if (due_ms <= now_ms) return 0;
+        uint64_t ms = due_ms - now_ms;
+        return ms > 0x7fffffff ? 0x7fffffff : (int)ms;
+    }
+
+private:
+    uint32_t tick_ms_;
+    uint64_t origin_ms_;
+    uint64_t now_tick_ = 0;   // every tick before this one has been processed
+    size_t count_ = 0;
+    WheelTimer* slots_[LEVELS][SLOTS] = {};
+    uint64_t occupied_[LEVELS] = {};   // bit s = slot s is not empty
+
+    void insert(WheelTimer& t) {
+        uint64_t delta = t.expires - now_tick_;
+        int level = 0;
+        while (level < LEVELS - 1 && delta >= (1ull << ((level + 1) * LEVEL_BITS))) ++level;
+        if (level == LEVELS - 1 && delta >= (1ull << (LEVELS * LEVEL_BITS))) {
+            // further out than the wheel reaches: park it at the far end. It fires early there,
+            // callers that check their own deadline on expiry (see the tip above) just arm it again
+            t.expires = now_tick_ + (1ull << (LEVELS * LEVEL_BITS)) - 1;
+        }
+        int slot = (int)((t.expires >> (level * LEVEL_BITS)) & (SLOTS - 1));
+        t.level = (uint8_t)level;
+        t.slot = (uint8_t)slot;
+        WheelTimer*& head = slots_[level][slot];
+        t.next = head;
+        if (head) head->pprev = &t.next;
+        head = &t;
+        t.pprev = &head;
+        occupied_[level] |= 1ull << slot;
+        ++count_;
+    }
+
+    void unlink(WheelTimer& t) {
+        *t.pprev = t.next;
+        if (t.next) t.next->pprev = t.pprev;
+        t.next = nullptr;
+        t.pprev = nullptr;
+        --count_;
+        if (!slots_[t.level][t.slot]) occupied_[t.level] &= ~(1ull << t.slot);
+    }
+
+    // Moves every timer of slots_[level][idx] down to where it belongs now
+    void cascade(int level, int idx) {
+        WheelTimer* list = slots_[level][idx];
+        slots_[level][idx] = nullptr;
+        occupied_[level] &= ~(1ull << idx);
+        while (list) {
+            WheelTimer* t = list;
+            list = t->next;
+            --count_;   // insert() counts it again
+            t->pprev = nullptr;
+            insert(*t);
+        }
+    }
+
+    // Earliest tick at which something has to happen: a level 0 slot firing, or a higher level slot
+    // cascading (its timers expire at or after that).
+    uint64_t next_tick() const {
+        uint64_t best = UINT64_MAX;
+        for (int l = 0; l < LEVELS; ++l) {
+            uint64_t live = occupied_[l];
+            if (!live) continue;
+
+            int shift = l * LEVEL_BITS;
+            uint64_t unit = 1ull << shift;
+            // first level-l boundary still to be processed (for level 0, every tick is one)
+            uint64_t first = (now_tick_ + unit - 1) >> shift;
+            int from = (int)(first & (SLOTS - 1));
+            // nearest occupied slot at or after `from`, wrapping round
+            uint64_t rot = (live >> from) | (from ? live << (SLOTS - from) : 0);
+            uint64_t ahead = (uint64_t)__builtin_ctzll(rot);
+            uint64_t when = (first + ahead) << shift;
+            if (when < best) best = when;
+        }
+        return best;
+    }
+};
@@ -0,0 +1,249 @@
+#pragma once
+// Tiny io_uring wrapper straight on top of the syscalls (no liburing needed).
+//
+// io_uring = two ring buffers shared between us and the kernel through mmap():
+//   - SQ (submission queue): we write requests (SQEs) in, kernel reads them
+//   - CQ (completion queue): kernel writes results (CQEs) in, we read them
+// Filling an SQE and reading a CQE are plain memory writes/reads, so the only syscall left
+// is io_uring_enter() which says "go look at my new SQEs, and sleep until N CQEs are ready".
+// One io_uring_enter can submit and reap hundreds of operations, so at high message rates
+// the cost per message is close to zero syscalls (epoll needs epoll_wait + read + write).
+//
+// Linux only, needs >= 6.0 for multishot recv + provided buffer rings.
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+
+// user_data is 64 bits we get back untouched in the CQE, we pack (op, fd, buffer id) into it
+inline uint64_t uring_pack(uint8_t op, int fd, uint16_t bid = 0) {
+    return ((uint64_t)op << 56) | ((uint64_t)(uint32_t)fd << 16) | bid;
+}
+inline uint8_t uring_op(uint64_t ud) { return (uint8_t)(ud >> 56); }
+inline int uring_fd(uint64_t ud) { return (int)(uint32_t)(ud >> 16); }
+inline uint16_t uring_bid(uint64_t ud) { return (uint16_t)ud; }
+
+struct Uring {
+    int fd = -1;
+
+    // SQ ring pointers (all point into the shared mmap)
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned sq_mask = 0;
+    unsigned sq_entries = 0;
+    io_uring_sqe* sqes = nullptr;
+    unsigned sq_local_tail = 0;   // SQEs we filled in but havent told the kernel about yet
+    unsigned to_submit = 0;
+
+    // CQ ring pointers
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    io_uring_cqe* cqes = nullptr;
+
+    void* ring_ptr = nullptr;
+    size_t ring_sz = 0;
+    size_t sqes_sz = 0;
+
+    bool init(unsigned entries) {
+        io_uring_params p{};
+        // Multishot ops produce many CQEs per SQE, so give the CQ a lot more room than the SQ
+        p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL |
+                  IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER;
+        p.cq_entries = entries * 8;
+        fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+        if (fd < 0 && errno == EINVAL) {
+            // older kernel that doesnt know one of the flags, the plain ring still works
+            p = io_uring_params{};
+            p.flags = IORING_SETUP_CQSIZE;
+            p.cq_entries = entries * 8;
+            fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+        }
+        if (fd < 0) { perror("io_uring_setup"); return false; }
+
+        if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP)) {
+            fprintf(stderr, "io_uring: kernel too old\n");
+            return false;
+        }
+
+        // SQ and CQ rings live in one mapping (FEAT_SINGLE_MMAP), the SQE array is a second one
+        size_t sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        size_t cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        ring_sz = sq_sz > cq_sz ? sq_sz : cq_sz;
+        ring_ptr = mmap(nullptr, ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        fd, IORING_OFF_SQ_RING);
+        if (ring_ptr == MAP_FAILED) { perror("mmap sq/cq ring"); return false; }
+
+        sqes_sz = p.sq_entries * sizeof(io_uring_sqe);
+        sqes = (io_uring_sqe*)mmap(nullptr, sqes_sz, PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) { perror("mmap sqes"); return false; }
+
+        char* base = (char*)ring_ptr;
+        sq_head = (unsigned*)(base + p.sq_off.head);
+        sq_tail = (unsigned*)(base + p.sq_off.tail);
+        sq_mask = *(unsigned*)(base + p.sq_off.ring_mask);
+        sq_entries = p.sq_entries;
+        // The indirection array maps ring slot -> SQE index, we just use the identity mapping
+        unsigned* array = (unsigned*)(base + p.sq_off.array);
+        for (unsigned i = 0; i < sq_entries; ++i) array[i] = i;
+        sq_local_tail = *sq_tail;
+
+        cq_head = (unsigned*)(base + p.cq_off.head);
+        cq_tail = (unsigned*)(base + p.cq_off.tail);
+        cq_mask = *(unsigned*)(base + p.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)(base + p.cq_off.cqes);
+        return true;
+    }
+
+    // Next free SQE, zeroed. If the SQ is full we flush it to the kernel first
+    io_uring_sqe* get_sqe() {
+        unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        if (sq_local_tail - head >= sq_entries) {
+            submit_and_wait(0);
+            head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+            if (sq_local_tail - head >= sq_entries) return nullptr;
+        }
+        io_uring_sqe* sqe = &sqes[sq_local_tail & sq_mask];
+        memset(sqe, 0, sizeof(*sqe));
+        ++sq_local_tail;
+        ++to_submit;
+        return sqe;
+    }
+
+    // Free SQ slots, used to keep a linked chain from being split over two submits
+    unsigned sq_space() const {
+        return sq_entries - (sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE));
+    }
+
+    // The one syscall: hand over everything we queued and (optionally) sleep for wait_nr CQEs
+    int submit_and_wait(unsigned wait_nr) {
+        // release: the kernel must see the SQE contents before it sees the new tail
+        __atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+        unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+        while (true) {
+            int ret = (int)syscall(__NR_io_uring_enter, fd, to_submit, wait_nr, flags, nullptr, 0);
+            if (ret < 0) {
+                if (errno == EINTR) continue;
+                return -errno;
+            }
+            to_submit -= (unsigned)ret < to_submit ? (unsigned)ret : to_submit;
+            return ret;
+        }
+    }
+
+    // Like submit_and_wait(1), but gives up after timeout_ms (0 = just submit, -1 = no limit).
+    // Returns -ETIME if the time ran out with no CQE. Needs IORING_FEAT_EXT_ARG (5.11)
+    int submit_and_wait_ms(int timeout_ms) {
+        if (timeout_ms < 0) return submit_and_wait(1);
+        if (timeout_ms == 0) return submit_and_wait(0);
+        __atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+        __kernel_timespec ts{};
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+        io_uring_getevents_arg arg{};
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+        while (true) {
+            int ret = (int)syscall(__NR_io_uring_enter, fd, to_submit, 1u,
+                                   IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+            if (ret < 0) {
+                if (errno == EINTR) continue;
+                return -errno;
+            }
+            to_submit -= (unsigned)ret < to_submit ? (unsigned)ret : to_submit;
+            return ret;
+        }
+    }
+
+    // Hands every ready CQE to f (at most `max` of them, the rest stay for the next call),
+    // then tells the kernel the slots can be reused
+    template <typename F>
+    unsigned for_each_cqe(F&& f, unsigned max = ~0u) {
+        unsigned head = *cq_head;
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        unsigned count = 0;
+        while (head != tail && count < max) {
+            f(&cqes[head & cq_mask]);
+            ++head;
+            ++count;
+            // f may have submitted more work, pick up anything that completed meanwhile
+            if (head == tail) tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        return count;
+    }
+
+    void destroy() {
+        if (sqes && sqes != MAP_FAILED) munmap(sqes, sqes_sz);
+        if (ring_ptr && ring_ptr != MAP_FAILED) munmap(ring_ptr, ring_sz);
+        if (fd >= 0) close(fd);
+        fd = -1;
+    }
+};
+
+// Provided buffer ring: instead of passing a buffer with every recv, we give the kernel a pool
+// of buffers up front. When data arrives the kernel picks a free buffer, fills it and tells us
+// its id in the CQE flags. We hand the buffer back (recycle) once we are done with the bytes.
+// This is what makes multishot recv possible: one SQE, unlimited receives, no buffer per SQE.
+struct BufRing {
+    io_uring_buf_ring* ring = nullptr;
+    char* base = nullptr;
+    unsigned entries = 0;      // must be a power of 2
+    unsigned buf_size = 0;
+    uint16_t bgid = 0;
+    uint16_t tail = 0;
+    size_t ring_sz = 0;
+
+    // populate = false: leave the buffers unfaulted, only the pages the kernel actually writes get
+    // memory (for big buffers that usually hold much less than their size)
+    bool init(Uring& uring, uint16_t group, unsigned n, unsigned size, bool populate = true) {
+        bgid = group;
+        entries = n;
+        buf_size = size;
+        ring_sz = entries * sizeof(io_uring_buf);
+        // The ring itself has to be page aligned, mmap gives us that
+        void* mem = mmap(nullptr, ring_sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) { perror("mmap buf ring"); return false; }
+        ring = (io_uring_buf_ring*)mem;
+
+        base = (char*)mmap(nullptr, (size_t)entries * buf_size, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | (populate ? MAP_POPULATE : 0), -1, 0);
+        if (base == MAP_FAILED) { perror("mmap buffers"); return false; }
+
+        io_uring_buf_reg reg{};
+        reg.ring_addr = (uint64_t)(uintptr_t)ring;
+        reg.ring_entries = entries;
+        reg.bgid = bgid;
+        if (syscall(__NR_io_uring_register, uring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+            perror("IORING_REGISTER_PBUF_RING");
+            return false;
+        }
+
+        tail = 0;
+        for (unsigned i = 0; i < entries; ++i) add((uint16_t)i);
+        publish();
+        return true;
+    }
+
+    char* buf(uint16_t bid) { return base + (size_t)bid * buf_size; }
+
+    // Queue a buffer for the kernel, it only becomes visible after publish()
+    void add(uint16_t bid) {
+        // Index by hand instead of ring->bufs[]: in C++ the kernel header's flex array macro
+        // wraps bufs in a struct with an empty member, which shifts it 8 bytes from where the kernel looks
+        io_uring_buf* b = (io_uring_buf*)ring + (tail & (entries - 1));
+        b->addr = (uint64_t)(uintptr_t)buf(bid);
+        b->len = buf_size;
+        b->bid = bid;
+        ++tail;
+    }
+
+    void publish() { __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE); }
+
+    void recycle(uint16_t bid) { add(bid); publish(); }
+};
@@ -0,0 +1,1141 @@
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <linux/errqueue.h>
+
+#include "../../common/uring.h"
+#include "../../common/sockets.h"
+#include "../../common/out_buffer.h"
+#include "../../common/conn_table.h"
+#include "../../common/metrics.h"
+#include "../../common/framing.h"
+#include "../../common/low_latency.h"
+#include "../../common/timer_wheel.h"
+#include "../../common/pipeline.h"
+#include "../../common/shm_ring.h"
+#include "../../common/capture.h"
+#include "../../common/kernel_ts.h"
+
+// Thread-per-core TCP echo server (Linux only).
+//
+// One event loop on one thread can never use more than one core.
+// Here every worker thread owns EVERYTHING it touches:
+//   - its own listening socket (SO_REUSEPORT lets N sockets bind the same ip:port)
+//   - its own epoll instance
+//   - its own read buffer
+// and it is pinned to one CPU. Nothing is shared, so there are no locks and no cache lines
+// bouncing between cores, which is what lets throughput scale with the number of cores.
+//
+// With SO_REUSEPORT the kernel hashes each incoming connection (src ip/port, dst ip/port)
+// and drops it into the accept queue of exactly one of the listening sockets,
+// so the load balancing between workers is done for free by the kernel.
+//
+// With --uring each worker drives an io_uring instead of epoll (see uring_worker below).
+
+static const int PORT = 8080;
+static const int MAX_EVENTS = 256;
+
+// io_uring mode sizing, per worker: 4096 x 4 KB provided buffers = 16 MB
+static const unsigned URING_ENTRIES = 4096;
+static const unsigned URING_BUFS = 4096;
+static const unsigned URING_BUF_SIZE = 4096;
+
+void pin_to_cpu(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    // Only fails if the cpu doesnt exist / isnt allowed (eg taskset), the loop still works unpinned
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rc != 0) {
+        std::cerr << "pthread_setaffinity_np(cpu " << cpu << "): " << strerror(rc) << "\n";
+    }
+}
+
+// Backpressure, same scheme as tcp_reactor_server: stop reading a client once this much of its echo
+// is stuck in our buffers, resume when it drains below LOW_WATER
+static const size_t HIGH_WATER = 256 * 1024;
+static const size_t LOW_WATER = 64 * 1024;
+
+// ---------------------------------------------------------------------------------------
+// Echo paths (--echo copy|splice|zerocopy|auto)
+//
+// copy      read() into the worker's buffer, write() it back. Two copies (kernel -> us -> kernel)
+//           and two syscalls per read, which is fine for small messages.
+// splice    socket -> pipe -> same socket with splice(). The bytes never enter user space,
+//           the pipe just passes page references around. The pipe is also the connection's
+//           output buffer: reading stops while it is full.
+// zerocopy  read() into a pool buffer, send() it with MSG_ZEROCOPY. The kernel sends straight from
+//           our pages instead of copying them, so the buffer stays pinned until the kernel says
+//           it is done (a notification on the socket's error queue, which epoll reports as EPOLLERR).
+//           For when the server has to look at the bytes, which splice never shows us.
+// auto      copy, until a connection's average read gets big (BULK_ON), then splice
+//           (zerocopy with --inspect). Back to copy once the average drops under BULK_OFF.
+//
+// A connection only switches path while it has nothing queued on its current one,
+// otherwise bytes from the new path could overtake older ones still waiting on the old.
+// ---------------------------------------------------------------------------------------
+
+enum EchoMode : uint8_t { ECHO_COPY, ECHO_SPLICE, ECHO_ZEROCOPY, ECHO_AUTO };
+static EchoMode echo_mode = ECHO_COPY;
+static bool inspect = false;                    // auto: big messages go zerocopy, not splice
+static bool framed = false;                     // --framed: echo whole frames (common/framing.h), copy path only
+static PipelineFn transform = nullptr;          // --transform: stages run on every message (common/pipeline.h), copy path only
+
+static const uint32_t BULK_ON = 8 * 1024;       // average read size that switches auto to bulk
+static const uint32_t BULK_OFF = 2 * 1024;      // ...and back to copy
+static const int PIPE_SIZE = 256 * 1024;        // asked for, the kernel may round or refuse
+static const size_t ZC_READ_SIZE = 60 * 1024;   // fits the pool's biggest class
+
+// One send the kernel still holds our pages for
+struct ZcSent {
+    BufChunk* buf;
+    uint32_t id;   // MSG_ZEROCOPY sends are numbered 0, 1, 2... per socket
+};
+
+// Only connections that ever left the copy path get one of these
+struct BulkPath {
+    int pipe_r = -1, pipe_w = -1;
+    size_t pipe_bytes = 0;             // spliced in, not spliced out yet
+    size_t pipe_cap = 0;
+    bool pipe_full = false;            // splice in hit EAGAIN with bytes still in the pipe
+    std::deque<BufChunk*> zc_unsent;   // read but not (fully) sent, oldest first
+    size_t zc_unsent_bytes = 0;
+    std::deque<ZcSent> zc_inflight;    // fully sent, waiting for the completion notification
+    uint32_t zc_next_id = 0;
+    uint32_t zc_done = 0;              // every id below this has completed
+    bool zc_enabled = false;           // SO_ZEROCOPY is set on the socket
+    bool zc_copied = false;            // the kernel copied anyway (always the case over loopback)
+};
+
+// ---------------------------------------------------------------------------------------
+// Deadlines (--idle-timeout / --read-timeout / --write-timeout, seconds, 0 = off)
+//
+// Every connection has one WheelTimer (common/timer_wheel.h) armed for its EARLIEST deadline.
+// Traffic only stores timestamps in the Conn; the wheel is touched when a deadline moves earlier
+// than the armed one, or when the timer fires and finds the connection was active after all
+// (then it is re-armed for the new deadline). So a busy connection costs a couple of stores
+// per event and one wheel operation per timeout period, however many messages it sends.
+// ---------------------------------------------------------------------------------------
+
+static uint64_t idle_timeout_ms = 0;    // no events at all on the connection
+static uint64_t read_timeout_ms = 0;    // --framed: a frame started arriving and isnt complete yet
+static uint64_t write_timeout_ms = 0;   // echo bytes are queued and the client takes none of them
+
+// Everything we keep per client, 160 bytes while idle. Buffers are only borrowed from the
+// worker's BufferPool while echoed bytes are actually waiting; reads go through the one
+// per-worker read buffer, so no connection owns a read buffer either.
+struct Conn {
+    OutputQueue out;              // echoed bytes the socket hasnt taken yet (copy path)
+    FrameDecoder framer;          // --framed: the frame cut off by the end of the last read
+    BulkPath* bulk = nullptr;     // splice/zerocopy state, created on first use
+    uint32_t events = 0;          // what this fd is currently registered for in epoll
+    uint32_t avg_read = 0;        // moving average of bytes per read, drives --echo auto
+    EchoMode mode = ECHO_COPY;
+    bool peer_closed = false;     // got EOF, close once out is flushed
+    ReadSizer reads;              // how much the next read asks for (2 bytes, fits the padding here)
+
+    WheelTimer timer;             // armed for the earliest deadline, cookie = fd
+    uint64_t timer_at = 0;        // ms it is armed for
+    uint64_t last_active = 0;     // ms of the last event on this fd
+    uint64_t out_since = 0;       // ms since output has been queued without the queue shrinking, 0 = none queued
+    uint64_t frame_since = 0;     // ms the current partial frame started, 0 = none
+    size_t last_queued = 0;
+
+    uint32_t peer_ip = 0;         // only filled in with --capture
+    uint16_t peer_port = 0;
+};
+// idle connections are what a server holds most of, keep an eye on what one costs
+static_assert(sizeof(Conn) <= 160, "Conn grew, check the per-connection memory numbers");
+
+size_t queued_bytes(const Conn& c) {
+    return c.out.size() + (c.bulk ? c.bulk->pipe_bytes + c.bulk->zc_unsent_bytes : 0);
+}
+
+// Earliest deadline of c in ms, 0 = it has none right now
+uint64_t next_deadline(const Conn& c) {
+    uint64_t d = UINT64_MAX;
+    if (idle_timeout_ms) d = std::min(d, c.last_active + idle_timeout_ms);
+    if (read_timeout_ms && c.frame_since) d = std::min(d, c.frame_since + read_timeout_ms);
+    if (write_timeout_ms && c.out_since) d = std::min(d, c.out_since + write_timeout_ms);
+    return d == UINT64_MAX ? 0 : d;
+}
+
+// After every round of events on c: refresh the timestamps, and pull the timer in if a deadline
+// got earlier than the one it is armed for. Pushing a deadline OUT never touches the wheel
+void touch_deadlines(Conn& c, uint64_t now, TimerWheel& timers) {
+    c.last_active = now;
+    size_t q = queued_bytes(c);
+    if (q == 0) c.out_since = 0;
+    else if (c.out_since == 0 || q < c.last_queued) c.out_since = now;   // queued, or progress
+    c.last_queued = q;
+    if (c.framer.partial.empty()) c.frame_since = 0;
+    else if (c.frame_since == 0) c.frame_since = now;
+
+    uint64_t d = next_deadline(c);
+    if (d && (!c.timer.armed() || d < c.timer_at)) {
+        c.timer_at = d;
+        timers.arm(c.timer, d);
+    }
+}
+
+// Sets up what `mode` needs on this connection, falls back to copy if the kernel says no
+void enter_mode(int fd, Conn& c, EchoMode mode) {
+    c.mode = ECHO_COPY;
+    if (mode == ECHO_COPY) return;
+    if (!c.bulk) c.bulk = new BulkPath;
+    BulkPath& b = *c.bulk;
+    if (mode == ECHO_SPLICE && b.pipe_r < 0) {
+        int p[2];
+        if (pipe2(p, O_NONBLOCK | O_CLOEXEC) < 0) { perror("pipe2"); return; }
+        b.pipe_r = p[0];
+        b.pipe_w = p[1];
+        // a bigger pipe means fewer splice calls per MB, default is only 64 KB
+        fcntl(b.pipe_w, F_SETPIPE_SZ, PIPE_SIZE);
+        int cap = fcntl(b.pipe_w, F_GETPIPE_SZ);
+        b.pipe_cap = cap > 0 ? (size_t)cap : 65536;
+    }
+    if (mode == ECHO_ZEROCOPY && !b.zc_enabled) {
+        int one = 1;
+        if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0) { perror("SO_ZEROCOPY"); return; }
+        b.zc_enabled = true;
+    }
+    c.mode = mode;
+}
+
+void pick_mode(int fd, Conn& c) {
+    if (echo_mode != ECHO_AUTO || queued_bytes(c) > 0) return;
+    if (c.mode == ECHO_COPY && c.avg_read >= BULK_ON) {
+        // zerocopy that the kernel turns into a copy anyway is just copy with extra bookkeeping
+        bool zc_useless = c.bulk && c.bulk->zc_copied;
+        if (!inspect) enter_mode(fd, c, ECHO_SPLICE);
+        else if (!zc_useless) enter_mode(fd, c, ECHO_ZEROCOPY);
+    } else if (c.mode != ECHO_COPY && c.avg_read < BULK_OFF) {
+        c.mode = ECHO_COPY;
+    }
+}
+
+void free_bulk(Conn& c, BufferPool& pool) {
+    if (!c.bulk) return;
+    BulkPath& b = *c.bulk;
+    if (b.pipe_r >= 0) { close(b.pipe_r); close(b.pipe_w); }
+    for (BufChunk* ch : b.zc_unsent) pool.put(ch);
+    // Only reached with sends in flight when the connection broke, so nothing will be
+    // transmitted from these pages again and they can be reused
+    for (ZcSent& z : b.zc_inflight) pool.put(z.buf);
+    delete c.bulk;
+    c.bulk = nullptr;
+}
+
+void close_client(int epfd, int fd, ConnTable<Conn>& conns, BufferPool& pool, TimerWheel& timers, LoopStats& st, KernelTs* kts) {
+    st.closed();
+    st.syscall(2);   // the epoll_ctl + close below
+    Conn* c = conns.get(fd);
+    timers.cancel(c->timer);
+    if (g_capture.on && !capture_record(CAP_TCP_CLOSE, c->peer_ip, c->peer_port, nullptr, 0))
+        st.capture_drop();
+    c->out.release(pool);
+    free_bulk(*c, pool);
+    if (kts) kts->forget(fd);
+    conns.close(fd);
+    // close() removes the fd from the epoll set by itself (as long as nobody dup()ed it)
+    // but being explicit keeps it obvious
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+}
+
+// The splice pipe has no room for another read: the next splice would ask for 0 bytes, and a 0 from
+// splice reads like the client closing
+bool pipe_stalled(const Conn& c) {
+    return c.bulk && c.mode == ECHO_SPLICE && (c.bulk->pipe_full || c.bulk->pipe_bytes >= c.bulk->pipe_cap);
+}
+
+// EPOLLOUT only while bytes are waiting (level triggered EPOLLOUT on an idle socket would wake
+// us up on every epoll_wait), EPOLLIN only while the backlog is under the water mark.
+// EPOLLRDHUP goes with EPOLLIN: a hangup is only news once we read again, and left on while
+// reading is paused it would report the same hangup on every epoll_wait
+void update_interest(int epfd, int fd, Conn& c, LoopStats& st) {
+    bool reading = c.events & EPOLLIN;
+    size_t queued = queued_bytes(c);
+    bool want_read = !c.peer_closed && queued < (reading ? HIGH_WATER : LOW_WATER);
+    // the pipe is a fixed size buffer of its own, stop reading while it is full
+    if (pipe_stalled(c)) want_read = false;
+    // (with --edge the MOD re-arms the edge: turning EPOLLIN back on reports data that is already waiting)
+    uint32_t want = lowlat_events((want_read ? (uint32_t)(EPOLLIN | EPOLLRDHUP) : 0u) | (queued == 0 ? 0u : (uint32_t)EPOLLOUT));
+    if (want == c.events) return;
+    c.events = want;
+    epoll_event ev{};
+    ev.events = want;
+    ev.data.fd = fd;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+    st.syscall();
+}
+
+// writev() as much of the backlog as the socket takes. false = connection is broken.
+// stamp: the first writev asks for a TX timestamp (--timestamps)
+bool flush_output(int fd, Conn& c, BufferPool& pool, LoopStats& st, bool stamp = false) {
+    iovec iov[16];
+    while (!c.out.empty()) {
+        int cnt = c.out.fill_iovec(iov, 16);
+        size_t want = 0;
+        for (int i = 0; i < cnt; ++i) want += iov[i].iov_len;
+        ssize_t n = stamp ? kts_sendv(fd, iov, cnt) : writev(fd, iov, cnt);
+        stamp = false;
+        st.syscall();
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) return false;
+            st.would_block();
+            return true;
+        }
+        st.out((size_t)n);
+        if ((size_t)n < want) st.short_write();
+        c.out.consume(pool, (size_t)n);
+    }
+    return true;
+}
+
+// pipe -> socket
+bool flush_pipe(int fd, BulkPath& b, LoopStats& st) {
+    while (b.pipe_bytes > 0) {
+        ssize_t n = splice(b.pipe_r, nullptr, fd, nullptr, b.pipe_bytes, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        st.syscall();
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) return false;
+            st.would_block();
+            return true;
+        }
+        if (n == 0) return false;
+        st.out((size_t)n);
+        if ((size_t)n < b.pipe_bytes) st.short_write();
+        b.pipe_bytes -= (size_t)n;
+        b.pipe_full = false;
+    }
+    return true;
+}
+
+// Sends the read-but-unsent pool buffers with MSG_ZEROCOPY
+bool flush_zerocopy(int fd, BulkPath& b, BufferPool& pool, LoopStats& st) {
+    while (!b.zc_unsent.empty()) {
+        BufChunk* ch = b.zc_unsent.front();
+        int flags = MSG_NOSIGNAL | MSG_ZEROCOPY;
+        ssize_t n = send(fd, ch->data() + ch->start, ch->used(), flags);
+        st.syscall();
+        if (n < 0 && errno == ENOBUFS) {
+            // too many notifications outstanding (optmem limit), send this one the normal way
+            flags = MSG_NOSIGNAL;
+            n = send(fd, ch->data() + ch->start, ch->used(), flags);
+            st.syscall();
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) return false;
+            st.would_block();
+            return true;
+        }
+        // every successful MSG_ZEROCOPY send takes the next id, even a partial one
+        if (flags & MSG_ZEROCOPY) ++b.zc_next_id;
+        st.out((size_t)n);
+        b.zc_unsent_bytes -= (size_t)n;
+        ch->start += (uint32_t)n;
+        if (ch->used() > 0) {
+            st.short_write();
+            continue;
+        }
+        b.zc_unsent.pop_front();
+        // The buffer waits for the notification of the last zerocopy send so far (earlier ids
+        // for the same buffer complete before it). If that one is done already, or there never
+        // was one, the bytes were only ever copied and the buffer is free right away
+        uint32_t last = b.zc_next_id - 1;
+        if (b.zc_next_id == 0 || (int32_t)(last - b.zc_done) < 0) pool.put(ch);
+        else b.zc_inflight.push_back({ch, last});
+    }
+    return true;
+}
+
+// Everything queued for the socket, oldest path first
+bool flush_all(int fd, Conn& c, BufferPool& pool, LoopStats& st) {
+    if (!flush_output(fd, c, pool, st)) return false;
+    if (!c.out.empty() || !c.bulk) return true;
+    return flush_pipe(fd, *c.bulk, st) && flush_zerocopy(fd, *c.bulk, pool, st);
+}
+
+// Reads the socket's error queue: MSG_ZEROCOPY completions (the finished buffers go back to the pool)
+// and --timestamps TX stamps. false = the error queue held a real error
+bool reap_errqueue(int fd, Conn& c, BufferPool& pool, LoopStats& st, KernelTs* kts) {
+    alignas(cmsghdr) char control[256];
+    while (true) {
+        msghdr msg{};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t r = recvmsg(fd, &msg, MSG_ERRQUEUE);
+        st.syscall();
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        uint64_t tx_ns;
+        if (kts && kts_tx_stamp(msg, tx_ns)) {
+            kts->tx_done(fd, tx_ns);
+            continue;
+        }
+        if (!c.bulk) return false;
+        BulkPath& b = *c.bulk;
+        for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                  (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) continue;
+            sock_extended_err se;
+            memcpy(&se, CMSG_DATA(cm), sizeof(se));
+            if (se.ee_origin != SO_EE_ORIGIN_ZEROCOPY || se.ee_errno != 0) return false;
+            if (se.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) b.zc_copied = true;
+            // sends [ee_info, ee_data] are done. TCP completes them in order, so release from
+            // the front up to ee_data (compared with wraparound, the ids are 32 bit)
+            uint32_t hi = se.ee_data;
+            if ((int32_t)(hi + 1 - b.zc_done) > 0) b.zc_done = hi + 1;
+            while (!b.zc_inflight.empty() && (int32_t)(hi - b.zc_inflight.front().id) >= 0) {
+                pool.put(b.zc_inflight.front().buf);
+                b.zc_inflight.pop_front();
+            }
+        }
+    }
+}
+
+// One read on a client. false = close it. `more` = the socket may still hold data (the read filled
+// everything it asked for), only the --edge loop needs to know
+//
+// --timestamps samples reads on the copy path (plain and framed): a sampled read goes through recvmsg
+// for its RX stamp, and its echo asks for a TX stamp. splice and zerocopy are left alone
+bool on_readable(int fd, Conn& c, char* buf, size_t buf_size, BufferPool& pool, LoopStats& st, KernelTs* kts, bool& more) {
+    more = false;
+    ssize_t r;
+    if (c.mode == ECHO_SPLICE) {
+        BulkPath& b = *c.bulk;
+        if (b.pipe_bytes >= b.pipe_cap) return true;   // no room, leave the bytes in the socket
+        r = splice(fd, nullptr, b.pipe_w, nullptr, b.pipe_cap - b.pipe_bytes, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        st.syscall();
+        if (r > 0) {
+            // the pipe counts pages, not bytes, a short splice doesnt prove the socket is empty
+            more = true;
+            b.pipe_bytes += (size_t)r;
+            st.in((size_t)r);
+            if (c.out.empty() && !flush_pipe(fd, b, st)) return false;
+        } else if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // with bytes in the pipe this means the PIPE is out of room (it counts pages, not
+            // bytes, so it can fill before pipe_cap), the socket still has data for us
+            if (b.pipe_bytes > 0) b.pipe_full = true;
+            return true;
+        }
+    } else if (c.mode == ECHO_ZEROCOPY) {
+        BulkPath& b = *c.bulk;
+        BufChunk* ch = pool.get(ZC_READ_SIZE);
+        r = read(fd, ch->data(), ch->cap);
+        st.syscall();
+        if (r > 0) {
+            if (g_capture.on && !capture_record(CAP_TCP_DATA, c.peer_ip, c.peer_port, ch->data(), (size_t)r))
+                st.capture_drop();
+            more = (size_t)r == ch->cap;
+            ch->end = (uint32_t)r;
+            b.zc_unsent.push_back(ch);
+            b.zc_unsent_bytes += (size_t)r;
+            st.in((size_t)r);
+            if (c.out.empty() && b.pipe_bytes == 0 && !flush_zerocopy(fd, b, pool, st)) return false;
+        } else {
+            pool.put(ch);
+        }
+    } else if (framed) {
+        size_t want = std::min(c.reads.size(), buf_size);
+        bool sampled = kts && kts->sample();
+        uint64_t rx_ns = 0, read_ns = 0;
+        r = sampled ? kts_recv(fd, buf, want, rx_ns) : read(fd, buf, want);
+        st.syscall();
+        if (r > 0) {
+            if (sampled) {
+                read_ns = kts_now_ns();
+                kts->received(rx_ns, read_ns);
+            }
+            if (g_capture.on && !capture_record(CAP_TCP_DATA, c.peer_ip, c.peer_port, buf, (size_t)r))
+                st.capture_drop();
+            more = (size_t)r == want;
+            // Every complete request frame gets its response frame queued, then the whole batch
+            // goes out in ONE writev. With 16 pipelined requests in a read that is 1 write instead of 16.
+            // Each connection gets one read per epoll_wait, so this is one writev per loop iteration
+            uint64_t frames = 0;
+            bool rejected = false;
+            bool ok = c.framer.feed(buf, (size_t)r, [&](const char* payload, size_t len) {
+                if (rejected) return;
+                // the payload sits in buf or in the decoder's carry-over, both ours to rewrite
+                Msg m(const_cast<char*>(payload), len);
+                if (transform && !transform(m)) { rejected = true; return; }
+                char hdr[FRAME_HEADER];
+                frame_header((uint32_t)(len + m.trailer_len), hdr);
+                c.out.append(pool, hdr, FRAME_HEADER);
+                c.out.append(pool, payload, len);
+                if (m.trailer_len) c.out.append(pool, m.trailer, m.trailer_len);
+                ++frames;
+            });
+            if (!ok || rejected) return false;   // not our protocol (or a stage refused it), drop the connection
+            // a message is a frame here, counted in full (header included) on the way in
+            if (frames > 0) bump(st.msgs_in, frames);
+            bump(st.bytes_in, (uint64_t)r);
+            if (sampled && !c.out.empty()) {
+                // a read that only completed part of a frame has no echo to time
+                size_t before = c.out.size();
+                uint64_t send_ns = kts_now_ns();
+                bool stamp = kts->want_tx(send_ns);
+                if (!flush_output(fd, c, pool, st, stamp)) return false;
+                if (c.out.size() < before) kts->sent(fd, read_ns, send_ns, stamp);
+            } else if (!flush_output(fd, c, pool, st)) {
+                return false;
+            }
+        }
+    } else {
+        size_t want = std::min(c.reads.size(), buf_size);
+        bool sampled = kts && kts->sample();
+        uint64_t rx_ns = 0, read_ns = 0;
+        r = sampled ? kts_recv(fd, buf, want, rx_ns) : read(fd, buf, want);
+        st.syscall();
+        if (r > 0) {
+            if (sampled) {
+                read_ns = kts_now_ns();
+                kts->received(rx_ns, read_ns);
+            }
+            // a stream socket only returns less than asked for when its receive queue ran dry,
+            // and anything arriving after that raises a new edge, so no EAGAIN read is needed
+            more = (size_t)r == want;
+            st.in((size_t)r);
+            if (g_capture.on && !capture_record(CAP_TCP_DATA, c.peer_ip, c.peer_port, buf, (size_t)r))
+                st.capture_drop();
+            if (transform) {
+                // no frames: the stages see each read as it comes (only the byte-wise ones are allowed here)
+                Msg m(buf, (size_t)r);
+                if (!transform(m)) return false;
+            }
+            // Echo back. Nothing queued: write straight from buf and keep only what the socket
+            // refused. Something queued: append behind it so the stream stays in order
+            ssize_t w = 0;
+            if (queued_bytes(c) == 0) {
+                uint64_t send_ns = sampled ? kts_now_ns() : 0;
+                bool stamp = sampled && kts->want_tx(send_ns);
+                if (stamp) {
+                    iovec iov{buf, (size_t)r};
+                    w = kts_sendv(fd, &iov, 1);
+                } else {
+                    w = write(fd, buf, r);
+                }
+                st.syscall();
+                if (sampled && w > 0) kts->sent(fd, read_ns, send_ns, stamp);
+                if (w < 0) {
+                    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) return false;
+                    if (errno != EINTR) st.would_block();
+                    w = 0;
+                } else {
+                    st.out((size_t)w);
+                    if (w < r) st.short_write();
+                }
+            }
+            if (w < r) c.out.append(pool, buf + w, r - w);
+        }
+    }
+
+    if (r > 0) {
+        c.avg_read = (c.avg_read * 7 + (uint32_t)r) / 8;
+        c.reads.update((size_t)r);
+        pick_mode(fd, c);
+    } else if (r == 0) {
+        // client is done sending, but may still be waiting for the rest of its echo
+        c.peer_closed = true;
+    } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        return false;
+    } else if (errno != EINTR) {
+        st.would_block();
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------------------
+// Shared memory clients (--shm PATH, see common/shm_ring.h)
+//
+// Same-host clients can skip TCP: they connect to the Unix socket at PATH and get a pair of rings
+// in a memfd. The first worker serves them next to its TCP clients. Each session puts two fds into
+// the epoll set, its eventfd (the client pushed data or made room while we slept) and the Unix socket
+// (the client went away). The echo itself is a copy from one ring straight into the other.
+// ---------------------------------------------------------------------------------------
+
+static const char* shm_path = nullptr;
+
+// Echoes everything the client has pushed, as far as the reply ring has room.
+// false = the client corrupted the rings, drop it
+bool shm_echo(ShmEndpoint& ep, LoopStats& st) {
+    while (true) {
+        if (!ep.rx.sane() || !ep.tx.sane()) return false;
+        size_t n = ep.rx.move_to(ep.tx);
+        if (n > 0) {
+            st.in(n);
+            st.out(n);
+            ep.tx.wake_consumer();
+            ep.rx.wake_producer();
+        }
+        // out of input: sleep until the client pushes more. Reply ring full: sleep until it reads.
+        // Either way, if the condition went away while we were announcing it, go round again
+        if (ep.rx.readable() == 0) {
+            if (ep.rx.consumer_sleep()) return true;
+        } else if (ep.tx.producer_sleep()) {
+            return true;
+        }
+    }
+}
+
+void worker(int cpu, int listen_fd, int shm_fd) {
+    pin_to_cpu(cpu);
+
+    int epfd = epoll_create1(0);
+    if (epfd < 0) { perror("epoll_create1"); return; }
+    lowlat_epoll(epfd);
+
+    epoll_event ev{};
+    ev.events = lowlat_events(EPOLLIN);
+    ev.data.fd = listen_fd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev);
+    if (shm_fd >= 0) {
+        ev.events = EPOLLIN;
+        ev.data.fd = shm_fd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, shm_fd, &ev);
+    }
+    // shm sessions, by their eventfd and by their Unix socket
+    std::unordered_map<int, ShmEndpoint*> shm_peers;
+
+    std::vector<epoll_event> events(MAX_EVENTS);
+    // Sized for the biggest read a connection can grow to. A read only copies what is queued, so small
+    // messages never touch more than the start of it
+    char buf[64 * 1024];
+    ConnTable<Conn> conns;     // fd -> slab allocated Conn
+    BufferPool pool;           // output buffers for every client of this worker
+    LoopStats& st = metrics_register_loop();
+    std::unique_ptr<KernelTs> kts = kts_create(st);
+    TimerWheel timers(10);     // 10 ms ticks, deadlines are in seconds anyway
+    bool timed = idle_timeout_ms || read_timeout_ms || write_timeout_ms;
+    uint64_t now = timed ? monotonic_ms() : 0;
+
+    while (true) {
+        // sleep no longer than the next deadline (-1 = forever while no timer is armed)
+        int timeout = timed ? timers.next_timeout_ms(now) : -1;
+        int n = lowlat_wait(epfd, events.data(), MAX_EVENTS, timeout, st);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        if (timed) {
+            now = monotonic_ms();
+            timers.expire(now, [&](WheelTimer& t) {
+                int fd = (int)t.cookie;
+                Conn* c = conns.get(fd);
+                if (!c) return;
+                uint64_t d = next_deadline(*c);
+                if (d && d <= now) {
+                    st.timed_out();
+                    close_client(epfd, fd, conns, pool, timers, st, kts.get());
+                } else if (d) {
+                    // it was active since the timer was armed, wait for the rest
+                    c->timer_at = d;
+                    timers.arm(t, d);
+                }
+            });
+        }
+
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+
+            if (fd == listen_fd) {
+                // Drain the whole accept queue in one wakeup,
+                // under a connection storm one accept per epoll_wait wld be way too slow
+                while (true) {
+                    // accept4 sets O_NONBLOCK atomically, saves the 2 fcntl() calls per client.
+                    // The peer address is only wanted for --capture records
+                    sockaddr_in cli{};
+                    socklen_t cli_len = sizeof(cli);
+                    int client_fd = g_capture.on ? accept4(listen_fd, (sockaddr*)&cli, &cli_len, SOCK_NONBLOCK)
+                                                 : accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK);
+                    st.syscall();
+                    if (client_fd < 0) {
+                        if (errno == EINTR) continue;
+                        // (another worker's listener, or a client that gave up, can leave us with nothing)
+                        if (errno == EAGAIN || errno == EWOULDBLOCK) st.would_block();
+                        // EAGAIN = queue is empty, anything else (EMFILE etc) we retry on the next wakeup
+                        if (errno != EAGAIN && errno != EWOULDBLOCK) perror("accept4");
+                        break;
+                    }
+                    // An echo's last partial segment must not wait in Nagle's buffer for the ACK of
+                    // the previous one: the client delays that ACK (~40ms) until it gets more data,
+                    // which for a request/response client is exactly the echo we are holding back
+                    int one = 1;
+                    setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                    lowlat_socket(client_fd);
+                    if (kts) {
+                        kts_enable(client_fd);
+                        st.syscall();
+                    }
+                    epoll_event cev{};
+                    cev.events = lowlat_events(EPOLLIN | EPOLLRDHUP);
+                    cev.data.fd = client_fd;
+                    st.syscall(2);
+                    if (epoll_ctl(epfd, EPOLL_CTL_ADD, client_fd, &cev) < 0) {
+                        perror("epoll_ctl");
+                        close(client_fd);
+                        continue;
+                    }
+                    Conn* c = conns.open(client_fd);
+                    c->events = cev.events;
+                    c->peer_ip = cli.sin_addr.s_addr;
+                    c->peer_port = cli.sin_port;
+                    if (echo_mode == ECHO_SPLICE || echo_mode == ECHO_ZEROCOPY) enter_mode(client_fd, *c, echo_mode);
+                    st.accepted();
+                    if (timed) {
+                        c->timer.cookie = (uint64_t)client_fd;
+                        touch_deadlines(*c, now, timers);
+                    }
+                }
+                continue;
+            }
+
+            if (fd == shm_fd) {
+                while (true) {
+                    ShmEndpoint* ep = new ShmEndpoint;
+                    int rc = shm_accept(shm_fd, *ep);
+                    st.syscall(8);   // accept, memfd, 2 eventfds, ftruncate, seals, mmap, sendmsg
+                    if (rc <= 0) {
+                        delete ep;
+                        // a failed handshake only lost that client, the next one may be fine.
+                        // A failed accept leaves it queued, so like the TCP listener, wait for the next wakeup
+                        if (rc == -1) continue;
+                        break;
+                    }
+                    epoll_event sev{};
+                    sev.events = EPOLLIN;
+                    sev.data.fd = ep->efd;
+                    epoll_ctl(epfd, EPOLL_CTL_ADD, ep->efd, &sev);
+                    sev.events = EPOLLIN | EPOLLRDHUP;
+                    sev.data.fd = ep->ctl_fd;
+                    epoll_ctl(epfd, EPOLL_CTL_ADD, ep->ctl_fd, &sev);
+                    st.syscall(2);
+                    shm_peers[ep->efd] = ep;
+                    shm_peers[ep->ctl_fd] = ep;
+                    st.accepted();
+                    // nothing can be in the rings yet, just announce that we sleep
+                    shm_echo(*ep, st);
+                }
+                continue;
+            }
+
+            // stale event for a client closed earlier in this same batch
+            Conn* cp = conns.get(fd);
+            if (!cp) {
+                if (shm_peers.empty()) continue;
+                auto it = shm_peers.find(fd);
+                if (it == shm_peers.end()) continue;
+                ShmEndpoint* ep = it->second;
+                bool ok = fd == ep->efd;   // anything on the Unix socket means the client is gone
+                if (ok) {
+                    shm_drain(ep->efd);
+                    st.syscall();
+                    ok = shm_echo(*ep, st);
+                }
+                if (!ok) {
+                    // closing the fds takes them out of the epoll set too
+                    shm_peers.erase(ep->efd);
+                    shm_peers.erase(ep->ctl_fd);
+                    shm_close(*ep);
+                    delete ep;
+                    st.closed();
+                    st.syscall(4);
+                }
+                continue;
+            }
+            Conn& c = *cp;
+
+            // With MSG_ZEROCOPY or --timestamps, EPOLLERR mostly just means "completions / TX stamps are
+            // waiting on the error queue"
+            bool zc = c.bulk && c.bulk->zc_enabled;
+            if ((events[i].events & EPOLLERR) && (zc || kts) && !(events[i].events & EPOLLHUP)) {
+                if (!reap_errqueue(fd, c, pool, st, kts.get())) {
+                    close_client(epfd, fd, conns, pool, timers, st, kts.get());
+                    continue;
+                }
+            } else if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                close_client(epfd, fd, conns, pool, timers, st, kts.get());
+                continue;
+            }
+
+            if (events[i].events & EPOLLOUT) {
+                if (!flush_all(fd, c, pool, st)) {
+                    close_client(epfd, fd, conns, pool, timers, st, kts.get());
+                    continue;
+                }
+            }
+
+            // only while reading: a hangup reported while EPOLLIN was paused waits until it is back on
+            if ((events[i].events & (EPOLLIN | EPOLLRDHUP)) && (c.events & EPOLLIN)) {
+                // Level triggered, so one read per event is enough, whatever is left
+                // gets reported again on the next epoll_wait.
+                // Edge triggered (--edge) nothing gets reported again, so read until the socket is
+                // empty, or until backpressure says stop (update_interest then drops EPOLLIN, and
+                // the MOD that turns it back on reports the leftover data)
+                bool more, ok;
+                do {
+                    ok = on_readable(fd, c, buf, sizeof(buf), pool, st, kts.get(), more);
+                } while (ok && more && g_lowlat.edge && !c.peer_closed && queued_bytes(c) < HIGH_WATER &&
+                         !pipe_stalled(c));
+                if (!ok) {
+                    close_client(epfd, fd, conns, pool, timers, st, kts.get());
+                    continue;
+                }
+            }
+
+            // zerocopy buffers still pinned by the kernel must not go back to the pool yet,
+            // so a finished connection waits for its last completions before closing
+            if (c.peer_closed && queued_bytes(c) == 0 && !(c.bulk && !c.bulk->zc_inflight.empty())) {
+                close_client(epfd, fd, conns, pool, timers, st, kts.get());
+                continue;
+            }
+            if (timed) touch_deadlines(c, now, timers);
+            update_interest(epfd, fd, c, st);
+        }
+    }
+    close(epfd);
+}
+
+// ---------------------------------------------------------------------------------------
+// io_uring mode
+//
+// epoll tells us "fd is readable", then WE do read() and write(), so every echo costs
+// epoll_wait + read + write. With io_uring we instead describe the work once and only reap results:
+//   - ONE multishot accept SQE on the listener: it posts a CQE for every new connection, forever
+//   - ONE multishot recv SQE per connection: it posts a CQE every time data arrives,
+//     the kernel picks the buffer itself from our provided buffer ring
+//   - a send SQE per received buffer, pointing straight at that same buffer (no copy),
+//     the buffer goes back to the ring once the send CQE comes back
+// The loop is just: io_uring_enter (submit all new SQEs + wait) -> walk the CQEs -> repeat.
+//
+// Ordering: two sends to the same socket that are in flight at the same time can complete
+// in any order, which would scramble the echoed byte stream. So per connection we only ever have
+// ONE chain of sends in flight, linked with IOSQE_IO_LINK (the kernel runs linked SQEs strictly
+// one after the other). Data that arrives while a chain is in flight waits in `pending`
+// and goes out as the next chain.
+// ---------------------------------------------------------------------------------------
+
+enum : uint8_t { OP_ACCEPT = 1, OP_RECV = 2, OP_SEND = 3 };
+
+struct UringConn {
+    std::vector<uint16_t> pending;   // received buffers not yet handed to a send
+    unsigned inflight = 0;           // sends submitted, CQE not back yet
+    bool recv_armed = false;
+    bool closing = false;
+    bool open = false;
+};
+
+struct UringWorker {
+    Uring ring;
+    BufRing bufs;
+    int listen_fd = -1;
+    std::vector<UringConn> conns;         // indexed by fd
+    std::vector<uint32_t> buf_len;        // bytes held in each buffer, indexed by buffer id
+    std::vector<int> starved;             // conns whose recv stopped because the buffer ring ran dry
+    LoopStats* st = nullptr;              // one io_uring_enter counts as one wait, CQEs as its events
+
+    UringConn& conn(int fd) {
+        if ((size_t)fd >= conns.size()) conns.resize(fd * 2 + 1);
+        return conns[fd];
+    }
+
+    void arm_accept() {
+        io_uring_sqe* sqe = ring.get_sqe();
+        if (!sqe) return;
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = listen_fd;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_CLOEXEC;
+        sqe->user_data = uring_pack(OP_ACCEPT, listen_fd);
+    }
+
+    void arm_recv(int fd) {
+        io_uring_sqe* sqe = ring.get_sqe();
+        if (!sqe) return;
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = fd;
+        sqe->len = 0;                          // multishot recv: the buffer size comes from the ring
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = bufs.bgid;
+        sqe->user_data = uring_pack(OP_RECV, fd);
+        conn(fd).recv_armed = true;
+    }
+
+    // Submit everything pending for fd as one linked chain of sends
+    void flush_sends(int fd) {
+        UringConn& c = conn(fd);
+        if (c.pending.empty() || c.inflight > 0) return;
+        // a chain that gets cut by a submit in the middle would lose its ordering guarantee
+        if (ring.sq_space() < c.pending.size()) ring.submit_and_wait(0);
+
+        size_t n = c.pending.size();
+        if (n > ring.sq_space()) n = ring.sq_space();
+        for (size_t i = 0; i < n; ++i) {
+            uint16_t bid = c.pending[i];
+            io_uring_sqe* sqe = ring.get_sqe();
+            sqe->opcode = IORING_OP_SEND;
+            sqe->fd = fd;
+            sqe->addr = (uint64_t)(uintptr_t)bufs.buf(bid);
+            sqe->len = buf_len[bid];
+            // WAITALL: let the kernel retry short sends itself instead of completing half done
+            sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+            if (i + 1 < n) sqe->flags = IOSQE_IO_LINK;
+            sqe->user_data = uring_pack(OP_SEND, fd, bid);
+            ++c.inflight;
+        }
+        c.pending.erase(c.pending.begin(), c.pending.begin() + n);
+    }
+
+    void recycle(uint16_t bid) {
+        bufs.recycle(bid);
+        // buffers are back, give the recvs that starved another go
+        for (int fd : starved) {
+            UringConn& c = conn(fd);
+            if (c.open && !c.closing && !c.recv_armed) arm_recv(fd);
+        }
+        starved.clear();
+    }
+
+    // Only close once the kernel holds no more references to this fd (no recv, no sends),
+    // otherwise a CQE for the old connection could land on a new one that reused the fd number
+    void maybe_close(int fd) {
+        UringConn& c = conn(fd);
+        if (!c.open || !c.closing) return;
+        if (c.recv_armed) {
+            // wakes the multishot recv up with res = 0, we come back here from its CQE
+            shutdown(fd, SHUT_RDWR);
+            return;
+        }
+        if (c.inflight > 0) return;
+        for (uint16_t bid : c.pending) recycle(bid);
+        c.pending.clear();
+        c.open = false;
+        close(fd);
+        st->closed();
+        st->syscall();
+    }
+
+    void on_cqe(io_uring_cqe* cqe) {
+        int op = uring_op(cqe->user_data);
+        int fd = uring_fd(cqe->user_data);
+        bool more = cqe->flags & IORING_CQE_F_MORE;
+
+        if (op == OP_ACCEPT) {
+            if (cqe->res >= 0) {
+                st->accepted();
+                // same reason as in the epoll worker: no Nagle delay on the tail of an echo
+                int one = 1;
+                setsockopt(cqe->res, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                UringConn& c = conn(cqe->res);
+                c = UringConn{};
+                c.open = true;
+                arm_recv(cqe->res);
+            }
+            if (!more) arm_accept();   // multishot got cancelled (eg EMFILE), put it back
+            return;
+        }
+
+        UringConn& c = conn(fd);
+        if (op == OP_RECV) {
+            if (!more) c.recv_armed = false;
+            if (cqe->res > 0) {
+                st->in((size_t)cqe->res);
+                uint16_t bid = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+                buf_len[bid] = (uint32_t)cqe->res;
+                if (c.closing) {
+                    recycle(bid);
+                } else {
+                    c.pending.push_back(bid);
+                    flush_sends(fd);
+                    if (!more) arm_recv(fd);
+                }
+            } else if (cqe->res == -ENOBUFS) {
+                // every buffer is sitting in a send right now, retry once one comes back
+                starved.push_back(fd);
+            } else {
+                c.closing = true;   // 0 = peer closed, < 0 = error
+            }
+            maybe_close(fd);
+            return;
+        }
+
+        if (op == OP_SEND) {
+            uint16_t bid = uring_bid(cqe->user_data);
+            --c.inflight;
+            if (cqe->res > 0) st->out((size_t)cqe->res);
+            // a short send (or -ECANCELED for the rest of a broken chain) means the stream is gone
+            if (cqe->res < (int)buf_len[bid]) c.closing = true;
+            recycle(bid);
+            if (c.inflight == 0) {
+                if (c.closing) maybe_close(fd);
+                else flush_sends(fd);
+            }
+        }
+    }
+};
+
+void uring_worker(int cpu, int listen_fd) {
+    pin_to_cpu(cpu);
+
+    // one ring per thread, same share-nothing layout as the epoll workers
+    UringWorker w;
+    w.listen_fd = listen_fd;
+    if (!w.ring.init(URING_ENTRIES)) return;
+    if (!w.bufs.init(w.ring, 0, URING_BUFS, URING_BUF_SIZE)) return;
+    w.buf_len.resize(URING_BUFS);
+    w.st = &metrics_register_loop();
+
+    w.arm_accept();
+    while (true) {
+        int rc = w.ring.submit_and_wait(1);
+        if (rc < 0 && rc != -EBUSY && rc != -EAGAIN) {
+            fprintf(stderr, "io_uring_enter: %s\n", strerror(-rc));
+            break;
+        }
+        w.st->waited((int)w.ring.for_each_cqe([&](io_uring_cqe* cqe) { w.on_cqe(cqe); }));
+    }
+    w.ring.destroy();
+}
+
+int main(int argc, char** argv) {
+    // Usage: tcp_epoll_server [threads] [--uring] [--echo copy|splice|zerocopy|auto] [--inspect] [--framed] [--stats PATH]
+    //                         [--idle-timeout S] [--read-timeout S] [--write-timeout S] [--shm PATH]
+    //                         [--transform validate,lower|upper,crc32c]
+    //                         [--capture PATH] [--capture-mb N]
+    //                         [--timestamps N] (see common/kernel_ts.h)
+    //                         [low latency options, see common/low_latency.h]
+    // (default: one thread per core, epoll, copy)
+    int nthreads = (int)std::thread::hardware_concurrency();
+    bool use_uring = false;
+    const char* stats_path = nullptr;
+    TransformSpec spec;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--uring") == 0) use_uring = true;
+        else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc) stats_path = argv[++i];
+        else if (strcmp(argv[i], "--inspect") == 0) inspect = true;
+        else if (lowlat_parse_arg(argc, argv, i)) continue;
+        else if (strcmp(argv[i], "--idle-timeout") == 0 && i + 1 < argc) idle_timeout_ms = (uint64_t)(atof(argv[++i]) * 1000);
+        else if (strcmp(argv[i], "--read-timeout") == 0 && i + 1 < argc) read_timeout_ms = (uint64_t)(atof(argv[++i]) * 1000);
+        else if (strcmp(argv[i], "--write-timeout") == 0 && i + 1 < argc) write_timeout_ms = (uint64_t)(atof(argv[++i]) * 1000);
+        else if (strcmp(argv[i], "--framed") == 0) framed = true;
+        else if (strcmp(argv[i], "--transform") == 0 && i + 1 < argc) {
+            if (!parse_transform(argv[++i], spec)) {
+                std::cerr << "--transform takes a comma separated list of: validate, lower, upper, crc32c\n";
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--shm") == 0 && i + 1 < argc) shm_path = argv[++i];
+        else if (capture_parse_arg(argc, argv, i)) continue;
+        else if (kts_parse_arg(argc, argv, i)) continue;
+        else if (strcmp(argv[i], "--echo") == 0 && i + 1 < argc) {
+            const char* m = argv[++i];
+            if (strcmp(m, "splice") == 0) echo_mode = ECHO_SPLICE;
+            else if (strcmp(m, "zerocopy") == 0) echo_mode = ECHO_ZEROCOPY;
+            else if (strcmp(m, "auto") == 0) echo_mode = ECHO_AUTO;
+            else echo_mode = ECHO_COPY;
+        }
+        else nthreads = atoi(argv[i]);
+    }
+    if (nthreads <= 0) nthreads = 1;
+    if (shm_path && use_uring) {
+        std::cerr << "--shm is served by the epoll workers, not with --uring\n";
+        return 1;
+    }
+    transform = pick_pipeline(spec);
+    if (transform && use_uring) {
+        std::cerr << "--transform runs on the epoll copy path, not with --uring\n";
+        return 1;
+    }
+    if (g_kts.every && use_uring) {
+        std::cerr << "--timestamps samples the epoll copy path, not --uring\n";
+        return 1;
+    }
+    if (spec.framed_only() && !framed) {
+        std::cerr << "--transform crc32c needs --framed (it checksums whole messages)\n";
+        return 1;
+    }
+
+    // A write() to a client that already reset the connection raises SIGPIPE,
+    // which kills the whole process by default. We'd rather just get EPIPE back
+    signal(SIGPIPE, SIG_IGN);
+    raise_fd_limit();
+
+    // Open every listener up front so a bind error kills the process before any thread starts
+    std::vector<int> listeners;
+    for (int i = 0; i < nthreads; ++i) {
+        int fd = make_tcp_listener(PORT, true);
+        if (fd < 0) return 1;
+        listeners.push_back(fd);
+    }
+    int shm_fd = -1;
+    if (shm_path && (shm_fd = shm_listen(shm_path)) < 0) return 1;
+    if (g_capture.path && !capture_open()) return 1;
+
+    static const char* ECHO_NAMES[] = {"copy", "splice", "zerocopy", "auto"};
+    std::cout << "TCP server listening on port " << PORT << " (" << (use_uring ? "io_uring" : "epoll")
+              << ", " << nthreads << " threads, SO_REUSEPORT";
+    // splice never shows us the bytes and zerocopy reads into its own buffers, frames need the copy path.
+    // Capture and the transform stages need to see the bytes too
+    if (framed || g_capture.path || transform) echo_mode = ECHO_COPY;
+    if (!use_uring) std::cout << ", echo " << ECHO_NAMES[echo_mode] << (inspect ? " --inspect" : "")
+                              << (framed ? ", framed" : "");
+    if (!use_uring && g_lowlat.edge) std::cout << ", edge triggered";
+    if (!use_uring && g_lowlat.spin_us != 0) std::cout << ", spin " << (g_lowlat.spin_us < 0 ? "forever" : std::to_string(g_lowlat.spin_us) + " us");
+    if (!use_uring && g_lowlat.busy_poll_us > 0) std::cout << ", busy poll " << g_lowlat.busy_poll_us << " us";
+    if (transform) std::cout << ", transform " << (spec.validate ? "validate " : "")
+                             << (spec.fold == 'A' ? "lower " : spec.fold == 'a' ? "upper " : "")
+                             << (spec.crc ? "crc32c " : "") << "(" << simd_name(simd_best()) << ")";
+    if (g_kts.every) std::cout << ", kernel timestamps on 1 in " << g_kts.every << " reads";
+    std::cout << ")...\n";
+    if (g_capture.path) std::cout << "capturing received data to " << g_capture.path << " ("
+                                  << (g_capture.file_bytes >> 20) << " MB)\n";
+    if (shm_path) std::cout << "shared memory clients on " << shm_path << " (served by worker 0)\n";
+
+    if (stats_path && !metrics_serve(stats_path, "tcp_echo")) return 1;
+
+    int ncpu = (int)std::thread::hardware_concurrency();
+    if (ncpu <= 0) ncpu = 1;
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < nthreads; ++i) {
+        if (use_uring) threads.emplace_back(uring_worker, lowlat_cpu(i, i % ncpu), listeners[i]);
+        else threads.emplace_back(worker, lowlat_cpu(i, i % ncpu), listeners[i], i == 0 ? shm_fd : -1);
+    }
+    for (auto& t : threads) t.join();
+
+    for (int fd : listeners) close(fd);
+    if (shm_fd >= 0) {
+        close(shm_fd);
+        unlink(shm_path);
+    }
+    return 0;
+}
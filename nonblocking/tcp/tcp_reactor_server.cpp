@@ -0,0 +1,343 @@
+#include <iostream>
+#include <cstring>
+#include <unistd.h>
+#include <vector>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/uio.h>
+#include <cerrno>
+#include <signal.h>
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+#include "../../common/reactor.h"
+#include "../../common/sockets.h"
+#include "../../common/out_buffer.h"
+#include "../../common/conn_table.h"
+#include "../../common/async_log.h"
+#include "../../common/metrics.h"
+#include "../../common/timer_wheel.h"
+
+// Portable TCP echo server: one event loop written once against common/reactor.h, running on
+// epoll or io_uring on Linux and on kqueue on BSD/macOS (--backend). The loop is a template over
+// the backend, so each one gets its own compiled copy with direct calls, no virtual dispatch.
+//
+// --threads N runs N of these loops, each with its own listening socket in a SO_REUSEPORT group
+// (the kernel spreads the connections over them). Where SO_REUSEPORT doesnt balance (macOS), the
+// loops share one listening socket instead and whoever accept()s first gets the client.
+
+static const uint16_t PORT = 8080;
+static const int MAX_EVENTS = 64;
+
+// Backpressure: once a client has this many echoed bytes we couldnt write yet (it isnt reading),
+// we stop reading from it. Its own data then piles up in the kernel, TCP flow control pushes back
+// on the client, and our memory stays bounded. Reading resumes once the backlog drains below LOW_WATER.
+static const size_t HIGH_WATER = 256 * 1024;
+static const size_t LOW_WATER = 64 * 1024;
+
+// --idle-timeout S: close clients that had no event at all for S seconds.
+// --write-timeout S: close clients that have echo bytes queued and took none of them for S seconds.
+// One WheelTimer per client, armed for the earlier of the two; traffic only updates the timestamps
+// and the timer re-arms itself for the rest when it fires early (see common/timer_wheel.h)
+static uint64_t idle_timeout_ms = 0;
+static uint64_t write_timeout_ms = 0;
+
+// Everything the loop needs to remember about one client between events.
+// Its output buffers are borrowed from the loop's BufferPool only while bytes are waiting
+struct Conn {
+    OutputQueue out;            // echoed bytes the socket hasnt taken yet
+    uint32_t interest = RX_IN;  // what the reactor watches for: RX_IN while reading, RX_OUT while out has bytes
+    bool peer_closed = false;   // got EOF, close once out is flushed
+
+    WheelTimer timer;           // cookie = fd
+    uint64_t timer_at = 0;      // ms the timer is armed for
+    uint64_t last_active = 0;   // ms of the last event
+    uint64_t out_since = 0;     // ms since out has been waiting without shrinking, 0 = empty
+    size_t last_queued = 0;
+};
+
+// Earliest deadline of c in ms, 0 = none
+uint64_t next_deadline(const Conn& c) {
+    uint64_t d = UINT64_MAX;
+    if (idle_timeout_ms) d = std::min(d, c.last_active + idle_timeout_ms);
+    if (write_timeout_ms && c.out_since) d = std::min(d, c.out_since + write_timeout_ms);
+    return d == UINT64_MAX ? 0 : d;
+}
+
+// Called after each event on c. Only touches the wheel when a deadline moved earlier
+void touch_deadlines(Conn& c, uint64_t now, TimerWheel& timers) {
+    if (!idle_timeout_ms && !write_timeout_ms) return;
+    c.last_active = now;
+    size_t q = c.out.size();
+    if (q == 0) c.out_since = 0;
+    else if (c.out_since == 0 || q < c.last_queued) c.out_since = now;
+    c.last_queued = q;
+    uint64_t d = next_deadline(c);
+    if (d && (!c.timer.armed() || d < c.timer_at)) {
+        c.timer_at = d;
+        timers.arm(c.timer, d);
+    }
+}
+
+// writev() as much of the backlog as the socket takes. false = connection is broken
+bool flush_output(int fd, Conn& c, BufferPool& pool, LoopStats& st) {
+    iovec iov[16];
+    while (!c.out.empty()) {
+        int cnt = c.out.fill_iovec(iov, 16);
+        size_t want = 0;
+        for (int i = 0; i < cnt; ++i) want += iov[i].iov_len;
+        ssize_t n = writev(fd, iov, cnt);
+        st.syscall();
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) return false;
+            st.would_block();
+            return true;
+        }
+        st.out((size_t)n);
+        if ((size_t)n < want) st.short_write();
+        c.out.consume(pool, (size_t)n);
+    }
+    return true;
+}
+
+// Watches for writable only while bytes are waiting (otherwise the reactor would report
+// "writable" on every single wait), and toggles reading around the high/low water marks
+template <typename R>
+void update_interest(R& reactor, int fd, Conn& c, LoopStats& st) {
+    bool reading = c.interest & RX_IN;
+    bool want_read = !c.peer_closed && c.out.size() < (reading ? HIGH_WATER : LOW_WATER);
+    uint32_t want = (want_read ? RX_IN : 0u) | (c.out.empty() ? 0u : RX_OUT);
+    if (want == c.interest) return;
+    reactor.modify(fd, c.interest, want);
+    c.interest = want;
+    if (R::CTL_SYSCALL) st.syscall();
+}
+
+template <typename R>
+void close_conn(R& reactor, int fd, ConnTable<Conn>& conns, BufferPool& pool, TimerWheel& timers, LoopStats& st) {
+    log_close(fd);
+    st.closed();
+    st.syscall();
+    timers.cancel(conns.get(fd)->timer);
+    conns.get(fd)->out.release(pool);
+    conns.close(fd);
+    reactor.remove(fd);
+    close(fd);
+}
+
+// One read and its echo. false = close the connection
+bool on_readable(int fd, Conn& c, char* buf, size_t buf_size, BufferPool& pool, LoopStats& st) {
+    ssize_t n = read(fd, buf, buf_size);
+    st.syscall();
+    // n = 0 means client closed connection
+    // -1 means error, cld be disconnection too?
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        if (errno != EINTR) st.would_block();
+        return true;
+    }
+    if (n < 0 || (n == 0 && c.out.empty())) return false;
+    if (n == 0) {
+        // client is done sending but still waiting for its echo, finish writing first
+        c.peer_closed = true;
+        return true;
+    }
+
+    // copies (up to) the first LOG_PAYLOAD bytes into a ring, printing happens off this thread
+    log_recv(fd, nullptr, buf, n);
+    st.in((size_t)n);
+
+    // Echo back. Fast path: nothing queued, so write straight from buf and only keep what
+    // the socket refused. If something IS queued we must append behind it to keep the order
+    ssize_t w = 0;
+    if (c.out.empty()) {
+        w = write(fd, buf, n);
+        st.syscall();
+        if (w < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) return false;
+            if (errno != EINTR) st.would_block();
+            w = 0;
+        } else {
+            st.out((size_t)w);
+            if (w < n) st.short_write();
+        }
+    }
+    if (w < n) c.out.append(pool, buf + w, n - w);
+    return true;
+}
+
+// The socket has room again, push out whatever is waiting. false = close the connection
+bool on_writable(int fd, Conn& c, BufferPool& pool, LoopStats& st) {
+    if (!flush_output(fd, c, pool, st)) return false;
+    return !(c.peer_closed && c.out.empty());
+}
+
+template <typename R>
+int run_loop(R& reactor, int server_fd) {
+    // Hey kernel, tell me when the listening socket has a connection waiting.
+    // accept() won't block then: the thread sleeps inside wait() instead, and the kernel
+    // only wakes it when there is something to do
+    if (!reactor.add(server_fd, RX_IN)) return 1;
+
+    // A buffer where wait() writes the list of fds that are ready for i/o
+    std::vector<RxEvent> events(MAX_EVENTS);
+    // one read per readable event, big enough to take a 64 KB message in one go
+    std::vector<char> buf(64 * 1024);
+
+    // Per-client state, indexed by fd (fds are small ints handed out lowest-first, so this stays dense)
+    ConnTable<Conn> conns;
+    // Output buffers shared by every client of this loop
+    BufferPool pool;
+    // Counters for this loop, read from the --stats endpoint thread
+    LoopStats& st = metrics_register_loop();
+    // Idle / write deadlines, 10 ms resolution
+    TimerWheel timers(10);
+    uint64_t now = monotonic_ms();
+
+    while (true) {
+        // Put thread to sleep until the kernel says that an fd is ready.
+        // This fd cld be server fd (means theres a new client connection)
+        // or client fd (the client has data ready, or room for our echo)
+        // ...or until the next deadline is due (-1 = no timers, sleep for as long as it takes)
+        int wait_ms = timers.next_timeout_ms(now);
+        int nev = reactor.wait(events.data(), MAX_EVENTS, wait_ms);
+        if (nev < 0) {
+            if (errno == EINTR) continue;
+            perror(R::NAME);
+            break;
+        }
+        st.waited(nev);
+        now = monotonic_ms();
+
+        timers.expire(now, [&](WheelTimer& t) {
+            int fd = (int)t.cookie;
+            Conn* c = conns.get(fd);
+            if (!c) return;
+            uint64_t d = next_deadline(*c);
+            if (d && d <= now) {
+                st.timed_out();
+                close_conn(reactor, fd, conns, pool, timers, st);
+            } else if (d) {
+                c->timer_at = d;   // there was traffic since it was armed
+                timers.arm(t, d);
+            }
+        });
+
+        for (int i = 0; i < nev; ++i) {
+            int fd = events[i].fd;
+            uint32_t ev = events[i].events;
+            if (fd == server_fd) {
+                // New client connections. Take every one that is waiting, under a connection storm
+                // one accept per wait would be way too slow
+                while (true) {
+                    sockaddr_in cli{};
+                    socklen_t len = sizeof(cli);
+                    int client_fd = accept_nonblocking(server_fd, &cli, &len);
+                    st.syscall();
+                    if (client_fd < 0) {
+                        if (errno == EAGAIN || errno == EWOULDBLOCK) st.would_block();
+                        else if (errno != EINTR && errno != ECONNABORTED) perror("accept");
+                        break;
+                    }
+                    st.accepted();
+                    st.syscall(R::CTL_SYSCALL ? 2 : 1);   // setsockopt (+ the registration)
+                    // the tail of an echo must not wait in Nagle's buffer for a delayed ACK
+                    int one = 1;
+                    setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                    // Start watching the new client for data. Write interest only gets added
+                    // once we have something the socket didnt take
+                    if (!reactor.add(client_fd, RX_IN)) {
+                        close(client_fd);
+                        continue;
+                    }
+                    Conn* c = conns.open(client_fd);
+                    c->timer.cookie = (uint64_t)client_fd;
+                    touch_deadlines(*c, now, timers);
+                    log_accept(client_fd, cli);
+                }
+                continue;
+            }
+            // stale event for a client we already closed earlier in this same batch
+            Conn* c = conns.get(fd);
+            if (!c) continue;
+            if ((ev & RX_IN) && !on_readable(fd, *c, buf.data(), buf.size(), pool, st)) {
+                close_conn(reactor, fd, conns, pool, timers, st);
+                continue;
+            }
+            if ((ev & RX_OUT) && !on_writable(fd, *c, pool, st)) {
+                close_conn(reactor, fd, conns, pool, timers, st);
+                continue;
+            }
+            touch_deadlines(*c, now, timers);
+            update_interest(reactor, fd, *c, st);
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    // Usage: tcp_reactor_server [--backend epoll|uring|kqueue] [--threads N] [--stats PATH]
+    //                           [--idle-timeout S] [--write-timeout S]
+    //                           [--log-level off|error|info|debug] [--log-sample N] [--quiet]
+    const char* stats_path = nullptr;
+    int threads = 1;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc) stats_path = argv[++i];
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--idle-timeout") == 0 && i + 1 < argc) idle_timeout_ms = (uint64_t)(atof(argv[++i]) * 1000);
+        else if (strcmp(argv[i], "--write-timeout") == 0 && i + 1 < argc) write_timeout_ms = (uint64_t)(atof(argv[++i]) * 1000);
+        else if (reactor_parse_arg(argc, argv, i)) continue;
+        else if (!log_parse_arg(argc, argv, i)) {
+            std::cerr << "Usage: " << argv[0] << " " REACTOR_USAGE " [--threads N] [--stats PATH] "
+                      "[--idle-timeout S] [--write-timeout S] " LOG_USAGE "\n";
+            return 1;
+        }
+    }
+    if (threads < 1) threads = 1;
+    raise_fd_limit();
+
+    // Bind + listen on port 8080, one socket per loop if the kernel can balance between them.
+    // Why doesent the client need to bind()?
+    // OS can choose any avail local port for the client automatically
+    // Clients only care where theyre gg not where theyre calling from
+    // connect() on the client implicitly binds to an ephermal port like 40023 and picks the IP if not already bound
+    std::vector<int> listeners;
+    bool shared = false;
+    int first = make_tcp_listener(PORT, threads > 1);
+    if (first < 0 && threads > 1) {
+        // no balancing here, every loop watches the same listener
+        first = make_tcp_listener(PORT, false);
+        shared = true;
+    }
+    if (first < 0) return 1;
+    listeners.push_back(first);
+    for (int i = 1; i < threads; ++i) {
+        int fd = shared ? first : make_tcp_listener(PORT, true);
+        if (fd < 0) return 1;
+        listeners.push_back(fd);
+    }
+
+    // write() to a client that already reset the connection raises SIGPIPE, which kills the process.
+    // Ignoring it makes write() return EPIPE instead, which we handle like any other error
+    signal(SIGPIPE, SIG_IGN);
+
+    std::cout << "TCP server listening on port " << PORT << " (" << g_reactor.backend;
+    if (threads > 1) std::cout << ", " << threads << " threads" << (shared ? " sharing one listener" : ", SO_REUSEPORT");
+    std::cout << ")..." << std::endl;
+    log_start();
+    if (stats_path && !metrics_serve(stats_path, "tcp_echo")) return 1;
+
+    auto serve = [](int listen_fd) {
+        return with_reactor(g_reactor.backend, [&](auto& reactor) { return run_loop(reactor, listen_fd); });
+    };
+    if (threads == 1) return serve(listeners[0]);
+
+    std::vector<std::thread> loops;
+    for (int i = 0; i < threads; ++i) loops.emplace_back([&, i] { serve(listeners[i]); });
+    for (auto& t : loops) t.join();
+    return 0;
+}
@@ -1,79 +1,690 @@
 #include <iostream>
 #include <cstring>
+#include <cstdlib>
+#include <cerrno>
 #include <unistd.h>
-#include <fcntl.h>
+#include <signal.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
-#include <sys/epoll.h>
+#include <sys/mman.h>
 #include <arpa/inet.h>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <netinet/udp.h>
+#include <linux/filter.h>
+#include "../../common/uring.h"
+#endif
 
-int make_non_blocking(int fd) {
-    // Retrieves current flags on fd
-    // Adds O_NONBLOCK so syscalls like recvfrom() return -1 
-    // and set errno = EAGAIN if nothing is available
-    int flags = fcntl(fd, F_GETFL, 0);
-    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+#include "../../common/reactor.h"
+#include "../../common/sockets.h"
+#include "../../common/async_log.h"
+#include "../../common/metrics.h"
+#include "../../common/low_latency.h"
+#include "../../common/capture.h"
+#include "../../common/peer_limiter.h"
+#include "../../common/kernel_ts.h"
+
+// The event loop is common/reactor.h's, so it runs on epoll (default) or io_uring polls on Linux and
+// on kqueue on BSD/macOS (--backend). recvmmsg batching, GSO/GRO, --uring and the CPU steered
+// shards are Linux only; elsewhere the loop moves one datagram per recvfrom/sendto.
+
+#ifdef __linux__
+// ---------------------------------------------------------------------------------------
+// io_uring mode (--uring)
+//
+// The epoll loop below pays epoll_wait + recvfrom + sendto for every datagram.
+// Here we post ONE multishot recvmsg: the kernel keeps it armed forever and drops every datagram
+// (sender address + payload) into a buffer it picks from our provided buffer ring, then posts a CQE.
+// We answer each one with a sendmsg SQE that points right back into that same buffer,
+// and give the buffer back to the ring when the send completes.
+// All of that goes through one io_uring_enter per loop iteration, however many datagrams it covers.
+//
+// UDP has no byte stream to keep in order, so unlike the TCP side the sends are not linked.
+// ---------------------------------------------------------------------------------------
+
+enum : uint8_t { OP_RECVMSG = 1, OP_SENDMSG = 2 };
+
+static const unsigned URING_ENTRIES = 4096;
+static const unsigned URING_BUFS = 4096;
+// recvmsg_out header + sockaddr_in + the biggest datagram. Multishot recvmsg cant be told how big
+// the next datagram is, and a datagram that doesnt fit its buffer is cut, so every buffer takes the
+// worst case. They are left unfaulted: a small datagram only ever touches the first page of its buffer
+static const unsigned URING_BUF_SIZE = 64 * 1024 + 256;
+
+int run_uring(int udp_fd) {
+    LoopStats& st = metrics_register_loop();
+    std::unique_ptr<PeerLimiter> limiter = peer_limit_create();
+    Uring ring;
+    BufRing bufs;
+    if (!ring.init(URING_ENTRIES)) return 1;
+    if (!bufs.init(ring, 0, URING_BUFS, URING_BUF_SIZE, false)) return 1;
+
+    // For multishot recvmsg the msghdr is only a template: it tells the kernel how much room
+    // to leave for the address (and cmsgs) at the front of each buffer
+    msghdr tmpl{};
+    tmpl.msg_namelen = sizeof(sockaddr_in);
+
+    // The sendmsg for buffer `bid` needs a msghdr + iovec that stays alive until its CQE,
+    // so there is one of each per buffer
+    std::vector<msghdr> send_msgs(URING_BUFS);
+    std::vector<iovec> send_iovs(URING_BUFS);
+
+    // false = no SQE for it, try again after the next wakeup
+    auto arm_recv = [&]() {
+        io_uring_sqe* sqe = ring.get_sqe();
+        if (!sqe) return false;
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->fd = udp_fd;
+        sqe->addr = (uint64_t)(uintptr_t)&tmpl;
+        sqe->len = 1;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = bufs.bgid;
+        sqe->user_data = uring_pack(OP_RECVMSG, udp_fd);
+        return true;
+    };
+
+    bool recv_armed = false;
+    bool starved = false;   // recv stopped because every buffer is out in a send
+    recv_armed = arm_recv();
+
+    while (true) {
+        int rc = ring.submit_and_wait(1);
+        if (rc < 0 && rc != -EBUSY && rc != -EAGAIN) {
+            fprintf(stderr, "io_uring_enter: %s\n", strerror(-rc));
+            break;
+        }
+
+        // one clock read for every datagram this wakeup brought
+        uint32_t now_ms = limiter ? peer_clock_ms() : 0;
+        uint64_t evicted = limiter ? limiter->evictions : 0;
+
+        unsigned ncqe = ring.for_each_cqe([&](io_uring_cqe* cqe) {
+            uint8_t op = uring_op(cqe->user_data);
+
+            if (op == OP_SENDMSG) {
+                if (cqe->res >= 0) st.out((size_t)cqe->res);
+                bufs.recycle(uring_bid(cqe->user_data));
+                if (starved) { starved = false; recv_armed = arm_recv(); }
+                return;
+            }
+
+            if (!(cqe->flags & IORING_CQE_F_MORE)) recv_armed = false;
+            if (cqe->res < 0) {
+                if (cqe->res == -ENOBUFS) starved = true;
+                else fprintf(stderr, "recvmsg: %s\n", strerror(-cqe->res));
+            } else if (cqe->flags & IORING_CQE_F_BUFFER) {
+                uint16_t bid = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+                char* buf = bufs.buf(bid);
+                // Buffer layout: [recvmsg_out][sender address][cmsgs][payload]
+                io_uring_recvmsg_out* out = (io_uring_recvmsg_out*)buf;
+                char* name = buf + sizeof(io_uring_recvmsg_out);
+                char* payload = name + tmpl.msg_namelen + tmpl.msg_controllen;
+                size_t room = URING_BUF_SIZE - (payload - buf);
+                size_t len = out->payloadlen < room ? out->payloadlen : room;
+                sockaddr_in* peer = (sockaddr_in*)name;
+                if (limiter && !limiter->allow(peer->sin_addr.s_addr, peer->sin_port, now_ms)) {
+                    // over its budget: the buffer goes straight back to the ring, no reply
+                    st.limited();
+                    bufs.recycle(bid);
+                } else {
+                    log_recv(udp_fd, peer, payload, len);
+                    if (g_capture.on && !capture_record(CAP_UDP_DATA, peer->sin_addr.s_addr, peer->sin_port, payload, len))
+                        st.capture_drop();
+                    st.in(len);
+
+                    iovec& iov = send_iovs[bid];
+                    iov.iov_base = payload;
+                    iov.iov_len = len;
+                    msghdr& msg = send_msgs[bid];
+                    msg = msghdr{};
+                    msg.msg_name = name;
+                    msg.msg_namelen = out->namelen < tmpl.msg_namelen ? out->namelen : tmpl.msg_namelen;
+                    msg.msg_iov = &iov;
+                    msg.msg_iovlen = 1;
+
+                    // get_sqe already flushed a full SQ once. Still full: drop this reply but
+                    // carry on, the recv may need re-arming below
+                    io_uring_sqe* sqe = ring.get_sqe();
+                    if (!sqe) {
+                        st.reply_dropped();
+                        bufs.recycle(bid);
+                    } else {
+                        sqe->opcode = IORING_OP_SENDMSG;
+                        sqe->fd = udp_fd;
+                        sqe->addr = (uint64_t)(uintptr_t)&msg;
+                        sqe->len = 1;
+                        sqe->user_data = uring_pack(OP_SENDMSG, udp_fd, bid);
+                    }
+                }
+            }
+        });
+        // multishot stopped for some other reason (eg CQ overflow), put it back. Checked once per
+        // wakeup, so a re-arm that found no SQE is retried on the next one
+        if (!recv_armed && !starved) recv_armed = arm_recv();
+        st.waited((int)ncqe);
+        if (limiter) st.evicted(limiter->evictions - evicted);
+    }
+    ring.destroy();
+    close(udp_fd);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------------------
+// Batched datagram I/O for the epoll loop
+//
+// recvfrom/sendto move ONE datagram per syscall. recvmmsg/sendmmsg take an array of
+// mmsghdr (each one a full msghdr: buffer + room for the sender address) and move up to
+// `size` datagrams per syscall. For small-datagram floods the syscall itself is most of the cost,
+// so draining 64 datagrams per recvmmsg + 1 sendmmsg is ~64x fewer kernel crossings.
+//
+// The slots are allocated once and reused forever. The same mmsghdr array is used for the replies:
+// after recvmmsg every slot already holds the sender address (msg_name) and the payload,
+// so we just shrink each iovec to the received length and hand the array to sendmmsg.
+// ---------------------------------------------------------------------------------------
+
+// Slot size. recvmmsg cuts a datagram that doesnt fit its slot and drops the rest of it, and there is
+// no asking how big the next 32 datagrams are without a MSG_PEEK syscall for each (which would undo
+// the batching). So every slot is as big as a datagram (or a GRO super-packet) can get, 64 KB, but
+// that is only address space: the slots are mapped without touching them, and a page gets memory
+// the first time a datagram reaches into it. 64 byte datagrams cost one page per slot, 1400 byte
+// ones too, a 60 KB datagram takes its 15 pages in the one slot it landed in.
+static const size_t SLOT_SIZE = 64 * 1024;
+static const int MAX_BATCH = 1024;   // the kernel caps vlen at UIO_MAXIOV (1024) anyway
+
+// ---------------------------------------------------------------------------------------
+// GSO/GRO mode (--gso)
+//
+// UDP_GRO on the socket lets the kernel hand us several datagrams from the same peer glued into
+// one "super-packet" plus a cmsg saying how big each original segment was.
+// UDP_SEGMENT (GSO) is the reverse on the way out: we pass one big buffer + the segment size
+// and the kernel (or the NIC) cuts it back into datagrams of that size.
+// So a burst of 40 x 1200 byte datagrams from one client costs us one recv slot and one send slot
+// instead of 40 of each, and the whole network stack is walked once per burst instead of per datagram.
+// ---------------------------------------------------------------------------------------
+
+struct DatagramBatch {
+    int size = 0;
+    bool gso = false;
+    bool stamps = false;      // --timestamps: the RX stamp cmsg comes with every datagram
+    std::vector<mmsghdr> msgs;
+    std::vector<iovec> iovs;
+    std::vector<sockaddr_in> addrs;
+    char* bufs = nullptr;     // size * SLOT_SIZE, mostly never faulted in
+    std::vector<char> ctrl;   // one cmsg slot per datagram, only used with --gso / --timestamps
+    size_t ctrl_size = 0;
+    std::vector<int> live;    // --rate-limit: the slots that got through
+    std::vector<mmsghdr> out; // --rate-limit: their replies packed together for sendmmsg
+
+    bool init(int n, bool use_gso, bool use_stamps) {
+        size = n;
+        gso = use_gso;
+        stamps = use_stamps;
+        // the same buffer holds what recvmsg puts there (UDP_GRO, SCM_TIMESTAMPING) and then
+        // what the reply sends (UDP_SEGMENT, the TX stamp request)
+        size_t recv_ctrl = (gso ? CMSG_SPACE(sizeof(int)) : 0) + (stamps ? KTS_RX_CMSG_SPACE : 0);
+        size_t send_ctrl = (gso ? CMSG_SPACE(sizeof(uint16_t)) : 0) + (stamps ? KTS_TX_CMSG_SPACE : 0);
+        ctrl_size = std::max(recv_ctrl, send_ctrl);
+        msgs.assign(n, mmsghdr{});
+        iovs.assign(n, iovec{});
+        addrs.assign(n, sockaddr_in{});
+        live.assign(n, 0);
+        out.assign(n, mmsghdr{});
+        void* p = mmap(nullptr, (size_t)n * SLOT_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED) { perror("mmap datagram slots"); return false; }
+        bufs = (char*)p;
+        if (ctrl_size) ctrl.assign((size_t)n * ctrl_size, 0);
+        for (int i = 0; i < n; ++i) {
+            iovs[i].iov_base = bufs + (size_t)i * SLOT_SIZE;
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+        }
+        reset(n);
+        return true;
+    }
+
+    ~DatagramBatch() {
+        if (bufs) munmap(bufs, (size_t)size * SLOT_SIZE);
+    }
+
+    // recvmmsg/sendmmsg overwrite the lengths, put the full sizes back before the next recv
+    void reset(int count) {
+        for (int i = 0; i < count; ++i) {
+            iovs[i].iov_len = SLOT_SIZE;
+            msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+            if (ctrl_size) {
+                msgs[i].msg_hdr.msg_control = &ctrl[(size_t)i * ctrl_size];
+                msgs[i].msg_hdr.msg_controllen = ctrl_size;
+            }
+        }
+    }
+
+    char* buf(int i) { return (char*)iovs[i].iov_base; }
+
+    // Size of the original datagrams glued into slot i, 0 = it is just one datagram
+    int gro_segment(int i) {
+        msghdr& mh = msgs[i].msg_hdr;
+        int seg = 0;
+        for (cmsghdr* c = CMSG_FIRSTHDR(&mh); c; c = CMSG_NXTHDR(&mh, c)) {
+            if (c->cmsg_level == SOL_UDP && c->cmsg_type == UDP_GRO) memcpy(&seg, CMSG_DATA(c), sizeof(seg));
+        }
+        return seg;
+    }
+
+    // --rate-limit: charges each of the first n slots to its sender and returns how many got
+    // through, their slot numbers are in live[]. The clock is read once for the whole batch
+    int admit(int n, PeerLimiter& limiter, LoopStats& st) {
+        uint32_t now_ms = peer_clock_ms();
+        uint64_t evicted = limiter.evictions;
+        int kept = 0;
+        for (int i = 0; i < n; ++i) {
+            // a GRO super-packet pays for every datagram glued into it
+            uint32_t cost = 1;
+            if (gso) {
+                unsigned len = msgs[i].msg_len;
+                int seg = gro_segment(i);
+                if (seg > 0 && len > (unsigned)seg) cost = (len + seg - 1) / seg;
+            }
+            if (limiter.allow(addrs[i].sin_addr.s_addr, addrs[i].sin_port, now_ms, cost)) live[kept++] = i;
+            else st.limited(cost);
+        }
+        st.evicted(limiter.evictions - evicted);
+        return kept;
+    }
+
+    // The replies of the slots admit() let through, back to back (sendmmsg wants one array)
+    mmsghdr* pack(int nlive) {
+        for (int k = 0; k < nlive; ++k) out[k] = msgs[live[k]];
+        return out.data();
+    }
+
+    // Turns the cmsgs we received in slot i into the ones its reply needs: the UDP_GRO segment size
+    // becomes a UDP_SEGMENT cmsg, and a sampled reply (stamp) asks for its TX timestamp
+    void reply_control(int i, unsigned len, bool stamp) {
+        msghdr& mh = msgs[i].msg_hdr;
+        int seg = gso ? gro_segment(i) : 0;
+        bool segment = seg > 0 && len > (unsigned)seg;
+        if (!segment && !stamp) {
+            // plain single datagram, nothing to say about it
+            mh.msg_control = nullptr;
+            mh.msg_controllen = 0;
+            return;
+        }
+        // reuse the same control buffer for the outgoing cmsgs
+        char* p = (char*)mh.msg_control;
+        size_t used = 0;
+        if (segment) {
+            cmsghdr* c = (cmsghdr*)p;
+            c->cmsg_level = SOL_UDP;
+            c->cmsg_type = UDP_SEGMENT;
+            c->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            uint16_t gso_size = (uint16_t)seg;
+            memcpy(CMSG_DATA(c), &gso_size, sizeof(gso_size));
+            used += CMSG_SPACE(sizeof(uint16_t));
+        }
+        if (stamp) used += kts_put_tx_request((cmsghdr*)(p + used));
+        mh.msg_controllen = used;
+    }
+};
+
+bool enable_gro(int udp_fd) {
+    int on = 1;
+    if (setsockopt(udp_fd, SOL_UDP, UDP_GRO, &on, sizeof(on)) < 0) {
+        perror("setsockopt UDP_GRO");
+        return false;
+    }
+    return true;
 }
 
-int main() {
-    int udp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+// Reads everything queued on the socket (up to batch.size datagrams per syscall) and echoes it back.
+// limiter: --rate-limit, nullptr = answer everyone. kts: --timestamps, nullptr = no sampling
+void drain_and_echo(int udp_fd, DatagramBatch& batch, LoopStats& st, PeerLimiter* limiter, KernelTs* kts) {
+    while (true) {
+        int n = recvmmsg(udp_fd, batch.msgs.data(), batch.size, MSG_DONTWAIT, nullptr);
+        st.syscall();
+        if (n <= 0) {
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) st.would_block();
+            // EAGAIN = socket drained, back to epoll_wait
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) perror("recvmmsg");
+            return;
+        }
+
+        // Senders over their budget are dropped right here, before capture, logging or building a reply
+        int nlive = limiter ? batch.admit(n, *limiter, st) : n;
+
+        // --timestamps: the whole batch was read at one moment (read_ns), and its replies go out in
+        // one sendmmsg, so one clock read on each side serves every sampled datagram in it
+        uint64_t read_ns = 0;
+        int nsampled = 0;
+        int stamp_k = -1;   // the reply that asks for a TX stamp, at most one per batch
+
+        for (int k = 0; k < nlive; ++k) {
+            int i = limiter ? batch.live[k] : k;
+            unsigned len = batch.msgs[i].msg_len;
+            bool stamp = false;
+            if (kts && kts->sample()) {
+                if (!read_ns) read_ns = kts_now_ns();
+                kts->received(kts_stamp(batch.msgs[i].msg_hdr), read_ns);
+                ++nsampled;
+                if (stamp_k < 0 && kts->want_tx(read_ns)) {
+                    stamp = true;
+                    stamp_k = k;
+                }
+            }
+            batch.iovs[i].iov_len = len;   // echo exactly what came in
+            if (g_capture.on) {
+                // one record per datagram the client sent, not per GRO super-packet
+                unsigned seg = batch.gso ? (unsigned)batch.gro_segment(i) : 0;
+                if (seg == 0) seg = len;
+                for (unsigned off = 0; off < len; off += seg)
+                    if (!capture_record(CAP_UDP_DATA, batch.addrs[i].sin_addr.s_addr, batch.addrs[i].sin_port,
+                                        batch.buf(i) + off, len - off < seg ? len - off : seg))
+                        st.capture_drop();
+            }
+            if (batch.gso || batch.stamps) batch.reply_control(i, len, stamp);
+            // with GRO this is the whole coalesced burst, the log keeps the real length and the first bytes
+            log_recv(udp_fd, &batch.addrs[i], batch.buf(i), len);
+            st.in(len);
+        }
+
+        // Nothing dropped: the replies go out of the recv array itself. Otherwise out of a packed copy
+        mmsghdr* replies = nlive == n ? batch.msgs.data() : batch.pack(nlive);
+        uint64_t send_ns = nsampled ? kts_now_ns() : 0;
+
+        // sendmmsg can stop early (eg send buffer full), keep going from where it stopped
+        int sent = 0;
+        while (sent < nlive) {
+            int r = sendmmsg(udp_fd, replies + sent, nlive - sent, 0);
+            st.syscall();
+            if (r < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) st.would_block();
+                // UDP makes no delivery promise anyway, drop the rest of this batch rather than block
+                if (errno != EAGAIN && errno != EWOULDBLOCK) perror("sendmmsg");
+                break;
+            }
+            for (int k = sent; k < sent + r; ++k) st.out(replies[k].msg_hdr.msg_iov->iov_len);
+            // sendmmsg returning fewer than asked is the datagram version of a short write
+            if (sent + r < nlive) st.short_write();
+            sent += r;
+        }
+        for (int k = 0; k < nsampled; ++k) kts->sent(udp_fd, read_ns, send_ns, k == 0 && stamp_k >= 0 && stamp_k < sent);
+
+        batch.reset(n);
+        // a short batch means the receive queue is empty, no need to pay for a recvmmsg that returns EAGAIN.
+        // Also safe edge triggered (--edge): every datagram queued after this raises a new edge
+        if (n < batch.size) return;
+    }
+}
+
+#else
+
+static const size_t SLOT_SIZE = 64 * 1024;
+static const int MAX_BATCH = 1024;
+
+// No recvmmsg/sendmmsg: one recvfrom + sendto per datagram, through one buffer that takes the biggest
+struct DatagramBatch {
+    int size = 0;
+    std::vector<char> buf;
+
+    bool init(int n, bool, bool) {
+        size = n;
+        buf.resize(SLOT_SIZE);
+        return true;
+    }
+};
+
+// Reads everything queued on the socket and echoes it back. limiter: --rate-limit, nullptr = answer everyone.
+// (--timestamps is Linux only, kts is always nullptr here)
+void drain_and_echo(int udp_fd, DatagramBatch& batch, LoopStats& st, PeerLimiter* limiter, KernelTs*) {
+    while (true) {
+        sockaddr_in peer{};
+        socklen_t plen = sizeof(peer);
+        ssize_t n = recvfrom(udp_fd, batch.buf.data(), batch.buf.size(), MSG_DONTWAIT, (sockaddr*)&peer, &plen);
+        st.syscall();
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) st.would_block();
+            else if (errno != EINTR) perror("recvfrom");
+            return;
+        }
+        if (limiter) {
+            uint64_t evicted = limiter->evictions;
+            bool ok = limiter->allow(peer.sin_addr.s_addr, peer.sin_port, peer_clock_ms());
+            st.evicted(limiter->evictions - evicted);
+            if (!ok) { st.limited(); continue; }
+        }
+        if (g_capture.on && !capture_record(CAP_UDP_DATA, peer.sin_addr.s_addr, peer.sin_port, batch.buf.data(), (size_t)n))
+            st.capture_drop();
+        log_recv(udp_fd, &peer, batch.buf.data(), (size_t)n);
+        st.in((size_t)n);
+        ssize_t w = sendto(udp_fd, batch.buf.data(), (size_t)n, 0, (sockaddr*)&peer, plen);
+        st.syscall();
+        if (w < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) st.would_block();
+            else perror("sendto");
+        } else {
+            st.out((size_t)w);
+        }
+    }
+}
+
+#endif
 
-    if (udp_fd < 0) { perror("socket"); return 1; }
+// ---------------------------------------------------------------------------------------
+// Sharding (--workers N)
+//
+// One socket served by one thread tops out at what one core can do, however many cores the box has.
+// With --workers N every worker gets its OWN socket bound to the same port (SO_REUSEPORT), its own
+// epoll loop (or io_uring) and its own CPU, so nothing is shared between them.
+//
+// Plain SO_REUSEPORT picks the socket by hashing the 4-tuple, so a datagram is usually processed
+// by a different core than the one whose softirq received it, and its cache lines move with it.
+// SO_ATTACH_REUSEPORT_CBPF lets a tiny classic BPF program pick the socket instead. Ours reads the
+// CPU the packet arrived on and returns the index of the socket whose worker is pinned there
+// (the index is the order the sockets were bound in). With RSS spreading flows over the NIC queues
+// and each queue's IRQ on its own core, a datagram then never leaves the core it arrived on.
+// ---------------------------------------------------------------------------------------
 
-    sockaddr_in serv{};
-    serv.sin_family = AF_INET;
-    serv.sin_addr.s_addr = INADDR_ANY;
-    serv.sin_port = htons(8080);
+// Socket i of the group belongs to the worker pinned to cpus[i]:
+//     A = cpu; if A == cpus[0] return 0; if A == cpus[1] return 1; ...; return A % n
+// The fallback only matters for CPUs that have no worker (eg IRQs on a core outside --cpus).
+// Returns false (and leaves the default hashing on) if two workers share a CPU
+bool attach_cpu_steering(int fd, const std::vector<int>& cpus) {
+#ifndef __linux__
+    (void)fd;
+    (void)cpus;
+    return false;
+#else
+    uint32_t n = (uint32_t)cpus.size();
+    for (uint32_t i = 0; i < n; ++i)
+        for (uint32_t k = 0; k < i; ++k)
+            if (cpus[i] == cpus[k]) return false;
 
+    std::vector<sock_filter> code;
+    code.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t)(SKF_AD_OFF + SKF_AD_CPU)));
+    for (uint32_t i = 0; i < n; ++i) {
+        code.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (uint32_t)cpus[i], 0, 1));
+        code.push_back(BPF_STMT(BPF_RET | BPF_K, i));
+    }
+    code.push_back(BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, n));
+    code.push_back(BPF_STMT(BPF_RET | BPF_A, 0));
 
-    if (bind(udp_fd, (sockaddr*)&serv, sizeof(serv)) < 0) {
-    perror("bind");
-    return 1;
+    sock_fprog prog{};
+    prog.len = (unsigned short)code.size();
+    prog.filter = code.data();
+    // one program for the whole reuseport group, attaching it to any member is enough
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+        perror("setsockopt SO_ATTACH_REUSEPORT_CBPF");
+        return false;
     }
+    return true;
+#endif
+}
+
+// The event loop for one socket, runs forever
+template <typename R>
+int run_reactor(R& reactor, int udp_fd, int batch_size, bool gso) {
+#ifdef __linux__
+    if (gso && !enable_gro(udp_fd)) return 1;
+#endif
+
     make_non_blocking(udp_fd);
-    
-// epfd is a file descriptor used to refer to this epoll set
-// Epoll will monitor one or more FDs for I/O events    
-    int epfd = epoll_create1(0);
+    lowlat_socket(udp_fd);
+    lowlat_reactor(reactor);
 
-    epoll_event ev{};
     // you want the event to be where theres
     // data available to read
-    ev.events = EPOLLIN;
-    // store servers fd in data.fd
-    ev.data.fd = udp_fd;
-    // add the fd to epolls RB tree
-    epoll_ctl(epfd, EPOLL_CTL_ADD, udp_fd, &ev);    
+    // (--edge: only when new data arrives, drain_and_echo empties the socket every time anyway)
+    if (!reactor.add(udp_fd, lowlat_interest(RX_IN))) return 1;
 
-    std::cout << "UDP server listening on port 8080 (epoll, non-blocking)...\n";
-    
-    epoll_event events[10];
-    char buf[1024];   
+    RxEvent events[10];
+    LoopStats& st = metrics_register_loop();
+    std::unique_ptr<PeerLimiter> limiter = peer_limit_create();
+    std::unique_ptr<KernelTs> kts = kts_create(st);
+#ifdef __linux__
+    if (kts && !kts_enable(udp_fd)) return 1;
+#endif
+    DatagramBatch batch;
+    if (!batch.init(batch_size, gso, kts != nullptr)) return 1;
 
     while (true) {
-    // epoll wait checks the ready queue, returns number of triggered FDs up to 10
-    // epoll_wait blocks indefinitely with timeout = -1 (-1 means block forever)
+    // wait checks the ready queue, returns number of triggered FDs up to 10
+    // it blocks indefinitely with timeout = -1 (-1 means block forever)
    // if return == -1, an error occurred (e.g. signal interrupted)
-    int n = epoll_wait(epfd, events, 10, -1);
+   // (with --spin it polls with timeout 0 for a while first, see common/low_latency.h)
+    int n = lowlat_wait(reactor, events, 10, -1, st);
 
     for (int i = 0; i < n; ++i) {
-        if (events[i].data.fd == udp_fd) {
-            sockaddr_in cli{};
-            socklen_t cli_len = sizeof(cli);
-            // recvfrom is nonblocking so will return -1 if not ready yet but epoll_wait() alr told us its ready 
-            ssize_t len = recvfrom(udp_fd, buf, sizeof(buf) - 1, 0, (sockaddr*)&cli, &cli_len);
-            if (len > 0) {
-                buf[len] = '\0';
-                std::cout << "Received from " << inet_ntoa(cli.sin_addr) << ":" << ntohs(cli.sin_port) << " → " << buf << "\n";
-                // echo back to client
-                sendto(udp_fd, buf, len, 0, (sockaddr*)&cli, cli_len);
-            }
+        if (events[i].fd == udp_fd) {
+#ifdef __linux__
+            // --timestamps: TX stamps wait on the socket's error queue, which shows up as an error event
+            if (kts && (events[i].events & RX_ERR)) kts->reap(udp_fd);
+#endif
+            // recvmmsg is nonblocking so will return -1 if not ready yet but the reactor alr told us its ready
+            drain_and_echo(udp_fd, batch, st, limiter.get(), kts.get());
         }
     }
     }
     close(udp_fd);
-    close(epfd);
-    
+    return 0;
+}
+
+int run_loop(int udp_fd, int batch_size, bool gso) {
+    return with_reactor(g_reactor.backend, [&](auto& reactor) { return run_reactor(reactor, udp_fd, batch_size, gso); });
+}
+
+int main(int argc, char** argv) {
+    // Usage: udp_epoll_server [--backend epoll|uring|kqueue] [--uring] [--batch N] [--gso] [--workers N] [--steer cpu|hash] [--stats PATH]
+    //                         [logging options] [low latency options, see common/low_latency.h]
+    //                         [--capture PATH] [--capture-mb N] (see common/capture.h)
+    //                         [--rate-limit PPS[:BURST]] [--peers N] (see common/peer_limiter.h)
+    //                         [--timestamps N] (see common/kernel_ts.h)
+    bool use_uring = false;
+    const char* stats_path = nullptr;
+    bool gso = false;
+    int batch_size = 32;
+    int workers = 1;
+    bool steer = true;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--uring") == 0) use_uring = true;
+        else if (strcmp(argv[i], "--gso") == 0) gso = true;
+        else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) batch_size = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) workers = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--steer") == 0 && i + 1 < argc && (strcmp(argv[i + 1], "cpu") == 0 || strcmp(argv[i + 1], "hash") == 0))
+            steer = strcmp(argv[++i], "cpu") == 0;
+        else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc) stats_path = argv[++i];
+        else if (reactor_parse_arg(argc, argv, i)) continue;
+        else if (log_parse_arg(argc, argv, i)) continue;
+        else if (lowlat_parse_arg(argc, argv, i)) continue;
+        else if (capture_parse_arg(argc, argv, i)) continue;
+        else if (peer_limit_parse_arg(argc, argv, i)) continue;
+        else if (kts_parse_arg(argc, argv, i)) continue;
+        else {
+            std::cerr << "Usage: " << argv[0] << " " REACTOR_USAGE " [--uring] [--batch N] [--gso] [--workers N] [--steer cpu|hash] [--stats PATH] "
+                      LOG_USAGE " " LOWLAT_USAGE " " CAPTURE_USAGE " " PEER_LIMIT_USAGE " " KTS_USAGE "\n";
+            return 1;
+        }
+    }
+    if (use_uring && g_kts.every) {
+        std::cerr << "--timestamps samples the reactor loop, not --uring\n";
+        return 1;
+    }
+#ifndef __linux__
+    if (use_uring || gso) {
+        std::cerr << "--uring and --gso are Linux only\n";
+        return 1;
+    }
+#endif
+    if (batch_size < 1) batch_size = 1;
+    if (batch_size > MAX_BATCH) batch_size = MAX_BATCH;
+    if (workers < 1) workers = 1;
+
+    // UDP sends never raise SIGPIPE, but the --stats socket is a stream one
+    signal(SIGPIPE, SIG_IGN);
+
+    // One socket per worker. A single worker keeps the plain socket (no reuseport group to join)
+    std::vector<int> socks;
+    for (int i = 0; i < workers; ++i) {
+        int fd = make_udp_socket(8080, workers > 1);
+        if (fd < 0) return 1;
+        socks.push_back(fd);
+    }
+
+    int ncpu = (int)std::thread::hardware_concurrency();
+    if (ncpu <= 0) ncpu = 1;
+    std::vector<int> cpus;
+    for (int i = 0; i < workers; ++i) cpus.push_back(lowlat_cpu(i, i % ncpu));
+    bool steered = workers > 1 && steer && attach_cpu_steering(socks[0], cpus);
+
+    if (use_uring) std::cout << "UDP server listening on port 8080 (io_uring, multishot recvmsg";
+    else std::cout << "UDP server listening on port 8080 (" << g_reactor.backend << ", non-blocking, batch " << batch_size
+                   << (gso ? ", GSO/GRO" : "") << (g_lowlat.edge ? ", edge triggered" : "");
+    if (workers > 1) std::cout << ", " << workers << " workers, SO_REUSEPORT steered by " << (steered ? "cpu" : "hash");
+    if (!use_uring && g_lowlat.spin_us != 0) std::cout << ", spin " << (g_lowlat.spin_us < 0 ? "forever" : std::to_string(g_lowlat.spin_us) + " us");
+    if (!use_uring && g_lowlat.busy_poll_us > 0) std::cout << ", busy poll " << g_lowlat.busy_poll_us << " us";
+    if (g_peer_limit.rate > 0)
+        std::cout << ", rate limit " << g_peer_limit.rate << "/s per peer, burst "
+                  << (g_peer_limit.burst > 0 ? g_peer_limit.burst : g_peer_limit.rate) << ", " << g_peer_limit.peers << " peers";
+    if (g_kts.every) std::cout << ", kernel timestamps on 1 in " << g_kts.every << " datagrams";
+    std::cout << ")..." << std::endl;
+    if (workers > 1 && steer && !steered)
+        std::cerr << "two workers share a CPU (more workers than CPUs?), falling back to hash steering\n";
+
+    log_start();
+    if (stats_path && !metrics_serve(stats_path, "udp_echo")) return 1;
+    if (g_capture.path) {
+        if (!capture_open()) return 1;
+        std::cout << "capturing received datagrams to " << g_capture.path << std::endl;
+    }
+
+    if (workers == 1) {
+        // the loop is this thread; log writer and stats threads started above stay unpinned
+        if (!g_lowlat.cpus.empty()) lowlat_pin(g_lowlat.cpus[0]);
+#ifdef __linux__
+        if (use_uring) return run_uring(socks[0]);
+#endif
+        return run_loop(socks[0], batch_size, gso);
+    }
+
+    // Every worker is pinned, the cpu steering only means something if worker i stays on cpus[i]
+    std::vector<std::thread> threads;
+    for (int i = 0; i < workers; ++i) {
+        threads.emplace_back([&, i] {
+            lowlat_pin(cpus[i]);
+#ifdef __linux__
+            if (use_uring) { run_uring(socks[i]); return; }
+#endif
+            run_loop(socks[i], batch_size, gso);
+        });
+    }
+    for (auto& t : threads) t.join();
+    return 0;
 }
 // When a client sends a datagram, the kernel:
 
@@ -0,0 +1,126 @@
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <chrono>
+#include <vector>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+
+// Bulk UDP echo benchmark, used to compare udp_epoll_server with and without --gso.
+//
+// The client always sends bursts as GSO super-packets (one sendmsg per burst of `segs` datagrams)
+// and receives with UDP_GRO on, so it stays cheap no matter what the server does.
+// What changes between runs is the server:
+//   udp_epoll_server --quiet          -> the kernel splits each burst, server sees/sends `segs` datagrams
+//   udp_epoll_server --quiet --gso    -> server gets the burst as one GRO packet and echoes it with one GSO send
+//
+// Usage: udp_gso_bench [--size 1200] [--segs 40] [--window 8] [--seconds 5]
+
+int main(int argc, char** argv) {
+    int size = 1200;      // bytes per datagram
+    int segs = 40;        // datagrams per burst, size * segs has to stay under 64 KB
+    int window = 8;       // bursts in flight
+    int seconds = 5;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--size") == 0) size = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--segs") == 0) segs = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--window") == 0) window = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--seconds") == 0) seconds = atoi(argv[i + 1]);
+    }
+    if (size <= 0 || segs <= 0 || (long)size * segs > 65000) {
+        std::cerr << "size * segs must be in (0, 65000]\n";
+        return 1;
+    }
+
+    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockfd < 0) { perror("socket"); return 1; }
+
+    int on = 1;
+    if (setsockopt(sockfd, SOL_UDP, UDP_GRO, &on, sizeof(on)) < 0) perror("setsockopt UDP_GRO");
+    int bufsz = 8 << 20;
+    setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &bufsz, sizeof(bufsz));
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &bufsz, sizeof(bufsz));
+
+    sockaddr_in serv{};
+    serv.sin_family = AF_INET;
+    serv.sin_port = htons(8080);
+    inet_pton(AF_INET, "127.0.0.1", &serv.sin_addr);
+    // connect() on UDP just fixes the default destination, so send() needs no address
+    if (connect(sockfd, (sockaddr*)&serv, sizeof(serv)) < 0) { perror("connect"); return 1; }
+
+    size_t burst_bytes = (size_t)size * segs;
+    std::vector<char> out(burst_bytes, 'x');
+    std::vector<char> in(65536);
+
+    // UDP_SEGMENT cmsg: "cut this buffer into datagrams of `size` bytes"
+    char ctrl[CMSG_SPACE(sizeof(uint16_t))] = {};
+    iovec iov{out.data(), burst_bytes};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+    cmsghdr* c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_UDP;
+    c->cmsg_type = UDP_SEGMENT;
+    c->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    uint16_t gso_size = (uint16_t)size;
+    memcpy(CMSG_DATA(c), &gso_size, sizeof(gso_size));
+
+    using clock = std::chrono::steady_clock;
+    auto deadline = clock::now() + std::chrono::seconds(seconds);
+    auto start = clock::now();
+
+    int inflight = 0;
+    size_t partial = 0;        // bytes of the oldest burst that already came back
+    uint64_t bytes_back = 0;
+    uint64_t bursts_lost = 0;
+
+    while (clock::now() < deadline) {
+        while (inflight < window) {
+            if (sendmsg(sockfd, &msg, 0) < 0) {
+                if (errno == EINTR) continue;
+                perror("sendmsg");
+                return 1;
+            }
+            ++inflight;
+        }
+
+        pollfd pfd{sockfd, POLLIN, 0};
+        int pr = poll(&pfd, 1, 100);
+        if (pr == 0) {
+            // nothing for 100ms: whatever is in flight got dropped somewhere, start a fresh window
+            bursts_lost += inflight;
+            inflight = 0;
+            partial = 0;
+            continue;
+        }
+        if (pr < 0) continue;
+
+        while (true) {
+            ssize_t n = recv(sockfd, in.data(), in.size(), MSG_DONTWAIT);
+            if (n <= 0) break;
+            bytes_back += n;
+            partial += n;
+            while (partial >= burst_bytes && inflight > 0) {
+                partial -= burst_bytes;
+                --inflight;
+            }
+        }
+    }
+
+    double secs = std::chrono::duration<double>(clock::now() - start).count();
+    uint64_t dgrams = bytes_back / size;
+    std::cout << "payload " << size << " B, " << segs << " segs/burst, window " << window << "\n"
+              << "echoed " << dgrams << " datagrams in " << secs << " s: "
+              << dgrams / secs / 1e3 << " kpps, "
+              << bytes_back * 8 / secs / 1e9 << " Gbit/s, "
+              << bursts_lost << " bursts timed out\n";
+    close(sockfd);
+    return 0;
+}
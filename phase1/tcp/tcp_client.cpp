@@ -1,11 +1,29 @@
 #include <iostream>
 #include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <atomic>
+#include <chrono>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
 
-int main() {
+#include "../../common/hdr_histogram.h"
+#include "../../common/framing.h"
+#include "../../common/shm_ring.h"
+
+// Interactive mode: type a line, see it echoed
+int run_interactive() {
     // 1. Create TCP socket
     int sockfd = socket(AF_INET, SOCK_STREAM, 0);
     if (sockfd < 0) {
@@ -37,7 +55,7 @@ int main() {
 
     std::cout << "Connected to TCP echo server at 127.0.0.1:8080\n";
 
-    char buf[1024];
+    std::vector<char> buf(1024);
     std::string line;    
 
     // 4. Send-receive loop
@@ -50,16 +68,600 @@ int main() {
             break;
         }
 
-        ssize_t n = recv(sockfd, buf, sizeof(buf)-1, 0);
-        if (n <= 0) {
-            if (n < 0) perror("recv");
-            break;
+        // TCP doesnt keep message boundaries: a long line can come back in several pieces,
+        // so keep reading until the whole echo is here instead of trusting one recv()
+        if (buf.size() < line.size()) buf.resize(line.size());
+        size_t got = 0;
+        while (got < line.size()) {
+            ssize_t n = recv(sockfd, buf.data() + got, line.size() - got, 0);
+            if (n <= 0) {
+                if (n < 0) perror("recv");
+                break;
+            }
+            got += (size_t)n;
         }
+        if (got < line.size()) break;
 
-        buf[n] = '\0';
-        std::cout << "echoed: " << buf << "\n";
+        std::cout << "echoed: ";
+        std::cout.write(buf.data(), got) << "\n";
     }
     close(sockfd);
     return 0;
 
-}
\ No newline at end of file
+}
+
+// Interactive mode over shared memory (--shm PATH, server started with --shm PATH too).
+// Same loop, the rings are a byte stream just like the socket
+int run_interactive_shm(const char* path) {
+    ShmEndpoint ep;
+    if (!shm_connect(path, ep)) return 1;
+    std::cout << "Connected to echo server over shared memory (" << path << ")\n";
+
+    std::vector<char> buf(1024);
+    std::string line;
+    while (true) {
+        std::cout << "> ";
+        if (!std::getline(std::cin, line)) break;
+        if (!shm_send_all(ep, line.data(), line.size())) break;
+
+        if (buf.size() < line.size()) buf.resize(line.size());
+        size_t got = 0;
+        while (got < line.size()) {
+            size_t n = shm_recv(ep, buf.data() + got, line.size() - got);
+            if (n == 0) break;   // server gone
+            got += n;
+        }
+        if (got < line.size()) break;
+
+        std::cout << "echoed: ";
+        std::cout.write(buf.data(), got) << "\n";
+    }
+    shm_close(ep);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------------------
+// Load generator mode (--load)
+//
+// Every request is `size` bytes, the server echoes the same `size` bytes back.
+// TCP keeps bytes in order, so the k-th `size` bytes that come back ARE the answer to the k-th
+// request on that connection: each connection just keeps a FIFO of send times.
+//
+// Closed loop (default): every connection keeps `pipeline` requests outstanding and sends a new
+// one the moment one completes. Measures "how fast can the server go", but when the server stalls
+// we also stop sending, so the stall shows up as ONE slow sample instead of all the requests that
+// would have queued up behind it (coordinated omission). If --expected-us is given, slow samples
+// are back-filled HDR style (record_corrected).
+//
+// Framed (--framed): every request and response is a length-prefixed frame (common/framing.h),
+// for servers started with --framed. Responses are parsed frame by frame instead of counted in bytes.
+//
+// Open loop (--rate R): requests are scheduled at fixed intervals no matter how the server is doing.
+// Latency is measured from when the request SHOULD have been sent, so if the server (or a full
+// pipeline) makes us send late, that waiting time is counted too. This is the number to trust.
+//
+// Churn (--churn): short-lived connections instead. Every thread loops connect, send one request,
+// read the echo, close, as fast as it can; --conns is how many of those loops run at once. Latency
+// is the whole connect-to-close cycle, which is what accept backlog and fork/worker costs show up in.
+// ---------------------------------------------------------------------------------------
+
+struct LoadConfig {
+    std::string host = "127.0.0.1";
+    int port = 8080;
+    int conns = 64;
+    int threads = 4;
+    int size = 64;
+    int pipeline = 1;
+    double rate = 0;          // total requests/s over all connections, 0 = closed loop
+    int duration = 10;        // seconds
+    int64_t expected_ns = 0;  // closed loop CO correction interval
+    bool churn = false;       // one request per connection
+    bool framed = false;      // length-prefixed requests/responses
+    std::string shm;          // shared memory socket path instead of TCP
+    int spin_us = 0;          // --shm: poll the rings this long before sleeping
+};
+
+struct LoadConn {
+    int fd = -1;
+    bool connected = false;
+    std::deque<int64_t> starts;   // send (or intended send) time of every outstanding request
+    size_t to_send = 0;           // request bytes not written yet
+    uint64_t sent_total = 0;      // request bytes written so far, says where in the next request we are
+    size_t recv_partial = 0;      // bytes of the current response already received
+    FrameDecoder decoder;         // --framed
+    bool want_out = false;
+};
+
+struct ThreadResult {
+    HdrHistogram hist;
+    uint64_t completed = 0;
+    uint64_t errors = 0;
+};
+
+static int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void update_interest(int epfd, LoadConn& c) {
+    bool want = c.to_send > 0 || !c.connected;
+    if (want == c.want_out) return;
+    c.want_out = want;
+    epoll_event ev{};
+    ev.events = EPOLLIN | (want ? (uint32_t)EPOLLOUT : 0u);
+    ev.data.ptr = &c;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, c.fd, &ev);
+}
+
+// payload is pipeline + 1 requests back to back. A send() that stops in the middle of a request
+// must resume exactly there (with framing, restarting from a header would corrupt the stream),
+// so every send starts at sent_total's position inside one request
+static bool flush_conn(LoadConn& c, const std::vector<char>& payload, size_t req_bytes) {
+    while (c.to_send > 0) {
+        size_t offset = (size_t)(c.sent_total % req_bytes);
+        size_t chunk = payload.size() - offset;
+        if (chunk > c.to_send) chunk = c.to_send;
+        ssize_t n = send(c.fd, payload.data() + offset, chunk, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        c.to_send -= (size_t)n;
+        c.sent_total += (uint64_t)n;
+    }
+    return true;
+}
+
+static void load_thread(const LoadConfig& cfg, int nconns, double thread_rate,
+                        int64_t start_ns, int64_t end_ns, ThreadResult& res) {
+    int epfd = epoll_create1(0);
+    if (epfd < 0) { perror("epoll_create1"); return; }
+
+    sockaddr_in serv{};
+    serv.sin_family = AF_INET;
+    serv.sin_port = htons(cfg.port);
+    inet_pton(AF_INET, cfg.host.c_str(), &serv.sin_addr);
+
+    // big enough that a whole pipeline of requests goes out in one send(), from any starting point
+    size_t req_bytes = (size_t)cfg.size + (cfg.framed ? FRAME_HEADER : 0);
+    std::vector<char> payload(req_bytes * (cfg.pipeline + 1), 'x');
+    if (cfg.framed) {
+        for (size_t off = 0; off < payload.size(); off += req_bytes) frame_header((uint32_t)cfg.size, &payload[off]);
+    }
+    std::vector<char> rbuf(64 * 1024);
+
+    std::vector<LoadConn> conns(nconns);
+    for (auto& c : conns) {
+        c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (c.fd < 0) { perror("socket"); ++res.errors; continue; }
+        int one = 1;
+        // small requests must not sit in Nagle's buffer waiting for more data
+        setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (connect(c.fd, (sockaddr*)&serv, sizeof(serv)) < 0 && errno != EINPROGRESS) {
+            perror("connect");
+            close(c.fd);
+            c.fd = -1;
+            ++res.errors;
+            continue;
+        }
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLOUT;   // EPOLLOUT fires once the non-blocking connect finishes
+        ev.data.ptr = &c;
+        c.want_out = true;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, c.fd, &ev);
+    }
+
+    auto issue = [&](LoadConn& c, int64_t t) {
+        c.starts.push_back(t);
+        c.to_send += req_bytes;
+    };
+
+    auto drop = [&](LoadConn& c) {
+        ++res.errors;
+        epoll_ctl(epfd, EPOLL_CTL_DEL, c.fd, nullptr);
+        close(c.fd);
+        c.fd = -1;
+        c.connected = false;
+    };
+
+    // open loop bookkeeping: intended send times that could not be placed on a connection yet
+    bool open_loop = thread_rate > 0;
+    double interval_ns = open_loop ? 1e9 / thread_rate : 0;
+    uint64_t scheduled = 0;
+    std::deque<int64_t> backlog;
+    size_t rr = 0;
+
+    auto place_backlog = [&]() {
+        // round robin over connections that still have pipeline room
+        size_t tried = 0;
+        while (!backlog.empty() && tried < conns.size()) {
+            LoadConn& c = conns[rr];
+            rr = (rr + 1) % conns.size();
+            if (c.fd >= 0 && c.connected && c.starts.size() < (size_t)cfg.pipeline) {
+                issue(c, backlog.front());
+                backlog.pop_front();
+                tried = 0;
+                if (!flush_conn(c, payload, req_bytes)) { drop(c); continue; }
+                update_interest(epfd, c);
+            } else {
+                ++tried;
+            }
+        }
+    };
+
+    // the response to the oldest outstanding request on c is in
+    auto complete = [&](LoadConn& c, int64_t now) {
+        if (c.starts.empty()) return;
+        int64_t lat = now - c.starts.front();
+        c.starts.pop_front();
+        // only count what completes inside the measurement window
+        if (now >= start_ns) {
+            if (open_loop) res.hist.record(lat);
+            else res.hist.record_corrected(lat, cfg.expected_ns);
+            ++res.completed;
+        }
+        if (!open_loop) issue(c, now);
+    };
+
+    std::vector<epoll_event> events(256);
+    while (true) {
+        int64_t now = now_ns();
+        if (now >= end_ns) break;
+
+        int64_t wait_ns = end_ns - now;
+        if (open_loop) {
+            // queue every request whose intended time has come
+            while (start_ns + (int64_t)(scheduled * interval_ns) <= now) {
+                backlog.push_back(start_ns + (int64_t)(scheduled * interval_ns));
+                ++scheduled;
+            }
+            place_backlog();
+            int64_t next = start_ns + (int64_t)(scheduled * interval_ns) - now;
+            if (next < wait_ns) wait_ns = next;
+        }
+        timespec ts{wait_ns / 1000000000, wait_ns % 1000000000};
+        int n = epoll_pwait2(epfd, events.data(), (int)events.size(), &ts, nullptr);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_pwait2");
+            break;
+        }
+
+        now = now_ns();
+        for (int i = 0; i < n; ++i) {
+            LoadConn& c = *(LoadConn*)events[i].data.ptr;
+            if (c.fd < 0) continue;
+
+            if (!c.connected) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err != 0) { drop(c); continue; }
+                c.connected = true;
+                if (!open_loop) {
+                    for (int k = 0; k < cfg.pipeline; ++k) issue(c, now);
+                }
+            }
+
+            if (events[i].events & EPOLLIN) {
+                bool closed = false;
+                while (true) {
+                    ssize_t r = recv(c.fd, rbuf.data(), rbuf.size(), 0);
+                    if (r > 0) {
+                        if (cfg.framed) {
+                            bool ok = c.decoder.feed(rbuf.data(), (size_t)r, [&](const char*, size_t len) {
+                                if (len != (size_t)cfg.size) ++res.errors;
+                                complete(c, now);
+                            });
+                            if (!ok) { closed = true; break; }
+                        } else {
+                            c.recv_partial += (size_t)r;
+                            while (c.recv_partial >= (size_t)cfg.size && !c.starts.empty()) {
+                                c.recv_partial -= cfg.size;
+                                complete(c, now);
+                            }
+                        }
+                        if ((size_t)r < rbuf.size()) break;
+                    } else if (r == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                        closed = true;
+                        break;
+                    } else {
+                        break;
+                    }
+                }
+                if (closed) { drop(c); continue; }
+            }
+
+            if (!flush_conn(c, payload, req_bytes)) { drop(c); continue; }
+            update_interest(epfd, c);
+        }
+        if (open_loop) place_backlog();
+    }
+
+    // anything still scheduled but never sent is a request the server made us miss
+    if (open_loop) {
+        int64_t end = now_ns();
+        for (int64_t t : backlog) res.hist.record(end - t);
+    }
+
+    for (auto& c : conns) if (c.fd >= 0) close(c.fd);
+    close(epfd);
+}
+
+// One blocking connect/echo/close loop per thread, nothing to multiplex
+static void churn_thread(const LoadConfig& cfg, int64_t start_ns, int64_t end_ns, ThreadResult& res) {
+    sockaddr_in serv{};
+    serv.sin_family = AF_INET;
+    serv.sin_port = htons(cfg.port);
+    inet_pton(AF_INET, cfg.host.c_str(), &serv.sin_addr);
+
+    size_t req_bytes = (size_t)cfg.size + (cfg.framed ? FRAME_HEADER : 0);
+    std::vector<char> payload(req_bytes, 'x');
+    if (cfg.framed) frame_header((uint32_t)cfg.size, payload.data());
+    std::vector<char> rbuf(req_bytes);   // the echo is the same bytes, header and all
+
+    while (true) {
+        int64_t t0 = now_ns();
+        if (t0 >= end_ns) break;
+
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) { perror("socket"); ++res.errors; return; }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        bool ok = connect(fd, (sockaddr*)&serv, sizeof(serv)) == 0
+                  && send(fd, payload.data(), payload.size(), MSG_NOSIGNAL) == (ssize_t)payload.size();
+        size_t got = 0;
+        while (ok && got < rbuf.size()) {
+            ssize_t r = recv(fd, rbuf.data() + got, rbuf.size() - got, 0);
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) ok = false;
+            else got += (size_t)r;
+        }
+        close(fd);
+
+        int64_t t1 = now_ns();
+        if (!ok) {
+            ++res.errors;
+            continue;
+        }
+        if (t1 >= start_ns && t1 < end_ns) {
+            res.hist.record(t1 - t0);
+            ++res.completed;
+        }
+    }
+}
+
+// Closed loop over shared memory sessions (--shm). There are no sockets to wait on, so the thread
+// sweeps all its rings: push what fits, pop what came back. Only when a whole sweep finds nothing
+// to do (after --spin-us of that) does it tell the server it is going to sleep and wait on the
+// eventfds, which the server only writes to when it sees that flag
+struct ShmLoadConn {
+    ShmEndpoint ep;
+    std::deque<int64_t> starts;
+    size_t to_send = 0;
+    uint64_t sent_total = 0;
+    size_t recv_partial = 0;
+};
+
+static void shm_load_thread(const LoadConfig& cfg, int nconns, int64_t start_ns, int64_t end_ns, ThreadResult& res) {
+    int epfd = epoll_create1(0);
+    if (epfd < 0) { perror("epoll_create1"); return; }
+
+    // framed requests echo back byte for byte too, so counting bytes works for both
+    size_t req_bytes = (size_t)cfg.size + (cfg.framed ? FRAME_HEADER : 0);
+    // same layout as load_thread: a whole pipeline fits from any starting point inside one request
+    std::vector<char> payload(req_bytes * (cfg.pipeline + 1), 'x');
+    if (cfg.framed) {
+        for (size_t off = 0; off < payload.size(); off += req_bytes) frame_header((uint32_t)cfg.size, &payload[off]);
+    }
+    std::vector<char> rbuf(64 * 1024);
+
+    std::vector<ShmLoadConn> conns(nconns);
+    for (auto& c : conns) {
+        if (!shm_connect(cfg.shm.c_str(), c.ep)) { ++res.errors; continue; }
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.ptr = &c;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, c.ep.efd, &ev);
+        int64_t now = now_ns();
+        for (int k = 0; k < cfg.pipeline; ++k) c.starts.push_back(now);
+        c.to_send = req_bytes * cfg.pipeline;
+    }
+
+    std::vector<epoll_event> events(256);
+    int64_t idle_since = 0;
+    while (true) {
+        int64_t now = now_ns();
+        if (now >= end_ns) break;
+
+        bool progress = false;
+        for (auto& c : conns) {
+            if (!c.ep.region) continue;
+            if (c.to_send > 0) {
+                size_t off = (size_t)(c.sent_total % req_bytes);
+                size_t n = c.ep.tx.write(payload.data() + off, c.to_send);
+                if (n > 0) {
+                    c.to_send -= n;
+                    c.sent_total += n;
+                    c.ep.tx.wake_consumer();
+                    progress = true;
+                }
+            }
+            size_t r = c.ep.rx.read(rbuf.data(), rbuf.size());
+            if (r == 0) continue;
+            c.ep.rx.wake_producer();
+            progress = true;
+            c.recv_partial += r;
+            while (c.recv_partial >= req_bytes && !c.starts.empty()) {
+                c.recv_partial -= req_bytes;
+                int64_t lat = now - c.starts.front();
+                c.starts.pop_front();
+                if (now >= start_ns) {
+                    res.hist.record_corrected(lat, cfg.expected_ns);
+                    ++res.completed;
+                }
+                c.starts.push_back(now);
+                c.to_send += req_bytes;
+            }
+        }
+        if (progress) { idle_since = 0; continue; }
+        if (idle_since == 0) idle_since = now;
+        if (now - idle_since < (int64_t)cfg.spin_us * 1000) continue;
+
+        // about to sleep: every ring has to know, or its next message would not wake us
+        bool sleep = true;
+        for (auto& c : conns) {
+            if (!c.ep.region) continue;
+            if (!c.ep.rx.consumer_sleep()) sleep = false;
+            if (c.to_send > 0 && !c.ep.tx.producer_sleep()) sleep = false;
+        }
+        if (!sleep) continue;
+        int64_t wait_ns = end_ns - now;
+        timespec ts{wait_ns / 1000000000, wait_ns % 1000000000};
+        int n = epoll_pwait2(epfd, events.data(), (int)events.size(), &ts, nullptr);
+        for (int i = 0; i < n; ++i) shm_drain(((ShmLoadConn*)events[i].data.ptr)->ep.efd);
+        idle_since = 0;
+    }
+
+    for (auto& c : conns) shm_close(c.ep);
+    close(epfd);
+}
+
+static void print_usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [--load [options]]\n"
+              << "  no arguments      interactive mode\n"
+              << "  --host H          server address (127.0.0.1)\n"
+              << "  --port P          server port (8080)\n"
+              << "  --conns N         connections (64)\n"
+              << "  --threads T       client threads (4)\n"
+              << "  --size B          request/response payload in bytes (64)\n"
+              << "  --pipeline D      requests in flight per connection (1)\n"
+              << "  --rate R          open loop at R requests/s total (default: closed loop)\n"
+              << "  --duration S      seconds to measure (10)\n"
+              << "  --expected-us U   closed loop coordinated omission correction interval\n"
+              << "  --churn           new connection per request (connect, echo, close), --conns at once\n"
+              << "  --framed          length-prefixed requests (server needs --framed too)\n"
+              << "  --shm PATH        shared memory rings instead of TCP (server needs --shm PATH), closed loop\n"
+              << "  --spin-us U       --shm: poll the rings U us before sleeping (0)\n"
+              << "Interactive over shared memory: " << prog << " --shm PATH\n";
+}
+
+int run_churn(const LoadConfig& cfg) {
+    std::cout << "Churn: " << cfg.conns << " concurrent connect/echo/close loops, "
+              << cfg.size << " B payload, " << cfg.duration << " s against "
+              << cfg.host << ":" << cfg.port << "\n";
+
+    int64_t start_ns = now_ns() + 200 * 1000000LL;
+    int64_t end_ns = start_ns + (int64_t)cfg.duration * 1000000000LL;
+
+    std::vector<ThreadResult> results(cfg.conns);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < cfg.conns; ++t) {
+        threads.emplace_back(churn_thread, std::cref(cfg), start_ns, end_ns, std::ref(results[t]));
+    }
+    for (auto& th : threads) th.join();
+
+    HdrHistogram total;
+    uint64_t completed = 0, errors = 0;
+    for (auto& r : results) {
+        total.merge(r.hist);
+        completed += r.completed;
+        errors += r.errors;
+    }
+
+    std::cout << "connections: " << completed << " (" << completed / (double)cfg.duration
+              << " conn/s), errors " << errors << "\n";
+    std::cout << "connect..close (us): p50 " << total.percentile(50) / 1e3
+              << "  p99 " << total.percentile(99) / 1e3
+              << "  p99.9 " << total.percentile(99.9) / 1e3
+              << "  max " << total.max_value / 1e3
+              << "  mean " << total.mean() / 1e3 << "\n";
+    return errors > 0 && completed == 0 ? 1 : 0;
+}
+
+int run_load(const LoadConfig& cfg) {
+    int nthreads = cfg.threads < cfg.conns ? cfg.threads : cfg.conns;
+    if (nthreads < 1) nthreads = 1;
+
+    std::cout << "Load: " << cfg.conns << (cfg.shm.empty() ? " conns, " : " shm sessions, ") << nthreads << " threads, "
+              << cfg.size << " B payload" << (cfg.framed ? " (framed)" : "") << ", pipeline " << cfg.pipeline << ", "
+              << (cfg.rate > 0 ? "open loop @ " + std::to_string((long long)cfg.rate) + " req/s" : std::string("closed loop"))
+              << ", " << cfg.duration << " s against " << cfg.host << ":" << cfg.port << "\n";
+
+    // 200ms of slack so every thread has its connections up before the clock starts
+    int64_t start_ns = now_ns() + 200 * 1000000LL;
+    int64_t end_ns = start_ns + (int64_t)cfg.duration * 1000000000LL;
+
+    std::vector<ThreadResult> results(nthreads);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nthreads; ++t) {
+        int n = cfg.conns / nthreads + (t < cfg.conns % nthreads ? 1 : 0);
+        if (!cfg.shm.empty()) threads.emplace_back(shm_load_thread, std::cref(cfg), n, start_ns, end_ns, std::ref(results[t]));
+        else threads.emplace_back(load_thread, std::cref(cfg), n, cfg.rate / nthreads,
+                                  start_ns, end_ns, std::ref(results[t]));
+    }
+    for (auto& th : threads) th.join();
+
+    HdrHistogram total;
+    uint64_t completed = 0, errors = 0;
+    for (auto& r : results) {
+        total.merge(r.hist);
+        completed += r.completed;
+        errors += r.errors;
+    }
+
+    double secs = cfg.duration;
+    double rps = completed / secs;
+    std::cout << "requests: " << completed << " (" << rps << " req/s, "
+              << rps * cfg.size / 1e6 << " MB/s each way), errors " << errors << "\n";
+    std::cout << "latency (us): p50 " << total.percentile(50) / 1e3
+              << "  p99 " << total.percentile(99) / 1e3
+              << "  p99.9 " << total.percentile(99.9) / 1e3
+              << "  max " << total.max_value / 1e3
+              << "  mean " << total.mean() / 1e3 << "\n";
+    return errors > 0 && completed == 0 ? 1 : 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc == 1) return run_interactive();
+
+    LoadConfig cfg;
+    bool load = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        bool has_val = i + 1 < argc;
+        if (a == "--load") load = true;
+        else if (a == "--host" && has_val) cfg.host = argv[++i];
+        else if (a == "--port" && has_val) cfg.port = atoi(argv[++i]);
+        else if (a == "--conns" && has_val) cfg.conns = atoi(argv[++i]);
+        else if (a == "--threads" && has_val) cfg.threads = atoi(argv[++i]);
+        else if (a == "--size" && has_val) cfg.size = atoi(argv[++i]);
+        else if (a == "--pipeline" && has_val) cfg.pipeline = atoi(argv[++i]);
+        else if (a == "--rate" && has_val) cfg.rate = atof(argv[++i]);
+        else if (a == "--duration" && has_val) cfg.duration = atoi(argv[++i]);
+        else if (a == "--expected-us" && has_val) cfg.expected_ns = (int64_t)(atof(argv[++i]) * 1000);
+        else if (a == "--churn") cfg.churn = true;
+        else if (a == "--framed") cfg.framed = true;
+        else if (a == "--shm" && has_val) cfg.shm = argv[++i];
+        else if (a == "--spin-us" && has_val) cfg.spin_us = atoi(argv[++i]);
+        else { print_usage(argv[0]); return 1; }
+    }
+    if (!load && !cfg.shm.empty()) return run_interactive_shm(cfg.shm.c_str());
+    if (!cfg.shm.empty() && (cfg.rate > 0 || cfg.churn)) {
+        std::cerr << "--shm only does the closed loop\n";
+        return 1;
+    }
+    if (!load || cfg.conns < 1 || cfg.size < 1 || cfg.pipeline < 1 || cfg.duration < 1) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    // --conns 10000 needs 10k fds, the default soft limit is usually 1024
+    rlimit rl{};
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    return cfg.churn ? run_churn(cfg) : run_load(cfg);
+}
@@ -1,38 +1,108 @@
 #include <iostream>
 #include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <thread>
 #include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <signal.h>
+#include "../../common/async_log.h"
+#include "../../common/buffer_pool.h"
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
 
+// Three ways to run the same blocking echo loop:
+//   --mode fork      fork() a child for every accepted client (the original, default)
+//   --mode prefork   fork N workers up front, every worker blocks in accept() on the shared listener
+//   --mode threads   N threads up front, every thread blocks in accept() on the shared listener
+// With fork-per-client, every short connection pays for a fork (copying page tables), an exit and a
+// reap. The pools pay that once at startup: the kernel wakes one blocked accept() per incoming
+// connection, so the listener itself is the work queue and no extra locking is needed.
+// A pool of N serves at most N clients AT ONCE (each worker is busy until its client leaves),
+// the rest wait in the listen backlog.
+
+// --idle-timeout S / --write-timeout S (0 = off). A blocking server needs no timer for these:
+// SO_RCVTIMEO makes recv() give up with EAGAIN after S seconds without data, and SO_SNDTIMEO does
+// the same for a send() the client doesnt make room for. Either way the worker drops the client,
+// which matters most for the pools, where a silent client occupies a whole worker.
+static double idle_timeout = 0;
+static double write_timeout = 0;
+
+void set_timeout(int fd, int opt, double secs) {
+    if (secs <= 0) return;
+    timeval tv;
+    tv.tv_sec = (time_t)secs;
+    tv.tv_usec = (suseconds_t)((secs - (double)tv.tv_sec) * 1e6);
+    setsockopt(fd, SOL_SOCKET, opt, &tv, sizeof(tv));
+}
+
+// Receive buffers of this worker (thread or process). The payload is binary and echoed by length,
+// so nothing is NUL-terminated and the buffer is used to its last byte
+static thread_local BufferPool read_pool;
+
+// Serves one client until it disconnects, then closes the fd
 void handle_client(int client_fd, sockaddr_in cli) {
-    char buf[1024];
-    std::cout << "Child process handling client "
-              << inet_ntoa(cli.sin_addr) << ":" << ntohs(cli.sin_port) << "\n";
+    // Starts at 2 KB and follows the client's traffic up to 64 KB (see ReadSizer), so an idle
+    // worker doesnt sit on a big buffer and a bulk client isnt read 1 KB per syscall
+    ReadSizer sizer;
+    BufChunk* buf = read_pool.get(sizer.size());
+    // logging only copies a record into this thread's ring, the background writer formats it
+    log_accept(client_fd, cli);
+    // echoes go out in read-sized pieces, the last one must not sit in Nagle's buffer waiting for
+    // an ACK the client delays (~40ms) until it sees that very echo
+    int one = 1;
+    setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    set_timeout(client_fd, SO_RCVTIMEO, idle_timeout);
+    set_timeout(client_fd, SO_SNDTIMEO, write_timeout);
 
     while (true) {
-        ssize_t n = recv(client_fd, buf, sizeof(buf) - 1, 0);
+        ssize_t n = recv(client_fd, buf->data(), buf->cap, 0);
         if (n <= 0) {
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;   // idle timeout
             if (n < 0) perror("recv");
             break; // client disconnected or error
         }
 
-        buf[n] = '\0';
-        std::cout << "Received from " << inet_ntoa(cli.sin_addr) << ": " << buf << "\n";
+        log_recv(client_fd, &cli, buf->data(), n);
 
-        if (send(client_fd, buf, n, 0) < 0) {
-            perror("send");
+        if (send(client_fd, buf->data(), n, MSG_NOSIGNAL) < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("send");   // else: write timeout
             break;
         }
+        if (sizer.update((size_t)n)) {
+            read_pool.put(buf);
+            buf = read_pool.get(sizer.size());
+        }
     }
+    read_pool.put(buf);
 
-    std::cout << "Client disconnected.\n";
+    log_close(client_fd);
     close(client_fd);
-    exit(0); // only child exits
 }
 
-int main() {
+// Body of every pool worker (process or thread): take the next connection, serve it, repeat
+void accept_loop(int server_fd) {
+    while (true) {
+        sockaddr_in cli{};
+        socklen_t cli_len = sizeof(cli);
+        int client_fd = accept(server_fd, (sockaddr*)&cli, &cli_len);
+        if (client_fd < 0) {
+            if (errno != EINTR) perror("accept");
+            continue;
+        }
+        handle_client(client_fd, cli);
+    }
+}
+
+void run_fork_per_client(int server_fd) {
 // Ignore SIGCHLD to auto-clean zombie processes.
 // Normally, the parent is expected to call wait() to clean up each child,
 // but since we may fork many children (one per client),
@@ -42,6 +112,104 @@ int main() {
 // This prevents zombie processes from accumulating in the process table.
     signal(SIGCHLD, SIG_IGN);
 
+    while (true) {
+        
+        // Prepare a struct to receive the client's address when a new connection comes in.
+        sockaddr_in cli{};
+        socklen_t cli_len = sizeof(cli);
+        
+        // blocking call: waits for an incoming connection
+        // cli is filled w client's IP + port
+        // new fd is returned (just a way to enter kenrnel place)
+        int client_fd = accept(server_fd, (sockaddr*)&cli, &cli_len);
+
+        if (client_fd < 0) {
+            perror("accept");
+            continue;
+        }
+        
+        // if pid == 0, we are child
+        // if pid > 0, we r parent
+        // if pid < 0, error
+        pid_t pid = fork();
+
+        if (pid == 0) {
+        // Child process
+        close(server_fd); // child doesn't need listener
+        log_after_fork();
+        handle_client(client_fd, cli);
+        log_stop(); // flush this child's log lines before going away
+        exit(0); // only child exits
+        }
+        else if (pid > 0) {
+        // Parent process
+        close(client_fd); // parent doesn't use this client FD
+        }
+        else {
+        perror("fork");
+        close(client_fd);
+        }
+    }
+}
+
+pid_t spawn_worker(int server_fd) {
+    pid_t pid = fork();
+    if (pid == 0) {
+#ifdef __linux__
+        // take the worker down with the parent, or a killed server leaves its pool still accepting
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        if (getppid() == 1) exit(0);
+#endif
+        log_after_fork();
+        accept_loop(server_fd);
+        exit(0);
+    }
+    if (pid < 0) perror("fork");
+    return pid;
+}
+
+void run_prefork(int server_fd, int workers) {
+    // here we DO want SIGCHLD delivered normally: the parent reaps with wait() to notice dead workers
+    for (int i = 0; i < workers; ++i) spawn_worker(server_fd);
+
+    // The parent only supervises: if a worker dies (crash, kill), start a replacement
+    while (true) {
+        int status = 0;
+        pid_t dead = wait(&status);
+        if (dead < 0) {
+            if (errno == EINTR) continue;
+            perror("wait");
+            return;
+        }
+        std::cerr << "worker " << dead << " exited, respawning\n";
+        spawn_worker(server_fd);
+    }
+}
+
+void run_thread_pool(int server_fd, int workers) {
+    std::vector<std::thread> pool;
+    for (int i = 0; i < workers; ++i) pool.emplace_back(accept_loop, server_fd);
+    for (auto& t : pool) t.join();
+}
+
+int main(int argc, char** argv) {
+    // Usage: tcp_multi_server [--mode fork|prefork|threads] [--workers N] [--idle-timeout S] [--write-timeout S]
+    //                         [logging options]
+    std::string mode = "fork";
+    int workers = (int)std::thread::hardware_concurrency() * 4;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--mode") == 0 && i + 1 < argc) mode = argv[++i];
+        else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) workers = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--idle-timeout") == 0 && i + 1 < argc) idle_timeout = atof(argv[++i]);
+        else if (strcmp(argv[i], "--write-timeout") == 0 && i + 1 < argc) write_timeout = atof(argv[++i]);
+        else if (log_parse_arg(argc, argv, i)) continue;
+        else { std::cerr << "Usage: " << argv[0] << " [--mode fork|prefork|threads] [--workers N] [--idle-timeout S] [--write-timeout S] " LOG_USAGE "\n"; return 1; }
+    }
+    if ((mode != "fork" && mode != "prefork" && mode != "threads") || workers < 1) {
+        std::cerr << "Usage: " << argv[0] << " [--mode fork|prefork|threads] [--workers N] [--idle-timeout S] [--write-timeout S] " LOG_USAGE "\n";
+        return 1;
+    }
+
     // Create a socket w default TCP (0)
     // FD is my local handle to the server's listening socket in the kernel
     int server_fd = socket(AF_INET, SOCK_STREAM, 0);
@@ -77,52 +245,23 @@ int main() {
     perror("bind"); close(server_fd); return 1;
     }
     
-    // 5 is backlog: queue up to 5 unaccepted incoming connections
-    // before rejecting new ones
-    if (listen(server_fd, 5) < 0) {
+    // backlog: how many finished handshakes may wait for accept(). 5 overflows as soon as clients
+    // connect faster than we accept (new SYNs get dropped and retried after a 1s timeout).
+    // SOMAXCONN asks for the max, the kernel still caps it at net.core.somaxconn.
+    if (listen(server_fd, SOMAXCONN) < 0) {
     perror("listen"); close(server_fd); return 1;
     }
 
-    std::cout << "TCP multi-client echo server listening on port 8080...\n";
-    
-
-    while (true) {
-        
-        // Prepare a struct to receive the client's address when a new connection comes in.
-        sockaddr_in cli{};
-        socklen_t cli_len = sizeof(cli);
-        
-        // blocking call: waits for an incoming connection
-        // cli is filled w client's IP + port
-        // new fd is returned (just a way to enter kenrnel place)
-        int client_fd = accept(server_fd, (sockaddr*)&cli, &cli_len);
+    std::cout << "TCP multi-client echo server listening on port 8080 (" << mode;
+    if (mode != "fork") std::cout << ", " << workers << " workers";
+    // flush before forking, or every child inherits (and later prints) a copy of the buffered output
+    std::cout << ")..." << std::endl;
+    log_start();
 
-        if (client_fd < 0) {
-            perror("accept");
-            continue;
-        }
-        
-        // if pid == 0, we are child
-        // if pid > 0, we r parent
-        // if pid < 0, error
-        pid_t pid = fork();
+    if (mode == "prefork") run_prefork(server_fd, workers);
+    else if (mode == "threads") run_thread_pool(server_fd, workers);
+    else run_fork_per_client(server_fd);
 
-        if (pid == 0) {
-        // Child process
-        close(server_fd); // child doesn't need listener
-        handle_client(client_fd, cli);
-        }
-        else if (pid > 0) {
-        // Parent process
-        close(client_fd); // parent doesn't use this client FD
-        }
-        else {
-        perror("fork");
-        close(client_fd);
-        }
-    }
     close(server_fd);
     return 0;
 }
-
-
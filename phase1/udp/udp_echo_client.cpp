@@ -3,9 +3,19 @@
 #include <sys/socket.h>    // socket(), sendto(), recvfrom()
 #include <arpa/inet.h>     // sockaddr_in, inet_pton(), htons(), ntohs()
 #include <unistd.h>        // close()
+#include <cstdlib>         // atoi(), atof()
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <sys/epoll.h>     // epoll for the load generator
 
+#include "../../common/hdr_histogram.h"
 
-int main() {
+
+// Interactive mode: type a line, get it echoed
+int run_interactive() {
     // 1) Create the UDP socket (client) 
     // 0 means default datagram protocol, UDP
     int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
@@ -30,9 +40,14 @@ int main() {
     // size of the server address, needed by sendto()
     socklen_t serv_len = sizeof(serv);    
 
+    // UDP gives no delivery guarantee: if either the request or the echo is lost,
+    // a plain recvfrom() would block forever. Give up on a reply after 2 seconds instead.
+    timeval tv{};
+    tv.tv_sec = 2;
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
     // 3) send → receive loop
     while (true) {
-        char buf[1024];
         // a) read a line from stdin
         std::cout << "> ";
         std::string line;
@@ -52,17 +67,25 @@ int main() {
             perror("sendto");
             continue;                  // try again on next iteration
         }
-        // c) wait for the echo reply
-        ssize_t n = recvfrom(sockfd,
-                             buf, sizeof(buf)-1,
-                             0,
-                             nullptr, nullptr);
+        // c) wait for the echo reply. MSG_PEEK|MSG_TRUNC returns its size without taking it off the queue,
+        // so the buffer can fit it: recvfrom() throws away whatever part of a datagram doesnt fit
+        ssize_t n = recv(sockfd, nullptr, 0, MSG_PEEK | MSG_TRUNC);
+        std::vector<char> buf(n > 0 ? (size_t)n : 1);
+        if (n >= 0) {
+            n = recvfrom(sockfd,
+                         buf.data(), buf.size(),
+                         0,
+                         nullptr, nullptr);
+        }
         if (n < 0) {
-            perror("recvfrom");
+            if (errno == EAGAIN || errno == EWOULDBLOCK) std::cout << "(no reply, datagram lost?)\n";
+            else perror("recvfrom");
             continue;
         }
-        buf[n] = '\0';                  // NUL-terminate
-        std::cout << "from server: " << buf << "\n";
+        // the reply is n bytes, not a C-string: print exactly those, no NUL needed
+        std::cout << "from server: ";
+        std::cout.write(buf.data(), n);
+        std::cout << "\n";
 
     }
     // after user pressed ctrl D
@@ -71,3 +94,251 @@ int main() {
     return 0;
 }
 
+// ---------------------------------------------------------------------------------------
+// Load generator mode (--load)
+//
+// Every datagram starts with a small header: which socket sent it, its sequence number on that
+// socket and the time it was SUPPOSED to be sent. The server echoes the bytes back untouched, so
+// when the echo arrives we know everything from the datagram itself:
+//   - RTT = now - intended send time (measured from the schedule, so falling behind is counted)
+//   - loss = sent - received once we stop sending and give stragglers a moment to arrive
+//   - reorder = a sequence number lower than one we already saw on that socket
+// Sends are paced to --rate datagrams/s and go out with sendmmsg in batches of --batch,
+// so the client burns one syscall per batch and is not the bottleneck.
+// ---------------------------------------------------------------------------------------
+
+struct DgramHeader {
+    uint32_t sock_id;
+    uint32_t pad;
+    uint64_t seq;
+    int64_t intended_ns;
+};
+
+static const int64_t WARMUP_NS = 200 * 1000000LL;
+
+struct UdpLoadConfig {
+    std::string host = "127.0.0.1";
+    int port = 8080;
+    int sockets = 8;
+    int threads = 2;
+    int size = 64;
+    double rate = 100000;   // datagrams/s over all sockets
+    int duration = 10;
+    int batch = 32;
+};
+
+struct UdpSock {
+    int fd = -1;
+    uint64_t next_seq = 0;
+    uint64_t highest_rx = 0;
+    bool any_rx = false;
+};
+
+struct UdpThreadResult {
+    HdrHistogram hist;
+    uint64_t sent = 0;
+    uint64_t received = 0;
+    uint64_t reordered = 0;
+    uint64_t send_errors = 0;
+};
+
+static int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void udp_load_thread(const UdpLoadConfig& cfg, int first_sock, int nsocks, double rate,
+                            int64_t start_ns, int64_t end_ns, UdpThreadResult& res) {
+    sockaddr_in serv{};
+    serv.sin_family = AF_INET;
+    serv.sin_port = htons(cfg.port);
+    inet_pton(AF_INET, cfg.host.c_str(), &serv.sin_addr);
+
+    int epfd = epoll_create1(0);
+    std::vector<UdpSock> socks(nsocks);
+    for (int i = 0; i < nsocks; ++i) {
+        int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        if (fd < 0) { perror("socket"); return; }
+        int bufsz = 4 << 20;
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufsz, sizeof(bufsz));
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bufsz, sizeof(bufsz));
+        // connected UDP: no address per sendmmsg entry, and only the server's replies get through
+        if (connect(fd, (sockaddr*)&serv, sizeof(serv)) < 0) { perror("connect"); return; }
+        socks[i].fd = fd;
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.u32 = (uint32_t)i;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    }
+
+    // reusable send + receive slots
+    int k = cfg.batch;
+    std::vector<char> sbuf((size_t)k * cfg.size, 'u');
+    std::vector<char> rbuf((size_t)k * 2048);
+    std::vector<iovec> siov(k), riov(k);
+    std::vector<mmsghdr> smsg(k), rmsg(k);
+    for (int i = 0; i < k; ++i) {
+        siov[i] = {&sbuf[(size_t)i * cfg.size], (size_t)cfg.size};
+        smsg[i].msg_hdr.msg_iov = &siov[i];
+        smsg[i].msg_hdr.msg_iovlen = 1;
+        riov[i] = {&rbuf[(size_t)i * 2048], 2048};
+        rmsg[i].msg_hdr.msg_iov = &riov[i];
+        rmsg[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    double interval_ns = 1e9 / rate;
+    int64_t send_start = start_ns - WARMUP_NS;   // sending starts with the warmup, recording at start_ns
+    uint64_t scheduled = 0;
+    size_t rr = 0;
+    // after the last send, wait this long for stragglers before counting them as lost
+    int64_t drain_until = end_ns + WARMUP_NS;
+
+    auto receive = [&](UdpSock& s) {
+        while (true) {
+            int n = recvmmsg(s.fd, rmsg.data(), k, MSG_DONTWAIT, nullptr);
+            if (n <= 0) return;   // EAGAIN, or ECONNREFUSED when nothing listens on the port
+            int64_t now = now_ns();
+            for (int i = 0; i < n; ++i) {
+                if (rmsg[i].msg_len < sizeof(DgramHeader)) continue;
+                DgramHeader h;
+                memcpy(&h, riov[i].iov_base, sizeof(h));
+                ++res.received;
+                if (s.any_rx && h.seq < s.highest_rx) ++res.reordered;
+                if (!s.any_rx || h.seq > s.highest_rx) s.highest_rx = h.seq;
+                s.any_rx = true;
+                if (h.intended_ns >= start_ns) res.hist.record(now - h.intended_ns);
+            }
+            if (n < k) return;
+        }
+    };
+
+    std::vector<epoll_event> events(64);
+    while (true) {
+        int64_t now = now_ns();
+        if (now >= drain_until) break;
+
+        if (now < end_ns) {
+            // everything due by now goes out, batch by batch, rotating over the sockets
+            uint64_t due = now >= send_start ? (uint64_t)((now - send_start) / interval_ns) + 1 : 0;
+            while (scheduled < due) {
+                UdpSock& s = socks[rr];
+                rr = (rr + 1) % socks.size();
+                int cnt = (int)std::min<uint64_t>(due - scheduled, (uint64_t)k);
+                for (int i = 0; i < cnt; ++i) {
+                    DgramHeader h{};
+                    h.sock_id = (uint32_t)(first_sock + (int)(&s - socks.data()));
+                    h.seq = s.next_seq + i;
+                    h.intended_ns = send_start + (int64_t)((scheduled + i) * interval_ns);
+                    memcpy(siov[i].iov_base, &h, sizeof(h));
+                }
+                int done = 0;
+                while (done < cnt) {
+                    int r = sendmmsg(s.fd, smsg.data() + done, cnt - done, 0);
+                    if (r <= 0) {
+                        if (r < 0 && errno == EINTR) continue;
+                        // socket buffer full or server port closed: count them as sent-and-lost
+                        res.send_errors += cnt - done;
+                        break;
+                    }
+                    done += r;
+                }
+                s.next_seq += cnt;
+                scheduled += cnt;
+                res.sent += cnt;
+            }
+        }
+
+        int64_t next = now < end_ns ? send_start + (int64_t)(scheduled * interval_ns) - now_ns()
+                                    : drain_until - now_ns();
+        if (next < 0) next = 0;
+        timespec ts{next / 1000000000, next % 1000000000};
+        int n = epoll_pwait2(epfd, events.data(), (int)events.size(), &ts, nullptr);
+        for (int i = 0; i < n; ++i) receive(socks[events[i].data.u32]);
+    }
+
+    for (auto& s : socks) close(s.fd);
+    close(epfd);
+}
+
+static void print_usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [--load [options]]\n"
+              << "  no arguments      interactive mode\n"
+              << "  --host H          server address (127.0.0.1)\n"
+              << "  --port P          server port (8080)\n"
+              << "  --sockets N       UDP sockets (8)\n"
+              << "  --threads T       client threads (2)\n"
+              << "  --size B          datagram size, min " << sizeof(DgramHeader) << " (64)\n"
+              << "  --rate R          datagrams/s over all sockets (100000)\n"
+              << "  --duration S      seconds to send (10)\n"
+              << "  --batch K         datagrams per sendmmsg (32)\n";
+}
+
+int run_load(const UdpLoadConfig& cfg) {
+    int nthreads = std::min(cfg.threads, cfg.sockets);
+    std::cout << "UDP load: " << cfg.sockets << " sockets, " << nthreads << " threads, " << cfg.size
+              << " B, " << (long long)cfg.rate << " pps target, batch " << cfg.batch << ", "
+              << cfg.duration << " s against " << cfg.host << ":" << cfg.port << "\n";
+
+    // the first 200ms are warmup: sent, but their RTTs are not recorded
+    int64_t start_ns = now_ns() + WARMUP_NS;
+    int64_t end_ns = start_ns + (int64_t)cfg.duration * 1000000000LL;
+
+    std::vector<UdpThreadResult> results(nthreads);
+    std::vector<std::thread> threads;
+    int first = 0;
+    for (int t = 0; t < nthreads; ++t) {
+        int n = cfg.sockets / nthreads + (t < cfg.sockets % nthreads ? 1 : 0);
+        threads.emplace_back(udp_load_thread, std::cref(cfg), first, n, cfg.rate / nthreads,
+                             start_ns, end_ns, std::ref(results[t]));
+        first += n;
+    }
+    for (auto& th : threads) th.join();
+
+    HdrHistogram total;
+    uint64_t sent = 0, received = 0, reordered = 0, send_errors = 0;
+    for (auto& r : results) {
+        total.merge(r.hist);
+        sent += r.sent;
+        received += r.received;
+        reordered += r.reordered;
+        send_errors += r.send_errors;
+    }
+    double secs = cfg.duration + WARMUP_NS / 1e9;
+    uint64_t lost = sent > received ? sent - received : 0;
+    std::cout << "sent " << sent << " (" << sent / secs << " pps), received " << received
+              << " (" << received / secs << " pps), send errors " << send_errors << "\n";
+    std::cout << "loss " << (sent ? 100.0 * lost / sent : 0) << "% (" << lost << "), reordered "
+              << reordered << "\n";
+    std::cout << "rtt (us): p50 " << total.percentile(50) / 1e3
+              << "  p99 " << total.percentile(99) / 1e3
+              << "  p99.9 " << total.percentile(99.9) / 1e3
+              << "  max " << total.max_value / 1e3 << "\n";
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc == 1) return run_interactive();
+
+    UdpLoadConfig cfg;
+    bool load = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        bool has_val = i + 1 < argc;
+        if (a == "--load") load = true;
+        else if (a == "--host" && has_val) cfg.host = argv[++i];
+        else if (a == "--port" && has_val) cfg.port = atoi(argv[++i]);
+        else if (a == "--sockets" && has_val) cfg.sockets = atoi(argv[++i]);
+        else if (a == "--threads" && has_val) cfg.threads = atoi(argv[++i]);
+        else if (a == "--size" && has_val) cfg.size = atoi(argv[++i]);
+        else if (a == "--rate" && has_val) cfg.rate = atof(argv[++i]);
+        else if (a == "--duration" && has_val) cfg.duration = atoi(argv[++i]);
+        else if (a == "--batch" && has_val) cfg.batch = atoi(argv[++i]);
+        else { print_usage(argv[0]); return 1; }
+    }
+    if (!load || cfg.sockets < 1 || cfg.threads < 1 || cfg.rate <= 0 || cfg.duration < 1 ||
+        cfg.batch < 1 || cfg.batch > 1024 || cfg.size < (int)sizeof(DgramHeader) || cfg.size > 2048) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    return run_load(cfg);
+}
@@ -5,10 +5,19 @@
 #include <unistd.h>       // close()
 #include <cstdlib>        // exit(), EXIT_FAILURE
 #include <arpa/inet.h>
+#include "../../common/async_log.h"
+#include "../../common/buffer_pool.h"
 
 
 
-int main() {
+int main(int argc, char** argv) {
+    // Usage: udp_echo_server [--log-level off|error|info|debug] [--log-sample N] [--quiet]
+    for (int i = 1; i < argc; ++i) {
+        if (!log_parse_arg(argc, argv, i)) {
+            std::cerr << "Usage: " << argv[0] << " " LOG_USAGE "\n";
+            return 1;
+        }
+    }
 
     //create the socket
     // Address family here is the internet, others include AF_INET6 for IPV6, or AF_UNIX for local IPC
@@ -62,25 +71,28 @@ int main() {
         exit(EXIT_FAILURE);
     }
 
-    std::cout << "Server listening on port 8080\n";
+    std::cout << "Server listening on port 8080\n" << std::flush;
+    log_start();
 
 
-    // 1023 bytes + NULL TERMINATOR
-// 3. Isn’t char buf[1024] only for characters?
+// 3. Isn’t a char buffer only for characters?
 // In C/C++, char is just the smallest addressable byte type. A char[] is really a byte‐array, and sockets deal in raw bytes.
 // Whether you send ASCII text, integers, images, or serialized objects, it all ends up as a stream of bytes. You can reinterpret those bytes however you like
 
 
-// Why do we reserve one byte for a NUL terminator in buf?
-// you’re treating buf as a C-string for printing. C-string functions (printf("%s"), std::cout << buf, strlen(), etc.) expect a trailing '\0' to know where the text ends. If you omitted that:
-
-// Printing routines would keep reading past your data into whatever garbage follows in memory → undefined behavior (often junk output or a crash).
+// Why is there no NUL terminator?
+// This used to be char buf[1024], read with sizeof(buf)-1 so a '\0' could go after the data for printing it as a C-string.
+// But the payload is binary: it can contain zero bytes itself, and the logger and sendto() both work off the byte count n anyway.
+// Worse, recvfrom() on a UDP socket DISCARDS whatever part of a datagram doesnt fit the buffer, so every datagram over 1023 bytes
+// was silently cut short (a datagram can be up to 65507 bytes).
 
-// Substring or length-based logic would break, since there’s no marker for the end of “the string.”
+// So now every datagram gets a buffer that fits it: MSG_PEEK|MSG_TRUNC asks the kernel how big the next datagram is
+// without taking it off the queue (MSG_TRUNC makes it return the real length, not what fit in our 0 byte buffer),
+// and the buffer comes from the pool's size classes (512 B .. 64 KB), so a 100 byte datagram doesnt need a 64 KB buffer.
+// The price is one extra syscall per datagram, which this server already spends one blocking recvfrom on anyway
+// (udp_epoll_server avoids both, see its batch buffers)
 
-// If you were only sending/receiving pure binary data (e.g. packed integers), you wouldn’t need a terminator—you’d work off the returned byte-count (n) instead of relying on '\0'
-
-    char buf[1024];
+    BufferPool pool;
     sockaddr_in cli{};
 // cli_len tells the kernel how big your address buffer (cli) is so it won’t overrun it when writing the peer’s socket address
 // Before the call: you’re saying “I have room for sizeof(cli) bytes of address data—please don’t write more than that.”
@@ -106,19 +118,24 @@ int main() {
 // By contrast, TCP is like having a dedicated private line or slot in a multi-box cabinet for each friend. When Alice calls (or connects), you get a dedicated handset (a new FD) you use for all your back-and-forth. Bob gets another handset. You keep track of each handset separately
 
     while (true) {
-        // recvfrom is a blocking call, blocks until server receives a datagram. it then copies the first 1023 (or less) bytes received into the buffer, and the
+        // blocks until a datagram is queued, then returns its full size (0 byte datagrams are legal too)
+        ssize_t want = recv(sockfd, nullptr, 0, MSG_PEEK | MSG_TRUNC);
+        if (want < 0) { perror("recv MSG_PEEK"); continue; }
+        BufChunk* buf = pool.get((size_t)want);
+
+        // recvfrom takes the datagram off the queue, copies it into the buffer (it fits now), and fills in
         // cli and cli_len as well
         // returns the number of bytes received
-        ssize_t n = recvfrom(sockfd, buf, sizeof(buf)-1, 0, reinterpret_cast<sockaddr*>(&cli), &cli_len);
-        if (n < 0) { perror("recvfrom"); continue; }
-        buf[n] = '\0';
-        std::cout << "From " 
-                  << inet_ntoa(cli.sin_addr) << ":" << ntohs(cli.sin_port)
-                  << " → " << buf << "\n";
-        // inet_ntoa converts binary ip to human readable string
-        if (sendto(sockfd, buf, n, 0, (sockaddr*)&cli, cli_len) < 0) {
+        cli_len = sizeof(cli);
+        ssize_t n = recvfrom(sockfd, buf->data(), buf->cap, 0, reinterpret_cast<sockaddr*>(&cli), &cli_len);
+        if (n < 0) { perror("recvfrom"); pool.put(buf); continue; }
+        // Used to be cout << inet_ntoa(cli.sin_addr) << buf right here: a locked, formatted write per
+        // datagram. Now it just copies a record into a ring, a background thread does the printing
+        log_recv(sockfd, &cli, buf->data(), n);
+        if (sendto(sockfd, buf->data(), n, 0, (sockaddr*)&cli, cli_len) < 0) {
             perror("sendto");
         }
+        pool.put(buf);
     } 
     
 // Whenever your process terminates—whether by returning from main(), calling exit(), or being killed by a signal like Ctrl-C—the kernel will automatically close all of its open file descriptors (including your UDP socket). So you won’t leave the socket “leaking” at the OS level once the process is gone.